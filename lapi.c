@@ -307,7 +307,7 @@ LUM_API int lum_isinteger (lum_State *L, int idx) {
 LUM_API int lum_isnumber (lum_State *L, int idx) {
   lum_Number n;
   const TValue *o = index2value(L, idx);
-  return tonumber(o, &n);
+  return tonumber(L, o, &n);
 }
 
 
@@ -389,7 +389,7 @@ LUM_API size_t lum_stringtonumber (lum_State *L, const char *s) {
 LUM_API lum_Number lum_tonumberx (lum_State *L, int idx, int *pisnum) {
   lum_Number n = 0;
   const TValue *o = index2value(L, idx);
-  int isnum = tonumber(o, &n);
+  int isnum = tonumber(L, o, &n);
   if (pisnum)
     *pisnum = isnum;
   return n;
@@ -399,7 +399,7 @@ LUM_API lum_Number lum_tonumberx (lum_State *L, int idx, int *pisnum) {
 LUM_API lum_Integer lum_tointegerx (lum_State *L, int idx, int *pisnum) {
   lum_Integer res = 0;
   const TValue *o = index2value(L, idx);
-  int isnum = tointeger(o, &res);
+  int isnum = tointeger(L, o, &res);
   if (pisnum)
     *pisnum = isnum;
   return res;
@@ -426,6 +426,8 @@ LUM_API const char *lum_tolstring (lum_State *L, int idx, size_t *len) {
     lumC_checkGC(L);
     o = index2value(L, idx);  /* previous call may reallocate the stack */
   }
+  else
+    lumS_flat(L, tsvalue(o));  /* a rope must be flattened */
   lum_unlock(L);
   if (len != NULL)
     return getlstr(tsvalue(o), *len);
@@ -969,6 +971,8 @@ LUM_API int lum_setmetatable (lum_State *L, int objindex) {
   }
   switch (ttype(obj)) {
     case LUM_TTABLE: {
+      if (isinchain(hvalue(obj)))
+        lumH_unchain(L, hvalue(obj));
       hvalue(obj)->metatable = mt;
       if (mt) {
         lumC_objbarrier(L, gcvalue(obj), mt);
@@ -1054,22 +1058,9 @@ LUM_API void lum_callk (lum_State *L, int nargs, int nresults,
 /*
 ** Execute a protected call.
 */
-struct CallS {  /* data to 'f_call' */
-  StkId func;
-  int nresults;
-};
-
-
-static void f_call (lum_State *L, void *ud) {
-  struct CallS *c = cast(struct CallS *, ud);
-  lumD_callnoyield(L, c->func, c->nresults);
-}
-
-
-
 LUM_API int lum_pcallk (lum_State *L, int nargs, int nresults, int errfunc,
                         lum_KContext ctx, lum_KFunction k) {
-  struct CallS c;
+  StkId f;
   TStatus status;
   ptrdiff_t func;
   lum_lock(L);
@@ -1085,22 +1076,24 @@ LUM_API int lum_pcallk (lum_State *L, int nargs, int nresults, int errfunc,
     api_check(L, ttisfunction(s2v(o)), "error handler must be a function");
     func = savestack(L, o);
   }
-  c.func = L->top.p - (nargs+1);  /* function to be called */
-  if (k == NULL || !yieldable(L)) {  /* no continuation or no yieldable? */
-    c.nresults = nresults;  /* do a 'conventional' protected call */
-    status = lumD_pcall(L, f_call, &c, savestack(L, c.func), func);
+  f = L->top.p - (nargs+1);  /* function to be called */
+  if (k == NULL || !recoverable(L)) {  /* no continuation or no recovery? */
+    /* do a 'conventional' protected call */
+    status = lumD_pcallrec(L, f, nresults, func);
   }
-  else {  /* prepare continuation (call is already protected by 'resume') */
+  else {  /* prepare continuation (call is already protected by 'resume'
+             or by an outer recover point) */
     CallInfo *ci = L->ci;
     ci->u.c.k = k;  /* save continuation */
     ci->u.c.ctx = ctx;  /* save context */
     /* save information for error recovery */
-    ci->u2.funcidx = cast_int(savestack(L, c.func));
+    ci->u2.funcidx = cast_int(savestack(L, f));
     ci->u.c.old_errfunc = L->errfunc;
+    ci->u.c.old_ndefers = L->ndefers;
     L->errfunc = func;
     setoah(ci, L->allowhook);  /* save value of 'allowhook' */
     ci->callstatus |= CIST_YPCALL;  /* function can do error recovery */
-    lumD_call(L, c.func, nresults);  /* do the call */
+    lumD_call(L, f, nresults);  /* do the call */
     ci->callstatus &= ~CIST_YPCALL;
     L->errfunc = ci->u.c.old_errfunc;
     status = LUM_OK;  /* if it is here, there were no errors */
@@ -1194,15 +1187,18 @@ LUM_API int lum_gc (lum_State *L, int what, ...) {
     }
     case LUM_GCSTEP: {
       lu_byte oldstp = g->gcstp;
+      int oldndefers = L->ndefers;
       l_mem n = cast(l_mem, va_arg(argp, size_t));
       int work = 0;  /* true if GC did some work */
       g->gcstp = 0;  /* allow GC to run (other bits must be zero here) */
+      L->ndefers = 0;  /* explicit steps are never postponed */
       if (n <= 0)
         n = g->GCdebt;  /* force to run one basic step */
       lumE_setdebt(g, g->GCdebt - n);
       lumC_condGC(L, (void)0, work = 1);
       if (work && g->gcstate == GCSpause)  /* end of cycle? */
         res = 1;  /* signal it */
+      L->ndefers = oldndefers;
       g->gcstp = oldstp;  /* restore previous state */
       break;
     }
@@ -1229,6 +1225,14 @@ LUM_API int lum_gc (lum_State *L, int what, ...) {
         g->gcparams[param] = lumO_codeparam(cast_uint(value));
       break;
     }
+    case LUM_GCBEGINDEFER: {
+      lumC_begindefer(L);
+      break;
+    }
+    case LUM_GCENDDEFER: {
+      res = lumC_enddefer(L);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   va_end(argp);
@@ -7,6 +7,10 @@
 #define lauxlib_c
 #define LUM_LIB
 
+#if defined(LUM_USE_LINUX) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* for 'mremap' and 'MAP_ANONYMOUS' */
+#endif
+
 #include "lprefix.h"
 
 
@@ -1046,6 +1050,91 @@ LUMLIB_API const char *lumL_gsub (lum_State *L, const char *s,
 }
 
 
+/*
+** {======================================================
+** Default allocator
+** =======================================================
+*/
+
+/*
+** Blocks with at least LUML_LARGEBLOCK bytes (huge strings, tables,
+** userdata, etc.) live in a separate space: each one is mapped
+** directly with 'mmap' and returned to the system with 'munmap' as
+** soon as it is freed. So, they do not fragment the 'malloc' heap, and
+** the process shrinks as soon as they die. ('malloc' may do something
+** similar on its own, but usually with a threshold that grows after
+** large blocks are freed.) The allocator does not need to mark these
+** blocks: Lum always gives the original size of a block when resizing
+** or freeing it, so that size tells where the block came from.
+*/
+
+#if !defined(LUML_LARGEBLOCK)
+#define LUML_LARGEBLOCK		(1u << 20)
+#endif
+
+
+#if defined(LUM_USE_POSIX)
+#include <sys/mman.h>
+#endif
+
+
+#if defined(MAP_ANONYMOUS) && LUML_LARGEBLOCK > 0	/* { */
+
+#define islarge(sz)	((sz) >= LUML_LARGEBLOCK)
+
+
+static void *largealloc (size_t size) {
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+
+static void *largerealloc (void *ptr, size_t osize, size_t nsize) {
+#if defined(LUM_USE_LINUX)
+  void *p = mremap(ptr, osize, nsize, MREMAP_MAYMOVE);
+  return (p == MAP_FAILED) ? NULL : p;
+#else
+  void *p = largealloc(nsize);
+  if (p != NULL) {
+    memcpy(p, ptr, (osize < nsize) ? osize : nsize);
+    munmap(ptr, osize);
+  }
+  return p;
+#endif
+}
+
+
+static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  (void)ud;  /* not used */
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is not a size for new blocks */
+  if (nsize == 0) {
+    if (islarge(osize))
+      munmap(ptr, osize);
+    else
+      free(ptr);
+    return NULL;
+  }
+  else if (!islarge(osize) && !islarge(nsize))  /* common case */
+    return realloc(ptr, nsize);
+  else if (islarge(osize) && islarge(nsize))
+    return largerealloc(ptr, osize, nsize);
+  else {  /* block moves between spaces */
+    void *p = islarge(nsize) ? largealloc(nsize) : malloc(nsize);
+    if (p != NULL && ptr != NULL) {
+      memcpy(p, ptr, (osize < nsize) ? osize : nsize);
+      if (islarge(osize))
+        munmap(ptr, osize);
+      else
+        free(ptr);
+    }
+    return p;
+  }
+}
+
+#else						/* }{ */
+
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   (void)ud; (void)osize;  /* not used */
   if (nsize == 0) {
@@ -1056,6 +1145,10 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
     return realloc(ptr, nsize);
 }
 
+#endif						/* } */
+
+/* }====================================================== */
+
 
 /*
 ** Standard panic function just prints an error message. The test
@@ -1177,8 +1270,7 @@ LUMLIB_API unsigned int lumL_makeseed (lum_State *L) {
 }
 
 
-LUMLIB_API lum_State *lumL_newstate (void) {
-  lum_State *L = lum_newstate(l_alloc, NULL, lumi_makeseed());
+static lum_State *setdefaults (lum_State *L) {
   if (l_likely(L)) {
     lum_atpanic(L, &panic);
     lum_setwarnf(L, warnfoff, L);  /* default is warnings off */
@@ -1187,6 +1279,16 @@ LUMLIB_API lum_State *lumL_newstate (void) {
 }
 
 
+LUMLIB_API lum_State *lumL_newstate (void) {
+  return setdefaults(lum_newstate(l_alloc, NULL, lumi_makeseed()));
+}
+
+
+LUMLIB_API lum_State *lumL_newpooledstate (const lum_StrPool *pool) {
+  return setdefaults(lum_newpooledstate(l_alloc, NULL, pool));
+}
+
+
 LUMLIB_API void lumL_checkversion_ (lum_State *L, lum_Number ver, size_t sz) {
   lum_Number v = lum_version(L);
   if (sz != LUML_NUMSIZES)  /* check numeric types */
@@ -99,6 +99,7 @@ LUMLIB_API int (lumL_loadbufferx) (lum_State *L, const char *buff, size_t sz,
 LUMLIB_API int (lumL_loadstring) (lum_State *L, const char *s);
 
 LUMLIB_API lum_State *(lumL_newstate) (void);
+LUMLIB_API lum_State *(lumL_newpooledstate) (const lum_StrPool *pool);
 
 LUMLIB_API unsigned lumL_makeseed (lum_State *L);
 
@@ -241,6 +242,30 @@ typedef struct lumL_Stream {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** String buffers for the string library
+** =======================================================
+*/
+
+/*
+** A string buffer is a userdata with metatable 'LUM_STRBUFFHANDLE' and
+** structure 'lumL_StrBuff'. Its contents are the first 'n' bytes of
+** block 'b', allocated with the allocator of the state.
+*/
+
+#define LUM_STRBUFFHANDLE       "STRBUFF*"
+
+
+typedef struct lumL_StrBuff {
+  char *b;  /* block with the contents (NULL if 'size' is 0) */
+  size_t size;  /* size of block 'b' */
+  size_t n;  /* number of bytes in use */
+} lumL_StrBuff;
+
+/* }====================================================== */
+
+
 /*
 ** {============================================================
 ** Compatibility with deprecated conversions
@@ -201,10 +201,10 @@ static int pushmode (lum_State *L, int oldmode) {
 static int lumB_collectgarbage (lum_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "isrunning", "generational", "incremental",
-    "param", NULL};
+    "param", "begindefer", "enddefer", NULL};
   static const char optsnum[] = {LUM_GCSTOP, LUM_GCRESTART, LUM_GCCOLLECT,
     LUM_GCCOUNT, LUM_GCSTEP, LUM_GCISRUNNING, LUM_GCGEN, LUM_GCINC,
-    LUM_GCPARAM};
+    LUM_GCPARAM, LUM_GCBEGINDEFER, LUM_GCENDDEFER};
   int o = optsnum[lumL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUM_GCCOUNT: {
@@ -221,7 +221,7 @@ static int lumB_collectgarbage (lum_State *L) {
       lum_pushboolean(L, res);
       return 1;
     }
-    case LUM_GCISRUNNING: {
+    case LUM_GCISRUNNING: case LUM_GCENDDEFER: {
       int res = lum_gc(L, o);
       checkvalres(res);
       lum_pushboolean(L, res);
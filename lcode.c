@@ -14,6 +14,7 @@
 #include <limits.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lum.h"
 
@@ -1866,6 +1867,1297 @@ static int finaltarget (Instruction *code, int i) {
 }
 
 
+/*
+** {======================================================================
+** Scalar replacement of tables
+** =======================================================================
+*/
+
+/*
+** A table created by the constructor of a local variable ('local p =
+** {...}') that is used only to read and write fields with constant
+** keys ('p.x', 'p[1]') cannot escape its function, so it can be
+** replaced by one register for each of its fields: the constructor
+** becomes a LOADNIL of these registers, and each field access becomes
+** a MOVE (or a LOADK). The new registers take the place of the
+** variable, so all registers above it are shifted up inside the scope
+** of the variable. Any other use of the variable's register (passing
+** it to a function, returning it, capturing it in a closure, etc.),
+** any instruction that uses a range of registers including it, or any
+** jump from outside into the scope of the variable, keeps the table.
+*/
+
+/* maximum number of fields in a replaced table */
+#define MAXSRFIELDS	16
+
+
+/* shift register in argument 'x' of '*i' if above 'r'; fail if it is 'r' */
+#define shiftarg(i,x,r,d)  \
+  { int v_ = GETARG_##x(*(i));  \
+    if (v_ == (r)) return 0;  \
+    else if (v_ > (r)) SETARG_##x(*(i), v_ + (d)); }
+
+
+/*
+** Shift by 'd' a range of 'n' registers starting at register A of
+** '*i', if that range is above register 'r'. ('n' < 0 means an open
+** range, up to the stack top.) Fail if the range includes 'r'.
+*/
+static int shiftrange (Instruction *i, int r, int d, int n) {
+  int a = GETARG_A(*i);
+  if (a > r)
+    SETARG_A(*i, a + d);
+  else if (n < 0 || a + n > r)
+    return 0;
+  return 1;
+}
+
+
+/*
+** Shift by 'd' all register operands of instruction '*i' above
+** register 'r'. Return false if the instruction uses register 'r' (or
+** a range of registers including it). With 'd' equal to zero, this
+** function only does the check.
+*/
+static int shiftregs (Instruction *i, int r, int d) {
+  switch (GET_OPCODE(*i)) {
+    case OP_MOVE: case OP_GETI: case OP_GETFIELD:
+    case OP_ADDI: case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK:
+    case OP_POWK: case OP_DIVK: case OP_IDIVK: case OP_BANDK:
+    case OP_BORK: case OP_BXORK: case OP_SHRI: case OP_SHLI:
+    case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+    case OP_EQ: case OP_LT: case OP_LE: case OP_TESTSET: case OP_MMBIN: {
+      shiftarg(i, A, r, d);
+      shiftarg(i, B, r, d);
+      return 1;
+    }
+    case OP_GETTABLE:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: {
+      shiftarg(i, A, r, d);
+      shiftarg(i, B, r, d);
+      shiftarg(i, C, r, d);
+      return 1;
+    }
+    case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADKX:
+    case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_GETUPVAL: case OP_SETUPVAL: case OP_GETTABUP:
+    case OP_NEWTABLE: case OP_MMBINI: case OP_MMBINK:
+    case OP_CLOSE: case OP_TBC: case OP_EQK: case OP_EQI: case OP_LTI:
+    case OP_LEI: case OP_GTI: case OP_GEI: case OP_TEST:
+    case OP_RETURN1: case OP_CLOSURE: {
+      shiftarg(i, A, r, d);
+      return 1;
+    }
+    case OP_SETTABLE: {
+      shiftarg(i, A, r, d);
+      shiftarg(i, B, r, d);
+      if (!TESTARG_k(*i)) shiftarg(i, C, r, d);
+      return 1;
+    }
+    case OP_SETI: case OP_SETFIELD: {
+      shiftarg(i, A, r, d);
+      if (!TESTARG_k(*i)) shiftarg(i, C, r, d);
+      return 1;
+    }
+    case OP_SETTABUP: {
+      if (!TESTARG_k(*i)) shiftarg(i, C, r, d);
+      return 1;
+    }
+    case OP_SELF: {
+      shiftarg(i, B, r, d);
+      return shiftrange(i, r, d, 2);
+    }
+    case OP_LOADNIL: return shiftrange(i, r, d, GETARG_B(*i) + 1);
+    case OP_CONCAT: return shiftrange(i, r, d, GETARG_B(*i));
+    case OP_CALL: {  /* arguments and results */
+      int b = GETARG_B(*i);
+      int c = GETARG_C(*i);
+      return shiftrange(i, r, d, (b == 0 || c == 0) ? -1
+                                 : (b > c - 1) ? b : c - 1);
+    }
+    case OP_TAILCALL: {
+      int b = GETARG_B(*i);
+      return shiftrange(i, r, d, (b == 0) ? -1 : b);
+    }
+    case OP_RETURN: return shiftrange(i, r, d, GETARG_B(*i) - 1);
+    case OP_RETURN0: return shiftrange(i, r, d, 0);
+    case OP_FORLOOP: case OP_FORPREP: return shiftrange(i, r, d, 3);
+    case OP_TFORPREP: case OP_TFORLOOP: return shiftrange(i, r, d, 4);
+    case OP_TFORCALL: {  /* uses R[A+3] to R[A+5] to call iterator */
+      int c = GETARG_C(*i);
+      return shiftrange(i, r, d, (c > 3) ? 3 + c : 6);
+    }
+    case OP_SETLIST: {
+      int b = GETARG_vB(*i);
+      return shiftrange(i, r, d, (b == 0) ? -1 : b + 1);
+    }
+    case OP_VARARG: return shiftrange(i, r, d, GETARG_C(*i) - 1);
+    case OP_JMP: case OP_VARARGPREP: case OP_EXTRAARG: return 1;
+    default: return 0;  /* unknown instruction */
+  }
+}
+
+
+/*
+** If instruction 'i' reads or writes a field with a constant key of
+** the table in register 'r', return that key coded as a non-negative
+** integer (constant index or integer key, plus a bit to tell them
+** apart). Otherwise, return -1.
+*/
+static int fieldkey (Instruction i, int r) {
+  switch (GET_OPCODE(i)) {
+    case OP_GETFIELD: case OP_GETI: {
+      if (GETARG_B(i) != r || GETARG_A(i) == r)
+        return -1;
+      return GETARG_C(i) * 2 + (GET_OPCODE(i) == OP_GETI);
+    }
+    case OP_SETFIELD: case OP_SETI: {
+      if (GETARG_A(i) != r || (!TESTARG_k(i) && GETARG_C(i) == r))
+        return -1;
+      return GETARG_B(i) * 2 + (GET_OPCODE(i) == OP_SETI);
+    }
+    default: return -1;
+  }
+}
+
+
+/*
+** Return the target of a jump at 'pc' (or of the skip done by a test),
+** or -1 if the instruction does not jump.
+*/
+static int jumptarget (Instruction *code, int pc) {
+  Instruction i = code[pc];
+  OpCode op = GET_OPCODE(i);
+  switch (op) {
+    case OP_JMP: return pc + 1 + GETARG_sJ(i);
+    case OP_FORPREP: return pc + 2 + GETARG_Bx(i);
+    case OP_TFORPREP: return pc + 1 + GETARG_Bx(i);
+    case OP_FORLOOP: case OP_TFORLOOP: return pc + 1 - GETARG_Bx(i);
+    case OP_LFALSESKIP: return pc + 2;
+    default: return (testTMode(op)) ? pc + 2 : -1;
+  }
+}
+
+
+/*
+** Return the register of local variable 'v' of function 'f' (which is
+** its position among the variables active when it starts).
+*/
+static int varregister (Proto *f, int v) {
+  int reg = 0;
+  int i;
+  for (i = 0; i < v; i++) {
+    if (f->locvars[i].startpc <= f->locvars[v].startpc &&
+        f->locvars[v].startpc < f->locvars[i].endpc)
+      reg++;
+  }
+  return reg;
+}
+
+
+/*
+** Find the local variable initialized by the table constructor at
+** 'pc' in register 'r': the first variable in that register starting
+** after 'pc'. Return -1 if there is none.
+*/
+static int findtablevar (FuncState *fs, int pc, int r) {
+  Proto *f = fs->f;
+  int v;
+  for (v = 0; v < fs->ndebugvars; v++) {
+    if (f->locvars[v].startpc > pc && varregister(f, v) == r)
+      return v;
+  }
+  return -1;
+}
+
+
+/*
+** Replace the entry of local variable 'v' in the debug information by
+** entries for the registers of its 'nf' fields, named 'v.key' (or
+** 'v[key]', for integer keys).
+*/
+static void fieldvars (FuncState *fs, int v, const int *keys, int nf) {
+  lum_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  LocVar var = f->locvars[v];
+  int n;
+  for (n = 0; n < nf; n++) {
+    TString *name;
+    int key = keys[n] >> 1;
+    if (keys[n] & 1)  /* integer key? */
+      lumO_pushfstring(L, "%s[%d]", getstr(var.varname), key);
+    else  /* 'ldebug.c' uses the dot to recognize a field */
+      lumO_pushfstring(L, "%s.%s", getstr(var.varname),
+                                   getstr(tsvalue(&f->k[key])));
+    name = tsvalue(s2v(L->top.p - 1));
+    if (n > 0) {  /* insert a new entry after previous one */
+      int oldsize = f->sizelocvars;
+      lumM_growvector(L, f->locvars, fs->ndebugvars, f->sizelocvars,
+                      LocVar, SHRT_MAX, "local variables");
+      while (oldsize < f->sizelocvars)
+        f->locvars[oldsize++].varname = NULL;
+      memmove(&f->locvars[v + n + 1], &f->locvars[v + n],
+              cast_sizet(fs->ndebugvars - v - n) * sizeof(LocVar));
+      fs->ndebugvars++;
+    }
+    f->locvars[v + n] = var;
+    f->locvars[v + n].varname = name;
+    lumC_objbarrier(L, f, name);
+    L->top.p--;  /* pop name */
+  }
+}
+
+
+/*
+** Try to replace the table created by the constructor at 'pc0'.
+*/
+static void replacetable (FuncState *fs, int pc0) {
+  Proto *f = fs->f;
+  Instruction *code = f->code;
+  int r = GETARG_A(code[pc0]);  /* register of the table */
+  int v = findtablevar(fs, pc0, r);
+  int keys[MAXSRFIELDS];
+  int nf = 0;  /* number of fields */
+  int end, pc, d;
+  if (v < 0)
+    return;
+  end = f->locvars[v].endpc;  /* table is dead after this point */
+  for (pc = pc0 + 2; pc < end; pc++) {  /* skip constructor */
+    Instruction i = code[pc];
+    int key = fieldkey(i, r);
+    if (key >= 0) {  /* a field access? */
+      int n = 0;
+      while (n < nf && keys[n] != key) n++;
+      if (n == nf) {  /* new field? */
+        if (nf == MAXSRFIELDS)
+          return;  /* too many fields */
+        keys[nf++] = key;
+      }
+    }
+    else if (!shiftregs(&i, r, 0))
+      return;  /* other use of the table */
+    else if (GET_OPCODE(i) == OP_CLOSURE) {
+      Proto *np = f->p[GETARG_Bx(i)];
+      int u;
+      for (u = 0; u < np->sizeupvalues; u++) {
+        if (np->upvalues[u].instack && np->upvalues[u].idx == r)
+          return;  /* table captured by a closure */
+      }
+    }
+  }
+  for (pc = 0; pc < fs->pc; pc++) {
+    if (pc < pc0 || pc >= end) {  /* outside variable's scope? */
+      int target = jumptarget(code, pc);
+      if (pc0 < target && target < end)
+        return;  /* jump into the scope */
+    }
+  }
+  d = nf - 1;  /* number of new registers */
+  if (nf == 0 || f->maxstacksize + d > MAX_FSTACK ||
+      fs->ndebugvars + d >= SHRT_MAX)
+    return;
+  /* do the replacement */
+  code[pc0] = CREATE_ABCk(OP_LOADNIL, r, d, 0, 0);
+  code[pc0 + 1] = CREATE_sJ(OP_JMP, OFFSET_sJ, 0);  /* no-op */
+  for (pc = pc0 + 2; pc < end; pc++) {
+    Instruction *i = &code[pc];
+    int key = fieldkey(*i, r);
+    if (key >= 0) {
+      int fr = r;  /* register of the field */
+      while (keys[fr - r] != key) fr++;
+      if (GET_OPCODE(*i) == OP_GETFIELD || GET_OPCODE(*i) == OP_GETI) {
+        int a = GETARG_A(*i);
+        *i = CREATE_ABCk(OP_MOVE, (a > r) ? a + d : a, fr, 0, 0);
+      }
+      else if (TESTARG_k(*i))  /* constant value? */
+        *i = CREATE_ABx(OP_LOADK, fr, GETARG_C(*i));
+      else {
+        int c = GETARG_C(*i);
+        *i = CREATE_ABCk(OP_MOVE, fr, (c > r) ? c + d : c, 0, 0);
+      }
+    }
+    else {
+      lum_assert(shiftregs(i, r, 0));
+      shiftregs(i, r, d);
+      if (GET_OPCODE(*i) == OP_CLOSURE) {  /* correct its upvalues */
+        Proto *np = f->p[GETARG_Bx(*i)];
+        int u;
+        for (u = 0; u < np->sizeupvalues; u++) {
+          if (np->upvalues[u].instack && np->upvalues[u].idx > r)
+            np->upvalues[u].idx = cast_byte(np->upvalues[u].idx + d);
+        }
+      }
+    }
+  }
+  f->maxstacksize = cast_byte(f->maxstacksize + d);
+  fieldvars(fs, v, keys, nf);
+}
+
+
+static void replacetables (FuncState *fs) {
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) {
+    if (GET_OPCODE(fs->f->code[pc]) == OP_NEWTABLE)
+      replacetable(fs, pc);
+  }
+}
+
+/* }====================================================================== */
+
+
+/*
+** {======================================================================
+** Inlining of local functions
+** =======================================================================
+*/
+
+/*
+** With load mode 'O', a call to a small function stored in a local
+** variable that is never assigned again ('local function f' or 'local
+** f = function') is replaced by a copy of the function's body, if the
+** call passes and expects fixed numbers of values. The copy uses the
+** registers of the arguments as its parameters and moves its results
+** to the register of the called function. Each inlined call is
+** recorded in 'inlineinfo', so that the debug interface can still show
+** it as a call (see 'ldebug.c').
+*/
+
+/* maximum size (in instructions) of an inlined function */
+#define MAXINLINESIZE	24
+
+/* maximum code growth due to inlining in a function of size 'n' */
+#define MAXINLINEGROWTH(n)	((n) < 256 ? 256 : (n))
+
+
+/* what to do with each instruction of the caller */
+#define IKEEP		0
+#define IDROP		1	/* move of the function to be called */
+#define ICALL		2	/* call to be inlined */
+
+
+static int isreturn (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (op == OP_RETURN || op == OP_RETURN0 || op == OP_RETURN1);
+}
+
+
+/*
+** Check whether the body of 'p' can run inside the frame of another
+** function: it cannot have varargs, closures, tail calls, or
+** to-be-closed variables, and it must return fixed numbers of values.
+*/
+static int inlinable (const Proto *p) {
+  int pc;
+  if ((p->flag & PF_ISVARARG) || p->sizecode > MAXINLINESIZE ||
+      p->sizep > 0 || p->sizeinlineinfo > 0)
+    return 0;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction i = p->code[pc];
+    switch (GET_OPCODE(i)) {
+      case OP_TAILCALL: case OP_VARARG: case OP_LOADKX:
+      case OP_CLOSE: case OP_TBC:
+        return 0;
+      case OP_RETURN: {
+        if (TESTARG_k(i) || GETARG_B(i) == 0)
+          return 0;
+        break;
+      }
+      default: {
+        if (!shiftregs(&i, -1, 0))
+          return 0;  /* unknown instruction */
+        break;
+      }
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Check whether function 'p' (or any function nested in it) can
+** assign to its upvalue 'uv'.
+*/
+static int writesupval (const Proto *p, int uv) {
+  int i;
+  for (i = 0; i < p->sizecode; i++) {
+    Instruction ins = p->code[i];
+    if (GET_OPCODE(ins) == OP_SETUPVAL && GETARG_B(ins) == uv)
+      return 1;
+  }
+  for (i = 0; i < p->sizep; i++) {
+    const Proto *np = p->p[i];
+    int u;
+    for (u = 0; u < np->sizeupvalues; u++) {
+      if (!np->upvalues[u].instack && np->upvalues[u].idx == uv &&
+          writesupval(np, u))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Check whether closure 'p' can assign to register 'r' of the function
+** creating it.
+*/
+static int closurewrites (const Proto *p, int r) {
+  int u;
+  for (u = 0; u < p->sizeupvalues; u++) {
+    if (p->upvalues[u].instack && p->upvalues[u].idx == r &&
+        writesupval(p, u))
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Check whether register 'r' keeps its value along the code in
+** [pc, end): no instruction there assigns to it, and no closure
+** created there assigns to it through an upvalue.
+*/
+static int keepsvalue (Proto *f, int r, int pc, int end) {
+  for (; pc < end; pc++) {
+    Instruction i = f->code[pc];
+    OpCode op = GET_OPCODE(i);
+    int a = GETARG_A(i);
+    switch (op) {
+      case OP_LOADNIL: {
+        if (a <= r && r <= a + GETARG_B(i))
+          return 0;
+        break;
+      }
+      case OP_CALL: case OP_TAILCALL: case OP_VARARG: case OP_TFORCALL: {
+        if (a <= r)
+          return 0;
+        break;
+      }
+      case OP_FORPREP: case OP_FORLOOP: case OP_TFORPREP: case OP_TFORLOOP: {
+        if (a <= r && r < a + 4)
+          return 0;
+        break;
+      }
+      case OP_CLOSURE: {
+        if (a == r || closurewrites(f->p[GETARG_Bx(i)], r))
+          return 0;
+        break;
+      }
+      default: {
+        if (testAMode(op) && a == r)
+          return 0;
+        break;
+      }
+    }
+  }
+  return 1;
+}
+
+
+/*
+** Return the index of the local variable in register 'r' at 'pc', or
+** -1 if there is none.
+*/
+static int activevar (Proto *f, int nvars, int r, int pc) {
+  int v;
+  for (v = 0; v < nvars && f->locvars[v].startpc <= pc; v++) {
+    if (pc < f->locvars[v].endpc) {  /* is variable active? */
+      if (r-- == 0)
+        return v;
+    }
+  }
+  return -1;
+}
+
+
+/*
+** Find the instruction that loads the function called by the OP_CALL
+** at 'pc': a 'MOVE t r' with no other use of register 't' between it
+** and the call. Return its position or -1.
+*/
+static int findfuncmove (Instruction *code, int start, int pc, int r) {
+  int t = GETARG_A(code[pc]);
+  int q;
+  for (q = pc - 1; q > start; q--) {
+    Instruction i = code[q];
+    if (GET_OPCODE(i) == OP_MOVE && GETARG_A(i) == t)
+      return (GETARG_B(i) == r) ? q : -1;
+    if (!shiftregs(&i, t, 0))
+      return -1;  /* other use of register 't' (or unknown instruction) */
+  }
+  return -1;
+}
+
+
+/*
+** Add to the current function a copy of constant 'v' (from another
+** function) and return its index.
+*/
+static int copyk (FuncState *fs, const TValue *v) {
+  switch (ttypetag(v)) {
+    case LUM_VSHRSTR: case LUM_VLNGSTR: return stringK(fs, tsvalue(v));
+    case LUM_VNUMINT: return lumK_intK(fs, ivalue(v));
+    case LUM_VNUMFLT: return lumK_numberK(fs, fltvalue(v));
+    case LUM_VFALSE: return boolF(fs);
+    case LUM_VTRUE: return boolT(fs);
+    default: lum_assert(ttisnil(v)); return nilK(fs);
+  }
+}
+
+
+/* set a constant operand, failing if it does not fit in its field */
+#define setkarg(i,x,kmap,max)  \
+  { int k_ = (kmap)[GETARG_##x(*(i))];  \
+    if (k_ > (max)) return 0;  \
+    SETARG_##x(*(i), k_); }
+
+
+/*
+** Translate the constant operands of instruction '*i' through 'kmap'.
+** Return false if a new index does not fit in its field.
+*/
+static int remapk (Instruction *i, const int *kmap) {
+  switch (GET_OPCODE(*i)) {
+    case OP_LOADK: setkarg(i, Bx, kmap, MAXARG_Bx); break;
+    case OP_GETTABUP: case OP_GETFIELD: case OP_SELF:
+    case OP_ADDK: case OP_SUBK: case OP_MULK: case OP_MODK: case OP_POWK:
+    case OP_DIVK: case OP_IDIVK: case OP_BANDK: case OP_BORK:
+    case OP_BXORK:
+      setkarg(i, C, kmap, MAXARG_C);
+      break;
+    case OP_SETTABUP: case OP_SETFIELD: {
+      setkarg(i, B, kmap, MAXARG_B);
+      if (TESTARG_k(*i)) setkarg(i, C, kmap, MAXARG_C);
+      break;
+    }
+    case OP_SETTABLE: case OP_SETI: {
+      if (TESTARG_k(*i)) setkarg(i, C, kmap, MAXARG_C);
+      break;
+    }
+    case OP_EQK: case OP_MMBINK: setkarg(i, B, kmap, MAXARG_B); break;
+    default: break;
+  }
+  return 1;
+}
+
+
+/*
+** Translate the upvalues used by instruction '*i' of function 'p' to
+** the function where it is being inlined: upvalues that are local
+** variables there become registers.
+*/
+static void remapupval (Instruction *i, const Proto *p) {
+  switch (GET_OPCODE(*i)) {
+    case OP_GETUPVAL: {
+      const Upvaldesc *uv = &p->upvalues[GETARG_B(*i)];
+      if (uv->instack)
+        *i = CREATE_ABCk(OP_MOVE, GETARG_A(*i), uv->idx, 0, 0);
+      else
+        SETARG_B(*i, uv->idx);
+      break;
+    }
+    case OP_SETUPVAL: {
+      const Upvaldesc *uv = &p->upvalues[GETARG_B(*i)];
+      if (uv->instack)
+        *i = CREATE_ABCk(OP_MOVE, uv->idx, GETARG_A(*i), 0, 0);
+      else
+        SETARG_B(*i, uv->idx);
+      break;
+    }
+    case OP_GETTABUP: {
+      const Upvaldesc *uv = &p->upvalues[GETARG_B(*i)];
+      if (uv->instack)
+        SET_OPCODE(*i, OP_GETFIELD);
+      SETARG_B(*i, uv->idx);
+      break;
+    }
+    case OP_SETTABUP: {
+      const Upvaldesc *uv = &p->upvalues[GETARG_A(*i)];
+      if (uv->instack)
+        SET_OPCODE(*i, OP_SETFIELD);
+      SETARG_A(*i, uv->idx);
+      break;
+    }
+    default: break;
+  }
+}
+
+
+/*
+** Number of instructions that replace the return 'i' (the last one in
+** the function if 'last') in a call with 'nres' results: moves of the
+** results, a LOADNIL for missing results, and a jump to the end.
+*/
+static int retsize (Instruction i, int nres, int last) {
+  int n;  /* number of values returned */
+  switch (GET_OPCODE(i)) {
+    case OP_RETURN0: n = 0; break;
+    case OP_RETURN1: n = 1; break;
+    default: n = GETARG_B(i) - 1; break;
+  }
+  return ((n < nres) ? n + 1 : nres) + !last;
+}
+
+
+/*
+** Compute the position, relative to the start of the inlined body, of
+** each instruction of 'p' in a call with 'nargs' arguments and 'nres'
+** results. Return the size of the inlined body.
+*/
+static int layoutbody (const Proto *p, int nargs, int nres, int *bodypc) {
+  int size = (nargs < p->numparams);  /* LOADNIL for missing parameters */
+  int pc;
+  for (pc = 0; pc < p->sizecode; pc++) {
+    Instruction i = p->code[pc];
+    bodypc[pc] = size;
+    size += isreturn(i) ? retsize(i, nres, pc == p->sizecode - 1) : 1;
+  }
+  bodypc[p->sizecode] = size;
+  return size;
+}
+
+
+/* state of the inlining of one function */
+typedef struct InlineState {
+  FuncState *fs;
+  Proto *p;  /* function being inlined */
+  int pidx;  /* index of 'p' in the caller's list of prototypes */
+  int reg;  /* register of the variable with the function */
+  int *kmap;  /* indices in the caller of the constants of 'p' */
+  int *bodypc;  /* layout of an inlined body */
+  lu_byte *mark;  /* what to do with each instruction of the caller */
+  int *newpc;  /* new position of each instruction of the caller */
+  int *line;  /* line of each instruction of the caller */
+  Instruction *ncode;  /* new code */
+  int *nline;  /* line of each instruction in the new code */
+} InlineState;
+
+
+/*
+** Copy into the new code, starting at 'at', the body of the function
+** for the call at 'pc'.
+*/
+static void emitbody (InlineState *is, int pc, int at) {
+  const Proto *p = is->p;
+  Instruction call = is->fs->f->code[pc];
+  int t = GETARG_A(call);  /* register of the function */
+  int base = t + 1;  /* register of first parameter */
+  int nargs = GETARG_B(call) - 1;
+  int nres = GETARG_C(call) - 1;
+  int end = at + layoutbody(p, nargs, nres, is->bodypc);
+  int n = at;  /* next position in the new code */
+  int ppc;
+  if (nargs < p->numparams) {  /* complete missing parameters */
+    is->ncode[n] = CREATE_ABCk(OP_LOADNIL, base + nargs,
+                               p->numparams - nargs - 1, 0, 0);
+    is->nline[n++] = is->line[pc];
+  }
+  for (ppc = 0; ppc < p->sizecode; ppc++) {
+    Instruction i = p->code[ppc];
+    int line = lumG_getfuncline(p, ppc);
+    if (isreturn(i)) {
+      int a = base + GETARG_A(i);
+      int nv = (GET_OPCODE(i) == OP_RETURN0) ? 0
+             : (GET_OPCODE(i) == OP_RETURN1) ? 1 : GETARG_B(i) - 1;
+      int k;
+      for (k = 0; k < nres && k < nv; k++) {  /* move results */
+        is->ncode[n] = CREATE_ABCk(OP_MOVE, t + k, a + k, 0, 0);
+        is->nline[n++] = line;
+      }
+      if (nres > nv) {  /* complete missing results */
+        is->ncode[n] = CREATE_ABCk(OP_LOADNIL, t + nv, nres - nv - 1, 0, 0);
+        is->nline[n++] = line;
+      }
+      if (ppc < p->sizecode - 1) {  /* not the last instruction? */
+        is->ncode[n] = CREATE_sJ(OP_JMP, end - (n + 1) + OFFSET_sJ, 0);
+        is->nline[n++] = line;
+      }
+    }
+    else {
+      int target = jumptarget(p->code, ppc);
+      int ntarget = (target >= 0) ? at + is->bodypc[target] : -1;
+      shiftregs(&i, -1, base);
+      remapk(&i, is->kmap);
+      remapupval(&i, p);
+      switch (GET_OPCODE(i)) {
+        case OP_JMP: SETARG_sJ(i, ntarget - (n + 1)); break;
+        case OP_FORPREP: SETARG_Bx(i, ntarget - (n + 2)); break;
+        case OP_TFORPREP: SETARG_Bx(i, ntarget - (n + 1)); break;
+        case OP_FORLOOP: case OP_TFORLOOP:
+          SETARG_Bx(i, (n + 1) - ntarget);
+          break;
+        default: break;
+      }
+      is->ncode[n] = i;
+      is->nline[n++] = line;
+    }
+  }
+  lum_assert(n == end);
+}
+
+
+/*
+** Replace the code of the current function by the new code, with the
+** inlined calls, and correct all its debug information.
+*/
+static void replacecode (InlineState *is, int newn, int ncalls) {
+  FuncState *fs = is->fs;
+  lum_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int pc, v, e;
+  int nentries = f->sizeinlineinfo + ncalls;
+  if (f->sizecode < newn) {
+    f->code = lumM_reallocvector(L, f->code, f->sizecode, newn, Instruction);
+    f->sizecode = newn;
+  }
+  if (f->sizelineinfo < newn) {
+    f->lineinfo = lumM_reallocvector(L, f->lineinfo, f->sizelineinfo, newn,
+                                     ls_byte);
+    f->sizelineinfo = newn;
+  }
+  f->inlineinfo = lumM_reallocvector(L, f->inlineinfo, f->sizeinlineinfo,
+                                     nentries, InlineInfo);
+  for (e = 0; e < f->sizeinlineinfo; e++) {  /* correct old entries */
+    f->inlineinfo[e].startpc = is->newpc[f->inlineinfo[e].startpc];
+    f->inlineinfo[e].endpc = is->newpc[f->inlineinfo[e].endpc];
+  }
+  for (pc = 0; pc < n; pc++) {  /* add new entries, keeping them sorted */
+    if (is->mark[pc] == ICALL) {
+      InlineInfo ii;
+      Instruction call = f->code[pc];
+      ii.startpc = is->newpc[pc];
+      ii.endpc = is->newpc[pc + 1];
+      ii.line = is->line[pc];
+      ii.proto = is->pidx;
+      ii.reg = cast_byte(is->reg);
+      ii.base = cast_byte(GETARG_A(call) + 1);
+      for (e = f->sizeinlineinfo;
+           e > 0 && f->inlineinfo[e - 1].startpc > ii.startpc; e--)
+        f->inlineinfo[e] = f->inlineinfo[e - 1];
+      f->inlineinfo[e] = ii;
+      f->sizeinlineinfo++;
+    }
+  }
+  lum_assert(f->sizeinlineinfo == nentries);
+  for (v = 0; v < fs->ndebugvars; v++) {
+    f->locvars[v].startpc = is->newpc[f->locvars[v].startpc];
+    f->locvars[v].endpc = is->newpc[f->locvars[v].endpc];
+  }
+  fs->previousline = f->linedefined;
+  fs->iwthabs = 0;
+  fs->nabslineinfo = 0;
+  for (pc = 0; pc < newn; pc++) {
+    f->code[pc] = is->ncode[pc];
+    fs->pc = pc + 1;
+    savelineinfo(fs, f, is->nline[pc]);
+  }
+}
+
+
+/*
+** Build the new code of the current function, with the marked calls
+** replaced by the body of the inlined function.
+*/
+static void buildcode (InlineState *is) {
+  Instruction *code = is->fs->f->code;
+  int n = is->fs->pc;
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    int np = is->newpc[pc];
+    if (is->mark[pc] == ICALL)
+      emitbody(is, pc, np);
+    else if (is->mark[pc] == IKEEP) {
+      Instruction i = code[pc];
+      int target = jumptarget(code, pc);
+      switch (GET_OPCODE(i)) {
+        case OP_JMP:
+          SETARG_sJ(i, is->newpc[target] - (np + 1));
+          break;
+        case OP_FORPREP:
+          SETARG_Bx(i, is->newpc[target] - (np + 2));
+          break;
+        case OP_TFORPREP:
+          SETARG_Bx(i, is->newpc[target] - (np + 1));
+          break;
+        case OP_FORLOOP: case OP_TFORLOOP:
+          SETARG_Bx(i, (np + 1) - is->newpc[target]);
+          break;
+        default: break;
+      }
+      is->ncode[np] = i;
+      is->nline[np] = is->line[pc];
+    }
+  }
+}
+
+
+/* allocate an anchored block of memory for temporary data */
+static void *tempblock (lum_State *L, size_t size) {
+  Udata *u = lumS_newudata(L, size, 0);
+  setuvalue(L, s2v(L->top.p), u);  /* anchor it */
+  lumD_inctop(L);
+  return getudatamem(u);
+}
+
+
+/*
+** Mark the calls to the function created at 'pc0' that can be inlined,
+** while the code growth fits in '*budget'. Return the number of those
+** calls and update '*budget'.
+*/
+static int markcalls (InlineState *is, int pc0, int end, int *budget) {
+  Instruction *code = is->fs->f->code;
+  int ncalls = 0;
+  int pc;
+  for (pc = pc0 + 1; pc < end; pc++) {
+    Instruction i = code[pc];
+    if (GET_OPCODE(i) == OP_CALL && GETARG_B(i) != 0 && GETARG_C(i) != 0 &&
+        GETARG_A(i) + 1 + is->p->maxstacksize <= MAX_FSTACK) {
+      int mv = findfuncmove(code, pc0, pc, is->reg);
+      if (mv >= 0) {
+        int size = layoutbody(is->p, GETARG_B(i) - 1, GETARG_C(i) - 1,
+                              is->bodypc);
+        if (size - 2 > *budget)
+          break;  /* budget exhausted */
+        *budget -= size - 2;
+        is->mark[mv] = IDROP;
+        is->mark[pc] = ICALL;
+        ncalls++;
+      }
+    }
+  }
+  return ncalls;
+}
+
+
+/*
+** Compute the new position and the line of each instruction of the
+** current function, and correct its maximum stack size. Return the
+** size of the new code.
+*/
+static int layoutcode (InlineState *is) {
+  Proto *f = is->fs->f;
+  int n = is->fs->pc;
+  int line = f->linedefined;
+  int nabs = 0;
+  int newn = 0;
+  int pc;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    is->newpc[pc] = newn;
+    if (is->mark[pc] == IKEEP)
+      newn++;
+    else if (is->mark[pc] == ICALL) {
+      int top = GETARG_A(i) + 1 + is->p->maxstacksize;
+      newn += layoutbody(is->p, GETARG_B(i) - 1, GETARG_C(i) - 1,
+                         is->bodypc);
+      if (top > f->maxstacksize)
+        f->maxstacksize = cast_byte(top);
+    }
+    if (f->lineinfo[pc] == ABSLINEINFO)
+      line = f->abslineinfo[nabs++].line;
+    else
+      line += f->lineinfo[pc];
+    is->line[pc] = line;
+  }
+  is->newpc[n] = newn;
+  return newn;
+}
+
+
+/*
+** Try to inline the calls to the function created by the OP_CLOSURE at
+** 'pc0'. (When a constant does not fit, the budget for these calls is
+** lost; that is rare enough.)
+*/
+static void inlinefunc (FuncState *fs, int pc0, int *budget) {
+  lum_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  InlineState is;
+  int n = fs->pc;
+  int v, end, ncalls, k;
+  is.fs = fs;
+  is.pidx = GETARG_Bx(f->code[pc0]);
+  is.p = f->p[is.pidx];
+  is.reg = GETARG_A(f->code[pc0]);
+  v = activevar(f, fs->ndebugvars, is.reg, pc0 + 1);
+  if (v < 0 || !inlinable(is.p) || closurewrites(is.p, is.reg))
+    return;
+  end = f->locvars[v].endpc;
+  if (!keepsvalue(f, is.reg, pc0 + 1, end))
+    return;
+  is.newpc = cast(int *,
+      tempblock(L, (cast_sizet(n + 1) * 2 + cast_sizet(is.p->sizecode + 1) +
+                    cast_sizet(is.p->sizek)) * sizeof(int) +
+                   cast_sizet(n + 1)));
+  is.line = is.newpc + (n + 1);
+  is.bodypc = is.line + (n + 1);
+  is.kmap = is.bodypc + (is.p->sizecode + 1);
+  is.mark = cast(lu_byte *, is.kmap + is.p->sizek);
+  memset(is.mark, IKEEP, cast_sizet(n + 1));
+  ncalls = markcalls(&is, pc0, end, budget);
+  for (k = 0; ncalls > 0 && k < is.p->sizek; k++)
+    is.kmap[k] = copyk(fs, &is.p->k[k]);
+  for (k = 0; ncalls > 0 && k < is.p->sizecode; k++) {
+    Instruction i = is.p->code[k];
+    if (!remapk(&i, is.kmap))
+      ncalls = 0;  /* constant index does not fit in its field */
+  }
+  if (ncalls > 0) {
+    int newn = layoutcode(&is);
+    is.ncode = cast(Instruction *,
+                    tempblock(L, cast_sizet(newn) *
+                                 (sizeof(Instruction) + sizeof(int))));
+    is.nline = cast(int *, is.ncode + newn);
+    buildcode(&is);
+    replacecode(&is, newn, ncalls);
+    L->top.p--;  /* remove new code */
+  }
+  L->top.p--;  /* remove temporary data */
+}
+
+
+static void inlinecalls (FuncState *fs) {
+  int budget = MAXINLINEGROWTH(fs->pc);
+  int pc;
+  for (pc = 0; pc < fs->pc; pc++) {
+    if (GET_OPCODE(fs->f->code[pc]) == OP_CLOSURE)
+      inlinefunc(fs, pc, &budget);
+  }
+}
+
+/* }====================================================================== */
+
+
+/*
+** {======================================================================
+** Optimizer
+** =======================================================================
+*/
+
+/*
+** An optional pass over the final code of a function (load mode 'O').
+** It replaces jumps to returns by copies of these returns and removes
+** unreachable code, jumps to the next instruction, moves that undo the
+** previous move, and simple loads whose registers are overwritten
+** before being read. The remaining instructions are then squeezed
+** together, recomputing jump offsets, line information, and the
+** ranges of local variables.
+*/
+
+/* information about each instruction */
+typedef struct OptInfo {
+  int line;  /* source line */
+  int nactive;  /* number of active local variables */
+  int newpc;  /* position in the optimized code */
+  lu_byte reached;  /* instruction is reachable */
+  lu_byte target;  /* instruction is a jump target */
+  lu_byte removed;  /* instruction will be removed */
+} OptInfo;
+
+
+/* maximum number of instructions scanned to prove a load dead */
+#define MAXDEADWINDOW	8
+
+
+/*
+** Instruction 'i' may skip the next one, so that next instruction
+** cannot be removed.
+*/
+static int skipsnext (Instruction i) {
+  return (testTMode(GET_OPCODE(i)) || GET_OPCODE(i) == OP_LFALSESKIP);
+}
+
+
+/*
+** Whether instruction 'pc' is a jump that can be changed or removed
+** (that is, it is not the jump of a conditional instruction).
+*/
+static int isplainjump (Instruction *code, int pc) {
+  return (GET_OPCODE(code[pc]) == OP_JMP &&
+          (pc == 0 || !skipsnext(code[pc - 1])));
+}
+
+
+/*
+** Fill 'succ' with the successors of the instruction at 'pc' and
+** return their number.
+*/
+static int successors (Instruction *code, int pc, int *succ) {
+  Instruction i = code[pc];
+  switch (GET_OPCODE(i)) {
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1: return 0;
+    case OP_JMP: case OP_LFALSESKIP: case OP_TFORPREP: {
+      succ[0] = jumptarget(code, pc);
+      return 1;
+    }
+    default: {
+      int target = jumptarget(code, pc);
+      succ[0] = pc + 1;
+      if (target < 0) return 1;
+      succ[1] = target;
+      return 2;
+    }
+  }
+}
+
+
+/*
+** Mark all instructions reachable from the first one, using 'stack'
+** as the work list.
+*/
+static void markreachable (Instruction *code, OptInfo *oi, int *stack) {
+  int top = 0;
+  stack[top++] = 0;
+  oi[0].reached = 1;
+  while (top > 0) {
+    int succ[2];
+    int pc = stack[--top];
+    int ns = successors(code, pc, succ);
+    while (ns-- > 0) {
+      if (!oi[succ[ns]].reached) {
+        oi[succ[ns]].reached = 1;
+        stack[top++] = succ[ns];
+      }
+    }
+  }
+}
+
+
+/*
+** Check whether the simple load at 'pc' is dead, that is, whether its
+** registers are overwritten by the next few instructions (in the same
+** basic block) before being read. The registers must not belong to
+** active variables, so that the change is invisible to the debug
+** library.
+*/
+static int deadload (Instruction *code, OptInfo *oi, int n, int pc) {
+  int a = GETARG_A(code[pc]);
+  int nr = (GET_OPCODE(code[pc]) == OP_LOADNIL) ? GETARG_B(code[pc]) + 1
+                                                 : 1;
+  unsigned int pending;  /* registers not yet overwritten */
+  int q;
+  if (nr > 16)
+    return 0;
+  pending = (1u << nr) - 1;
+  for (q = pc + 1; q < n && q <= pc + MAXDEADWINDOW; q++) {
+    Instruction i = code[q];
+    int w = 1;  /* number of registers written by 'i' */
+    int r;
+    if (oi[q].target || a < oi[q].nactive)
+      return 0;
+    switch (GET_OPCODE(i)) {
+      case OP_MOVE: {
+        r = GETARG_B(i) - a;
+        if (0 <= r && r < nr && (pending & (1u << r)))
+          return 0;  /* register is read */
+        break;
+      }
+      case OP_LOADNIL: w = GETARG_B(i) + 1; break;
+      case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADFALSE:
+      case OP_LOADTRUE: case OP_GETUPVAL: break;
+      case OP_JMP: {
+        if (GETARG_sJ(i) != 0)
+          return 0;
+        w = 0;  /* a jump to the next instruction does nothing */
+        break;
+      }
+      default: return 0;  /* unknown effects */
+    }
+    for (r = GETARG_A(i); r < GETARG_A(i) + w; r++) {
+      if (a <= r && r < a + nr)
+        pending &= ~(1u << (r - a));
+    }
+    if (pending == 0)
+      return 1;
+  }
+  return 0;
+}
+
+
+/*
+** Whether the instruction at 'pc' can be removed without changing
+** what the function does.
+*/
+static int uselessinstr (Instruction *code, OptInfo *oi, int n, int pc) {
+  Instruction i = code[pc];
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: {
+      Instruction prev = code[(pc > 0) ? pc - 1 : 0];
+      if (GETARG_A(i) == GETARG_B(i))
+        return 1;
+      if (pc > 0 && !oi[pc].target && !oi[pc - 1].removed &&
+          GET_OPCODE(prev) == OP_MOVE &&
+          GETARG_A(prev) == GETARG_B(i) && GETARG_B(prev) == GETARG_A(i))
+        return 1;  /* undoes the previous move */
+      return deadload(code, oi, n, pc);
+    }
+    case OP_LOADNIL: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADFALSE: case OP_LOADTRUE: case OP_GETUPVAL:
+      return deadload(code, oi, n, pc);
+    default: return 0;
+  }
+}
+
+
+/*
+** Compute the new positions of all instructions. A removed
+** instruction gets the position of the next one kept. Return the new
+** size of the code.
+*/
+static int newpositions (OptInfo *oi, int n) {
+  int pc;
+  int np = 0;
+  for (pc = 0; pc < n; pc++) {
+    oi[pc].newpc = np;
+    if (!oi[pc].removed) np++;
+  }
+  oi[n].newpc = np;
+  return np;
+}
+
+
+/*
+** Remove jumps to the next kept instruction, repeating while that
+** creates new opportunities.
+*/
+static void removenextjumps (Instruction *code, OptInfo *oi, int n) {
+  int changed;
+  do {
+    int pc;
+    changed = 0;
+    newpositions(oi, n);
+    for (pc = 0; pc < n; pc++) {
+      if (!oi[pc].removed && isplainjump(code, pc) &&
+          oi[jumptarget(code, pc)].newpc == oi[pc].newpc + 1) {
+        oi[pc].removed = 1;
+        changed = 1;
+      }
+    }
+  } while (changed);
+}
+
+
+/*
+** Compute line and number of active variables for each instruction.
+*/
+static void collectinfo (FuncState *fs, OptInfo *oi, int n) {
+  Proto *f = fs->f;
+  int line = f->linedefined;
+  int nabs = 0;
+  int pc, v;
+  for (v = 0; v < fs->ndebugvars; v++) {
+    oi[f->locvars[v].startpc].nactive++;
+    oi[f->locvars[v].endpc].nactive--;
+  }
+  for (pc = 0; pc < n; pc++) {
+    if (f->lineinfo[pc] == ABSLINEINFO) {
+      lum_assert(f->abslineinfo[nabs].pc == pc);
+      line = f->abslineinfo[nabs++].line;
+    }
+    else
+      line += f->lineinfo[pc];
+    oi[pc].line = line;
+    if (pc > 0)
+      oi[pc].nactive += oi[pc - 1].nactive;
+  }
+}
+
+
+/*
+** Move kept instructions to their new positions, correcting their jump
+** offsets and rebuilding line information and variable ranges.
+*/
+static void compactcode (FuncState *fs, OptInfo *oi, int n) {
+  Proto *f = fs->f;
+  Instruction *code = f->code;
+  int pc, v;
+  fs->previousline = f->linedefined;
+  fs->iwthabs = 0;
+  fs->nabslineinfo = 0;
+  for (pc = 0; pc < n; pc++) {
+    if (!oi[pc].removed) {
+      Instruction i = code[pc];
+      int np = oi[pc].newpc;
+      int target = jumptarget(code, pc);
+      switch (GET_OPCODE(i)) {
+        case OP_JMP:
+          SETARG_sJ(i, oi[target].newpc - (np + 1));
+          break;
+        case OP_FORPREP:
+          SETARG_Bx(i, oi[target].newpc - (np + 2));
+          break;
+        case OP_TFORPREP:
+          SETARG_Bx(i, oi[target].newpc - (np + 1));
+          break;
+        case OP_FORLOOP: case OP_TFORLOOP:
+          SETARG_Bx(i, (np + 1) - oi[target].newpc);
+          break;
+        default: break;
+      }
+      code[np] = i;
+      fs->pc = np + 1;
+      savelineinfo(fs, f, oi[pc].line);
+    }
+  }
+  fs->pc = oi[n].newpc;
+  for (v = 0; v < fs->ndebugvars; v++) {
+    f->locvars[v].startpc = oi[f->locvars[v].startpc].newpc;
+    f->locvars[v].endpc = oi[f->locvars[v].endpc].newpc;
+  }
+  for (v = 0; v < f->sizeinlineinfo; v++) {
+    f->inlineinfo[v].startpc = oi[f->inlineinfo[v].startpc].newpc;
+    f->inlineinfo[v].endpc = oi[f->inlineinfo[v].endpc].newpc;
+  }
+}
+
+
+static void optimize (FuncState *fs) {
+  lum_State *L = fs->ls->L;
+  Instruction *code = fs->f->code;
+  int n = fs->pc;
+  size_t size = cast_sizet(n + 1) * sizeof(OptInfo) +
+                cast_sizet(n) * sizeof(int);
+  Udata *u = lumS_newudata(L, size, 0);  /* memory for 'oi' and stack */
+  OptInfo *oi = cast(OptInfo *, getudatamem(u));
+  int *stack = cast(int *, oi + n + 1);
+  int pc;
+  setuvalue(L, s2v(L->top.p), u);  /* anchor it */
+  lumD_inctop(L);
+  memset(oi, 0, cast_sizet(n + 1) * sizeof(OptInfo));
+  for (pc = 0; pc < n; pc++) {  /* jump directly to returns */
+    if (isplainjump(code, pc)) {
+      Instruction ret = code[jumptarget(code, pc)];
+      OpCode op = GET_OPCODE(ret);
+      if ((op == OP_RETURN0 || op == OP_RETURN1 || op == OP_RETURN) &&
+          !lumP_isIT(ret))
+        code[pc] = ret;
+    }
+  }
+  markreachable(code, oi, stack);
+  for (pc = 0; pc < n; pc++) {
+    int target = jumptarget(code, pc);
+    if (oi[pc].reached && target >= 0 && target != pc + 1)
+      oi[target].target = 1;  /* (a jump to next is not a real target) */
+  }
+  collectinfo(fs, oi, n);
+  for (pc = 0; pc < n; pc++) {
+    if (pc > 0 && !oi[pc - 1].removed && skipsnext(code[pc - 1]))
+      continue;  /* keep instruction that can be skipped by previous one */
+    oi[pc].removed = !oi[pc].reached || uselessinstr(code, oi, n, pc);
+  }
+  removenextjumps(code, oi, n);
+  if (oi[n].newpc < n)  /* removed something? */
+    compactcode(fs, oi, n);
+  L->top.p--;  /* remove 'u' */
+}
+
+/* }====================================================================== */
+
+
 /*
 ** Do a final pass over the code of a function, doing small peephole
 ** optimizations and adjustments.
@@ -1874,6 +3166,9 @@ static int finaltarget (Instruction *code, int i) {
 void lumK_finish (FuncState *fs) {
   int i;
   Proto *p = fs->f;
+  replacetables(fs);
+  if (fs->ls->optimize)
+    inlinecalls(fs);
   for (i = 0; i < fs->pc; i++) {
     Instruction *pc = &p->code[i];
     /* avoid "not used" warnings when assert is off (for 'onelum.c') */
@@ -1901,4 +3196,6 @@ void lumK_finish (FuncState *fs) {
       default: break;
     }
   }
+  if (fs->ls->optimize)
+    optimize(fs);
 }
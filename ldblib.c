@@ -449,11 +449,68 @@ static int db_traceback (lum_State *L) {
 }
 
 
+/*
+** Writer for heap snapshots: writes directly to the file, so that
+** taking a snapshot does not need memory from the Lum heap.
+*/
+static int snapwriter (lum_State *L, const void *b, size_t size, void *f) {
+  (void)L;  /* not used */
+  return (fwrite(b, 1, size, (FILE *)f) != size);
+}
+
+
+static int db_heapsnapshot (lum_State *L) {
+  const char *fname = lumL_checkstring(L, 1);
+  FILE *f = fopen(fname, "wb");
+  int ok;
+  if (f == NULL)
+    return lumL_fileresult(L, 0, fname);
+  ok = (lum_heapsnapshot(L, snapwriter, f) == 0);
+  ok = (fclose(f) == 0) && ok;
+  return lumL_fileresult(L, ok, fname);
+}
+
+
+static int db_allocprofile (lum_State *L) {
+  lum_Integer rate = lumL_optinteger(L, 1, 0);
+  lumL_argcheck(L, rate >= 0, 1, "negative rate");
+  lum_pushboolean(L, lum_setallocsample(L, (size_t)rate));
+  return 1;
+}
+
+
+static void setsizefield (lum_State *L, const char *k, size_t v) {
+  lum_pushinteger(L, (lum_Integer)v);
+  lum_setfield(L, -2, k);
+}
+
+
+static int db_allocsites (lum_State *L) {
+  lum_AllocSite s;
+  int n;
+  lum_newtable(L);
+  for (n = 0; lum_getallocsite(L, n, &s); n++) {
+    lum_createtable(L, 0, 5);
+    lum_pushstring(L, s.stack);
+    lum_setfield(L, -2, "stack");
+    setsizefield(L, "count", s.count);
+    setsizefield(L, "bytes", s.bytes);
+    setsizefield(L, "livecount", s.livecount);
+    setsizefield(L, "livebytes", s.livebytes);
+    lum_rawseti(L, -2, n + 1);
+  }
+  return 1;
+}
+
+
 static const lumL_Reg dblib[] = {
+  {"allocprofile", db_allocprofile},
+  {"allocsites", db_allocsites},
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
   {"gethook", db_gethook},
   {"getinfo", db_getinfo},
+  {"heapsnapshot", db_heapsnapshot},
   {"getlocal", db_getlocal},
   {"getregistry", db_getregistry},
   {"getmetatable", db_getmetatable},
@@ -10,8 +10,10 @@
 #include "lprefix.h"
 
 
+#include <math.h>
 #include <stdarg.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "lum.h"
@@ -21,6 +23,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "lobject.h"
 #include "lopcodes.h"
 #include "lstate.h"
@@ -100,6 +103,30 @@ static int getcurrentline (CallInfo *ci) {
 }
 
 
+/*
+** Return the index of the inlined call (see 'lcode.c') that contains
+** instruction 'pc' of function 'p', or -1 if there is none.
+*/
+static int inlinedat (const Proto *p, int pc) {
+  int e;
+  for (e = 0; e < p->sizeinlineinfo && p->inlineinfo[e].startpc <= pc; e++) {
+    if (pc < p->inlineinfo[e].endpc)
+      return e;
+  }
+  return -1;
+}
+
+
+/*
+** Return the index of the inlined call being executed by the Lum
+** function 'ci', or -1 if it is not executing an inlined call.
+*/
+int lumG_inlinedcall (CallInfo *ci) {
+  const Proto *p = ci_func(ci)->p;
+  return (p->sizeinlineinfo == 0) ? -1 : inlinedat(p, currentpc(ci));
+}
+
+
 /*
 ** Set 'trap' for all active Lum frames.
 ** This function can be called during a signal, under "reasonable"
@@ -157,18 +184,39 @@ LUM_API int lum_gethookcount (lum_State *L) {
 }
 
 
-LUM_API int lum_getstack (lum_State *L, int level, lum_Debug *ar) {
+LUM_API int lum_heapsnapshot (lum_State *L, lum_Writer writer, void *data) {
   int status;
+  lum_lock(L);
+  status = lumC_heapsnapshot(L, writer, data);
+  lum_unlock(L);
+  return status;
+}
+
+
+/*
+** A Lum function executing an inlined call counts as two levels: the
+** inlined call and the function itself.
+*/
+LUM_API int lum_getstack (lum_State *L, int level, lum_Debug *ar) {
+  int status = 0;  /* no such level */
   CallInfo *ci;
   if (level < 0) return 0;  /* invalid (negative) level */
   lum_lock(L);
-  for (ci = L->ci; level > 0 && ci != &L->base_ci; ci = ci->previous)
-    level--;
-  if (level == 0 && ci != &L->base_ci) {  /* level found? */
-    status = 1;
-    ar->i_ci = ci;
+  for (ci = L->ci; ci != &L->base_ci; ci = ci->previous) {
+    int inl = isLum(ci) ? lumG_inlinedcall(ci) : -1;
+    if (inl >= 0 && level-- == 0) {  /* level is the inlined call? */
+      status = 1;
+      ar->i_ci = ci;
+      ar->i_inline = inl;
+      break;
+    }
+    if (level-- == 0) {  /* level found? */
+      status = 1;
+      ar->i_ci = ci;
+      ar->i_inline = -1;
+      break;
+    }
   }
-  else status = 0;  /* no such level */
   lum_unlock(L);
   return status;
 }
@@ -217,6 +265,26 @@ const char *lumG_findlocal (lum_State *L, CallInfo *ci, int n, StkId *pos) {
 }
 
 
+/*
+** Find local 'n' of the frame described by 'ar'. Only the parameters
+** of an inlined call are visible.
+*/
+static const char *findlocal (lum_State *L, const lum_Debug *ar, int n,
+                              StkId *pos) {
+  CallInfo *ci = ar->i_ci;
+  if (ar->i_inline >= 0) {  /* inlined call? */
+    const Proto *p = ci_func(ci)->p;
+    const InlineInfo *e = &p->inlineinfo[ar->i_inline];
+    const Proto *ip = p->p[e->proto];
+    if (n <= 0 || n > ip->numparams)
+      return NULL;
+    *pos = ci->func.p + 1 + e->base + (n - 1);
+    return lumF_getlocalname(ip, n, 0);
+  }
+  return lumG_findlocal(L, ci, n, pos);
+}
+
+
 LUM_API const char *lum_getlocal (lum_State *L, const lum_Debug *ar, int n) {
   const char *name;
   lum_lock(L);
@@ -228,7 +296,7 @@ LUM_API const char *lum_getlocal (lum_State *L, const lum_Debug *ar, int n) {
   }
   else {  /* active function; get information through 'ar' */
     StkId pos = NULL;  /* to avoid warnings */
-    name = lumG_findlocal(L, ar->i_ci, n, &pos);
+    name = findlocal(L, ar, n, &pos);
     if (name) {
       setobjs2s(L, L->top.p, pos);
       api_incr_top(L);
@@ -243,7 +311,7 @@ LUM_API const char *lum_setlocal (lum_State *L, const lum_Debug *ar, int n) {
   StkId pos = NULL;  /* to avoid warnings */
   const char *name;
   lum_lock(L);
-  name = lumG_findlocal(L, ar->i_ci, n, &pos);
+  name = findlocal(L, ar, n, &pos);
   if (name) {
     api_checkpop(L, 1);
     setobjs2s(L, pos, L->top.p - 1);
@@ -326,8 +394,25 @@ static const char *getfuncname (lum_State *L, CallInfo *ci, const char **name) {
 }
 
 
+/*
+** Get the current line of 'ci'. Inside an inlined call, that is the
+** line of the inlined code for the frame of the call ('inl' not NULL)
+** and the line of the call for the frame of 'ci' itself.
+*/
+static int currentline (CallInfo *ci, const InlineInfo *inl) {
+  if (ci == NULL || !isLum(ci))
+    return -1;
+  else if (inl == NULL) {
+    int e = lumG_inlinedcall(ci);
+    if (e >= 0)
+      return ci_func(ci)->p->inlineinfo[e].line;
+  }
+  return getcurrentline(ci);
+}
+
+
 static int auxgetinfo (lum_State *L, const char *what, lum_Debug *ar,
-                       Closure *f, CallInfo *ci) {
+                       Closure *f, CallInfo *ci, const InlineInfo *inl) {
   int status = 1;
   for (; *what; what++) {
     switch (*what) {
@@ -336,7 +421,7 @@ static int auxgetinfo (lum_State *L, const char *what, lum_Debug *ar,
         break;
       }
       case 'l': {
-        ar->currentline = (ci && isLum(ci)) ? getcurrentline(ci) : -1;
+        ar->currentline = currentline(ci, inl);
         break;
       }
       case 'u': {
@@ -352,7 +437,7 @@ static int auxgetinfo (lum_State *L, const char *what, lum_Debug *ar,
         break;
       }
       case 't': {
-        if (ci != NULL) {
+        if (ci != NULL && inl == NULL) {
           ar->istailcall = !!(ci->callstatus & CIST_TAIL);
           ar->extraargs =
                    cast_uchar((ci->callstatus & MAX_CCMT) >> CIST_CCMT);
@@ -364,7 +449,13 @@ static int auxgetinfo (lum_State *L, const char *what, lum_Debug *ar,
         break;
       }
       case 'n': {
-        ar->namewhat = getfuncname(L, ci, &ar->name);
+        if (inl != NULL) {  /* inlined call? */
+          const Proto *p = ci_func(ci)->p;
+          ar->name = lumF_getlocalname(p, inl->reg + 1, inl->startpc);
+          ar->namewhat = (ar->name != NULL) ? "local" : NULL;
+        }
+        else
+          ar->namewhat = getfuncname(L, ci, &ar->name);
         if (ar->namewhat == NULL) {
           ar->namewhat = "";  /* not found */
           ar->name = NULL;
@@ -372,7 +463,7 @@ static int auxgetinfo (lum_State *L, const char *what, lum_Debug *ar,
         break;
       }
       case 'r': {
-        if (ci == NULL || !(ci->callstatus & CIST_HOOKED))
+        if (ci == NULL || inl != NULL || !(ci->callstatus & CIST_HOOKED))
           ar->ftransfer = ar->ntransfer = 0;
         else {
           ar->ftransfer = L->transferinfo.ftransfer;
@@ -394,6 +485,7 @@ LUM_API int lum_getinfo (lum_State *L, const char *what, lum_Debug *ar) {
   int status;
   Closure *cl;
   CallInfo *ci;
+  const InlineInfo *inl = NULL;
   TValue *func;
   lum_lock(L);
   if (*what == '>') {
@@ -406,10 +498,14 @@ LUM_API int lum_getinfo (lum_State *L, const char *what, lum_Debug *ar) {
   else {
     ci = ar->i_ci;
     func = s2v(ci->func.p);
+    if (ar->i_inline >= 0) {  /* inlined call? */
+      inl = &ci_func(ci)->p->inlineinfo[ar->i_inline];
+      func = s2v(ci->func.p + 1 + inl->reg);  /* variable with function */
+    }
     lum_assert(ttisfunction(func));
   }
   cl = ttisclosure(func) ? clvalue(func) : NULL;
-  status = auxgetinfo(L, what, ar, cl, ci);
+  status = auxgetinfo(L, what, ar, cl, ci, inl);
   if (strchr(what, 'f')) {
     setobj2s(L, L->top.p, func);
     api_incr_top(L);
@@ -503,9 +599,33 @@ static const char *kname (const Proto *p, int index, const char **name) {
 static const char *basicgetobjname (const Proto *p, int *ppc, int reg,
                                     const char **name) {
   int pc = *ppc;
+  int e = (p->sizeinlineinfo == 0) ? -1 : inlinedat(p, pc);
+  if (e >= 0 && reg >= p->inlineinfo[e].base) {  /* inside inlined call? */
+    const InlineInfo *inl = &p->inlineinfo[e];
+    const Proto *ip = p->p[inl->proto];
+    if (reg - inl->base < ip->numparams) {  /* a parameter? */
+      *name = lumF_getlocalname(ip, reg - inl->base + 1, 0);
+      if (*name)
+        return "local";
+    }
+  }
   *name = lumF_getlocalname(p, reg + 1, pc);
-  if (*name)  /* is a local? */
+  if (*name) {  /* is a local? */
+    /* fields of a replaced table are named 'p.x' or 'p[1]' (see
+       'lcode.c'); report them as the original accesses would be */
+    const char *dot = strchr(*name, '.');
+    if (dot != NULL) {  /* field with a string key? */
+      int isenv = (dot - *name == sizeof(LUM_ENV) - 1 &&
+                   memcmp(*name, LUM_ENV, sizeof(LUM_ENV) - 1) == 0);
+      *name = dot + 1;
+      return isenv ? "global" : "field";
+    }
+    else if (strchr(*name, '[') != NULL) {  /* field with integer key? */
+      *name = "integer index";  /* as for OP_GETI */
+      return "field";
+    }
     return "local";
+  }
   /* else try symbolic execution */
   *ppc = pc = findsetreg(p, pc, reg);
   if (pc != -1) {  /* could find instruction? */
@@ -963,3 +1083,413 @@ int lumG_traceexec (lum_State *L, const Instruction *pc) {
   return 1;  /* keep 'trap' on */
 }
 
+
+
+/*
+** {======================================================
+** Allocation profiler
+** =======================================================
+*/
+
+/*
+** The profiler samples allocations of collectable objects. Allocations
+** are seen as a stream of bytes, and a sample is taken each time that
+** stream crosses a sampling point; the distance between two points
+** follows an exponential distribution with mean 'rate' (so, sampling
+** points form a Poisson process). Each sample records the stack of the
+** allocating thread, and it is aggregated into an "allocation site"
+** with all other samples with the same stack. Sampled objects are kept
+** in a second hash table, so that 'freeobj' can subtract them from
+** the live counts of their sites.
+** All memory used by the profiler comes directly from the allocation
+** function: it is invisible to the collector and to memory limits.
+** When memory is exhausted, samples are silently dropped.
+*/
+
+
+/* maximum number of stack frames recorded for each site */
+#if !defined(LUMI_PROFDEPTH)
+#define LUMI_PROFDEPTH	16
+#endif
+
+
+typedef struct ProfFrame {
+  const void *f;  /* function prototype or C function */
+  int line;  /* current line (-1 for C functions) */
+} ProfFrame;
+
+
+typedef struct AllocSite {
+  struct AllocSite *next;  /* next site in its bucket */
+  unsigned int h;  /* hash of its stack */
+  int nframes;
+  ProfFrame frame[LUMI_PROFDEPTH];
+  size_t stacksize;  /* size of buffer 'info.stack' */
+  lum_AllocSite info;  /* public information */
+} AllocSite;
+
+
+typedef struct SampledObj {
+  struct SampledObj *next;  /* next sample in its bucket */
+  const GCObject *o;
+  AllocSite *site;
+  size_t bytes;  /* estimated number of bytes this sample represents */
+} SampledObj;
+
+
+typedef struct AllocProf {
+  double rate;  /* mean number of bytes between samples */
+  l_uint32 rand;  /* state for the random generator */
+  AllocSite **sites;  /* hash table of sites */
+  AllocSite **vec;  /* all sites, in creation order */
+  int nsites;  /* number of sites */
+  int sizesites;  /* size of 'sites' and of 'vec' */
+  SampledObj **objs;  /* hash table of live sampled objects */
+  int nobjs;  /* number of live sampled objects */
+  int sizeobjs;  /* size of 'objs' */
+} AllocProf;
+
+
+#define hashptr(p)	cast_uint(point2uint(p) ^ (point2uint(p) >> 11))
+
+
+static void *profalloc (global_State *g, void *block, size_t osize,
+                                                      size_t nsize) {
+  return (*g->frealloc)(g->ud, block, osize, nsize);
+}
+
+
+/*
+** Distance to the next sampling point: '-log(u) * rate', with 'u'
+** uniformly distributed in (0,1].
+*/
+static l_mem nextsample (AllocProf *p) {
+  double u, d;
+  p->rand ^= p->rand << 13;  /* xorshift32 */
+  p->rand ^= p->rand >> 17;
+  p->rand ^= p->rand << 5;
+  p->rand &= 0xffffffffu;
+  u = cast(double, (p->rand >> 8) + 1) / cast(double, 1u << 24);
+  d = -log(u) * p->rate;
+  if (d < 1.0) return 1;
+  else if (d >= cast(double, MAX_LMEM / 2)) return MAX_LMEM / 2;
+  else return cast(l_mem, d);
+}
+
+
+static int getframes (lum_State *L, ProfFrame *frame) {
+  CallInfo *ci;
+  int n = 0;
+  for (ci = L->ci; ci != &L->base_ci && n < LUMI_PROFDEPTH;
+                   ci = ci->previous) {
+    const TValue *func = s2v(ci->func.p);
+    switch (ttypetag(func)) {
+      case LUM_VLCL: {
+        Proto *p = clLvalue(func)->p;
+        int e = lumG_inlinedcall(ci);
+        if (e >= 0 && n < LUMI_PROFDEPTH - 1) {  /* inlined call? */
+          frame[n].f = p->p[p->inlineinfo[e].proto];
+          frame[n++].line = getcurrentline(ci);
+        }
+        frame[n].f = p;
+        frame[n].line = currentline(ci, NULL);
+        break;
+      }
+      case LUM_VLCF:
+        frame[n].f = cast_voidp(cast_sizet(fvalue(func)));
+        frame[n].line = -1;
+        break;
+      case LUM_VCCL:
+        frame[n].f = cast_voidp(cast_sizet(clCvalue(func)->f));
+        frame[n].line = -1;
+        break;
+      default: continue;  /* should not happen */
+    }
+    n++;
+  }
+  return n;
+}
+
+
+static unsigned int hashframes (const ProfFrame *frame, int n) {
+  unsigned int h = cast_uint(n);
+  int i;
+  for (i = 0; i < n; i++)
+    h ^= (h << 5) + (h >> 2) + hashptr(frame[i].f) + cast_uint(frame[i].line);
+  return h;
+}
+
+
+/*
+** Build the textual description of a stack: one line per frame, with
+** the source and current line of each Lum function.
+*/
+static char *stackstring (global_State *g, const ProfFrame *frame, int n,
+                                           size_t *size) {
+  char buff[LUMI_PROFDEPTH * (LUM_IDSIZE + 20)];
+  char *s;
+  size_t len = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    if (i > 0) buff[len++] = '\n';
+    if (frame[i].line < 0) {
+      memcpy(buff + len, "[C]", 3);
+      len += 3;
+    }
+    else {
+      const Proto *p = cast(const Proto *, frame[i].f);
+      char src[LUM_IDSIZE];
+      if (p->source)
+        lumO_chunkid(src, getstr(p->source), tsslen(p->source));
+      else
+        lumO_chunkid(src, "=?", LL("=?"));
+      len += strlen(strcpy(buff + len, src));
+      buff[len++] = ':';
+      len += cast_sizet(l_sprintf(buff + len, 16, "%d", frame[i].line));
+    }
+  }
+  buff[len++] = '\0';
+  s = cast_charp(profalloc(g, NULL, 0, len));
+  if (s != NULL)
+    memcpy(s, buff, len);
+  *size = len;
+  return s;
+}
+
+
+static int growsites (global_State *g, AllocProf *p) {
+  int oldsize = p->sizesites;
+  int size = (oldsize == 0) ? 8 : 2 * oldsize;
+  size_t oldbytes = cast_sizet(oldsize) * sizeof(AllocSite *);
+  size_t nbytes = cast_sizet(size) * sizeof(AllocSite *);
+  AllocSite **nv;
+  AllocSite **nh = cast(AllocSite **, profalloc(g, NULL, 0, nbytes));
+  if (nh == NULL) return 0;
+  nv = cast(AllocSite **, profalloc(g, p->vec, oldbytes, nbytes));
+  if (nv == NULL) {
+    profalloc(g, nh, nbytes, 0);
+    return 0;
+  }
+  p->vec = nv;
+  memset(nh, 0, nbytes);
+  while (oldsize-- > 0) {  /* rehash old buckets */
+    AllocSite *s = p->sites[oldsize];
+    while (s != NULL) {
+      AllocSite *next = s->next;
+      unsigned int b = s->h & cast_uint(size - 1);
+      s->next = nh[b];
+      nh[b] = s;
+      s = next;
+    }
+  }
+  profalloc(g, p->sites, oldbytes, 0);
+  p->sites = nh;
+  p->sizesites = size;
+  return 1;
+}
+
+
+static int growobjs (global_State *g, AllocProf *p) {
+  int oldsize = p->sizeobjs;
+  int size = (oldsize == 0) ? 8 : 2 * oldsize;
+  size_t nbytes = cast_sizet(size) * sizeof(SampledObj *);
+  SampledObj **nh = cast(SampledObj **, profalloc(g, NULL, 0, nbytes));
+  if (nh == NULL) return 0;
+  memset(nh, 0, nbytes);
+  while (oldsize-- > 0) {  /* rehash old buckets */
+    SampledObj *so = p->objs[oldsize];
+    while (so != NULL) {
+      SampledObj *next = so->next;
+      unsigned int b = hashptr(so->o) & cast_uint(size - 1);
+      so->next = nh[b];
+      nh[b] = so;
+      so = next;
+    }
+  }
+  profalloc(g, p->objs, cast_sizet(p->sizeobjs) * sizeof(SampledObj *), 0);
+  p->objs = nh;
+  p->sizeobjs = size;
+  return 1;
+}
+
+
+static int sameframes (const ProfFrame *f1, const ProfFrame *f2, int n) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (f1[i].f != f2[i].f || f1[i].line != f2[i].line)
+      return 0;
+  }
+  return 1;
+}
+
+
+static AllocSite *getsite (lum_State *L, AllocProf *p) {
+  global_State *g = G(L);
+  ProfFrame frame[LUMI_PROFDEPTH];
+  int n = getframes(L, frame);
+  unsigned int h = hashframes(frame, n);
+  AllocSite *s;
+  if (p->sizesites > 0) {
+    for (s = p->sites[h & cast_uint(p->sizesites - 1)]; s; s = s->next) {
+      if (s->h == h && s->nframes == n && sameframes(s->frame, frame, n))
+        return s;  /* found it */
+    }
+  }
+  if (p->nsites >= p->sizesites && !growsites(g, p))
+    return NULL;  /* not enough memory */
+  s = cast(AllocSite *, profalloc(g, NULL, 0, sizeof(AllocSite)));
+  if (s == NULL) return NULL;
+  s->info.stack = stackstring(g, frame, n, &s->stacksize);
+  if (s->info.stack == NULL) {
+    profalloc(g, s, sizeof(AllocSite), 0);
+    return NULL;
+  }
+  s->h = h;
+  s->nframes = n;
+  memcpy(s->frame, frame, cast_sizet(n) * sizeof(ProfFrame));
+  s->info.count = s->info.bytes = 0;
+  s->info.livecount = s->info.livebytes = 0;
+  s->next = p->sites[h & cast_uint(p->sizesites - 1)];
+  p->sites[h & cast_uint(p->sizesites - 1)] = s;
+  p->vec[p->nsites++] = s;
+  return s;
+}
+
+
+/*
+** Called by 'lumC_newobj' when the allocation countdown reaches a
+** sampling point. Object 'o' (with 'sz' bytes) is the new object.
+*/
+void lumG_allocsample (lum_State *L, GCObject *o, size_t sz) {
+  global_State *g = G(L);
+  AllocProf *p = g->allocprof;
+  AllocSite *s;
+  SampledObj *so;
+  size_t bytes;
+  if (p == NULL) {  /* profiler is off? */
+    g->allocsample = MAX_LMEM;  /* do not come back here */
+    return;
+  }
+  g->allocsample = nextsample(p);
+  if (p->nobjs >= p->sizeobjs && !growobjs(g, p))
+    return;  /* not enough memory */
+  s = getsite(L, p);
+  if (s == NULL) return;  /* not enough memory for a new site */
+  so = cast(SampledObj *, profalloc(g, NULL, 0, sizeof(SampledObj)));
+  if (so == NULL) return;
+  /* a sample of 'sz' bytes represents 'sz / (1 - exp(-sz/rate))' bytes */
+  bytes = cast_sizet(cast(double, sz) /
+                     (1.0 - exp(-cast(double, sz) / p->rate)));
+  so->o = o;
+  so->site = s;
+  so->bytes = bytes;
+  so->next = p->objs[hashptr(o) & cast_uint(p->sizeobjs - 1)];
+  p->objs[hashptr(o) & cast_uint(p->sizeobjs - 1)] = so;
+  p->nobjs++;
+  s->info.count++;
+  s->info.bytes += bytes;
+  s->info.livecount++;
+  s->info.livebytes += bytes;
+}
+
+
+/*
+** Called by 'freeobj' (only while the profiler is on) for each object
+** being freed.
+*/
+void lumG_allocfree (global_State *g, const GCObject *o) {
+  AllocProf *p = g->allocprof;
+  if (p->sizeobjs > 0) {
+    SampledObj **pso = &p->objs[hashptr(o) & cast_uint(p->sizeobjs - 1)];
+    SampledObj *so;
+    while ((so = *pso) != NULL) {
+      if (so->o == o) {  /* found it? */
+        so->site->info.livecount--;
+        so->site->info.livebytes -= so->bytes;
+        *pso = so->next;
+        profalloc(g, so, sizeof(SampledObj), 0);
+        p->nobjs--;
+        return;
+      }
+      pso = &so->next;
+    }
+  }
+}
+
+
+/*
+** Stop the profiler, releasing all its data.
+*/
+void lumG_allocstop (global_State *g) {
+  AllocProf *p = g->allocprof;
+  int i;
+  if (p == NULL) return;
+  g->allocprof = NULL;
+  g->allocsample = MAX_LMEM;
+  for (i = 0; i < p->sizeobjs; i++) {
+    SampledObj *so = p->objs[i];
+    while (so != NULL) {
+      SampledObj *next = so->next;
+      profalloc(g, so, sizeof(SampledObj), 0);
+      so = next;
+    }
+  }
+  profalloc(g, p->objs, cast_sizet(p->sizeobjs) * sizeof(SampledObj *), 0);
+  for (i = 0; i < p->nsites; i++) {
+    AllocSite *s = p->vec[i];
+    profalloc(g, cast_voidp(s->info.stack), s->stacksize, 0);
+    profalloc(g, s, sizeof(AllocSite), 0);
+  }
+  profalloc(g, p->sites, cast_sizet(p->sizesites) * sizeof(AllocSite *), 0);
+  profalloc(g, p->vec, cast_sizet(p->sizesites) * sizeof(AllocSite *), 0);
+  profalloc(g, p, sizeof(AllocProf), 0);
+}
+
+
+LUM_API int lum_setallocsample (lum_State *L, size_t rate) {
+  global_State *g;
+  AllocProf *p;
+  int res = 1;
+  lum_lock(L);
+  g = G(L);
+  p = g->allocprof;
+  if (rate == 0)
+    lumG_allocstop(g);
+  else {
+    if (p == NULL) {  /* starting the profiler? */
+      p = cast(AllocProf *, profalloc(g, NULL, 0, sizeof(AllocProf)));
+      if (p == NULL)
+        res = 0;  /* not enough memory */
+      else {
+        p->rand = (g->seed & 0xffffffffu) | 1;  /* must not be zero */
+        p->sites = p->vec = NULL;
+        p->nsites = p->sizesites = 0;
+        p->objs = NULL;
+        p->nobjs = p->sizeobjs = 0;
+        g->allocprof = p;
+      }
+    }
+    if (p != NULL) {
+      p->rate = cast(double, rate);
+      g->allocsample = nextsample(p);
+    }
+  }
+  lum_unlock(L);
+  return res;
+}
+
+
+LUM_API int lum_getallocsite (lum_State *L, int n, lum_AllocSite *s) {
+  AllocProf *p;
+  int res = 0;
+  lum_lock(L);
+  p = G(L)->allocprof;
+  if (p != NULL && 0 <= n && n < p->nsites) {
+    *s = p->vec[n]->info;
+    res = 1;
+  }
+  lum_unlock(L);
+  return res;
+}
+
+/* }====================================================== */
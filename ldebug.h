@@ -37,6 +37,7 @@
 
 
 LUMI_FUNC int lumG_getfuncline (const Proto *f, int pc);
+LUMI_FUNC int lumG_inlinedcall (CallInfo *ci);
 LUMI_FUNC const char *lumG_findlocal (lum_State *L, CallInfo *ci, int n,
                                                     StkId *pos);
 LUMI_FUNC l_noret lumG_typeerror (lum_State *L, const TValue *o,
@@ -59,6 +60,9 @@ LUMI_FUNC const char *lumG_addinfo (lum_State *L, const char *msg,
 LUMI_FUNC l_noret lumG_errormsg (lum_State *L);
 LUMI_FUNC int lumG_traceexec (lum_State *L, const Instruction *pc);
 LUMI_FUNC int lumG_tracecall (lum_State *L);
+LUMI_FUNC void lumG_allocsample (lum_State *L, GCObject *o, size_t sz);
+LUMI_FUNC void lumG_allocfree (global_State *g, const GCObject *o);
+LUMI_FUNC void lumG_allocstop (global_State *g);
 
 
 #endif
@@ -406,6 +406,7 @@ void lumD_hook (lum_State *L, int event, int line,
     ar.event = event;
     ar.currentline = line;
     ar.i_ci = ci;
+    ar.i_inline = isLum(ci) ? lumG_inlinedcall(ci) : -1;
     L->transferinfo.ftransfer = ftransfer;
     L->transferinfo.ntransfer = ntransfer;
     if (isLum(ci) && L->top.p < ci->top.p)
@@ -767,6 +768,7 @@ static TStatus finishpcallk (lum_State *L,  CallInfo *ci) {
   else {  /* error */
     StkId func = restorestack(L, ci->u2.funcidx);
     L->allowhook = getoah(ci);  /* restore 'allowhook' */
+    L->ndefers = ci->u.c.old_ndefers;  /* close hints opened inside */
     func = lumF_close(L, func, status, 1);  /* can yield or raise an error */
     lumD_seterrorobj(L, status, func);
     lumD_shrinkstack(L);   /* restore stack size in case of overflow */
@@ -804,7 +806,7 @@ static void finishCcall (lum_State *L, CallInfo *ci) {
     TStatus status = LUM_YIELD;  /* default if there were no errors */
     lum_KFunction kf = ci->u.c.k;  /* continuation function */
     /* must have a continuation and must be able to call it */
-    lum_assert(kf != NULL && yieldable(L));
+    lum_assert(kf != NULL && recoverable(L));
     if (ci->callstatus & CIST_YPCALL)   /* was inside a 'lum_pcallk'? */
       status = finishpcallk(L, ci);  /* finish it */
     adjustresults(L, LUM_MULTRET);  /* finish 'lum_callk' */
@@ -818,14 +820,13 @@ static void finishCcall (lum_State *L, CallInfo *ci) {
 
 
 /*
-** Executes "full continuation" (everything in the stack) of a
-** previously interrupted coroutine until the stack is empty (or another
-** interruption long-jumps out of the loop).
+** Executes the continuation of all interrupted calls above 'base'
+** until the stack returns to 'base' (or another interruption
+** long-jumps out of the loop).
 */
-static void unroll (lum_State *L, void *ud) {
+static void unrollto (lum_State *L, CallInfo *base) {
   CallInfo *ci;
-  UNUSED(ud);
-  while ((ci = L->ci) != &L->base_ci) {  /* something in the stack */
+  while ((ci = L->ci) != base) {  /* something in the stack */
     if (!isLum(ci))  /* C function? */
       finishCcall(L, ci);  /* complete its execution */
     else {  /* Lum function */
@@ -837,12 +838,23 @@ static void unroll (lum_State *L, void *ud) {
 
 
 /*
-** Try to find a suspended protected call (a "recover point") for the
-** given thread.
+** Executes "full continuation" (everything in the stack) of a
+** previously interrupted coroutine until the stack is empty (or another
+** interruption long-jumps out of the loop).
+*/
+static void unroll (lum_State *L, void *ud) {
+  UNUSED(ud);
+  unrollto(L, &L->base_ci);
+}
+
+
+/*
+** Try to find a suspended protected call above 'base' (a "recover
+** point") for the given thread.
 */
-static CallInfo *findpcall (lum_State *L) {
+static CallInfo *findpcall (lum_State *L, CallInfo *base) {
   CallInfo *ci;
-  for (ci = L->ci; ci != NULL; ci = ci->previous) {  /* search for a pcall */
+  for (ci = L->ci; ci != base; ci = ci->previous) {  /* search for a pcall */
     if (ci->callstatus & CIST_YPCALL)
       return ci;
   }
@@ -913,7 +925,7 @@ static void resume (lum_State *L, void *ud) {
 */
 static TStatus precover (lum_State *L, TStatus status) {
   CallInfo *ci;
-  while (errorstatus(status) && (ci = findpcall(L)) != NULL) {
+  while (errorstatus(status) && (ci = findpcall(L, NULL)) != NULL) {
     L->ci = ci;  /* go down to recovery functions */
     setcistrecst(ci, status);  /* status to finish 'pcall' */
     status = lumD_rawrunprotected(L, unroll, NULL);
@@ -1018,6 +1030,7 @@ static void closepaux (lum_State *L, void *ud) {
 TStatus lumD_closeprotected (lum_State *L, ptrdiff_t level, TStatus status) {
   CallInfo *old_ci = L->ci;
   lu_byte old_allowhooks = L->allowhook;
+  int old_ndefers = L->ndefers;
   for (;;) {  /* keep closing upvalues until no more errors */
     struct CloseP pcl;
     pcl.level = restorestack(L, level); pcl.status = status;
@@ -1027,6 +1040,7 @@ TStatus lumD_closeprotected (lum_State *L, ptrdiff_t level, TStatus status) {
     else {  /* an error occurred; restore saved state and repeat */
       L->ci = old_ci;
       L->allowhook = old_allowhooks;
+      L->ndefers = old_ndefers;
     }
   }
 }
@@ -1042,12 +1056,14 @@ TStatus lumD_pcall (lum_State *L, Pfunc func, void *u, ptrdiff_t old_top,
   TStatus status;
   CallInfo *old_ci = L->ci;
   lu_byte old_allowhooks = L->allowhook;
+  int old_ndefers = L->ndefers;
   ptrdiff_t old_errfunc = L->errfunc;
   L->errfunc = ef;
   status = lumD_rawrunprotected(L, func, u);
   if (l_unlikely(status != LUM_OK)) {  /* an error occurred? */
     L->ci = old_ci;
     L->allowhook = old_allowhooks;
+    L->ndefers = old_ndefers;
     status = lumD_closeprotected(L, old_top, status);
     lumD_seterrorobj(L, status, restorestack(L, old_top));
     lumD_shrinkstack(L);   /* restore stack size in case of overflow */
@@ -1058,6 +1074,90 @@ TStatus lumD_pcall (lum_State *L, Pfunc func, void *u, ptrdiff_t old_top,
 
 
 
+/*
+** {======================================================
+** Recover points
+** =======================================================
+*/
+
+/*
+** A protected call done by 'lum_pcallk' is also a "recover point" for
+** the protected calls done inside it: while there are no new
+** non-yieldable calls in the stack ('recoverable'), 'lum_pcallk' does
+** not set a new error handler for its call, but only marks its
+** CallInfo with CIST_YPCALL, as it does inside coroutines. An error
+** long-jumps to the recover point, which finishes the interrupted
+** protected call and runs the remaining frames, like 'lum_resume'
+** does after an error in a coroutine. So, only the outermost protected
+** call pays for 'setjmp'.
+*/
+
+
+struct RecoverP {  /* data to 'reccall' */
+  StkId func;
+  int nresults;
+};
+
+
+static void reccall (lum_State *L, void *ud) {
+  struct RecoverP *r = cast(struct RecoverP *, ud);
+  lumD_callnoyield(L, r->func, r->nresults);
+}
+
+
+/*
+** Run the continuations of the frames above 'ud' after an error was
+** recovered. The frames run with the same counts they had inside
+** 'reccall', so that they can keep using the recover point.
+*/
+static void recunroll (lum_State *L, void *ud) {
+  L->nCcalls += nyci;  /* (restored by 'lumD_rawrunprotected') */
+  unrollto(L, cast(CallInfo *, ud));
+}
+
+
+/*
+** Call function 'func' in protected mode as a recover point. Any error
+** inside a protected call nested in it is recovered here and the
+** execution continues after that protected call.
+*/
+TStatus lumD_pcallrec (lum_State *L, StkId func, int nresults,
+                                     ptrdiff_t ef) {
+  TStatus status;
+  struct RecoverP r;
+  CallInfo *old_ci = L->ci;
+  ptrdiff_t old_top = savestack(L, func);
+  lu_byte old_allowhooks = L->allowhook;
+  int old_ndefers = L->ndefers;
+  ptrdiff_t old_errfunc = L->errfunc;
+  l_uint32 old_nnyrec = L->nnyrec;
+  CallInfo *ci;
+  L->errfunc = ef;
+  /* count of non-yieldable calls inside 'reccall' */
+  L->nnyrec = (L->nCcalls + nyci) & 0xffff0000;
+  r.func = func; r.nresults = nresults;
+  status = lumD_rawrunprotected(L, reccall, &r);
+  while (errorstatus(status) && (ci = findpcall(L, old_ci)) != NULL) {
+    L->ci = ci;  /* go down to recovery functions */
+    setcistrecst(ci, status);  /* status to finish 'pcall' */
+    status = lumD_rawrunprotected(L, recunroll, old_ci);
+  }
+  if (l_unlikely(status != LUM_OK)) {  /* an unrecovered error? */
+    L->ci = old_ci;
+    L->allowhook = old_allowhooks;
+    L->ndefers = old_ndefers;
+    status = lumD_closeprotected(L, old_top, status);
+    lumD_seterrorobj(L, status, restorestack(L, old_top));
+    lumD_shrinkstack(L);   /* restore stack size in case of overflow */
+  }
+  L->errfunc = old_errfunc;
+  L->nnyrec = old_nnyrec;
+  return status;
+}
+
+/* }====================================================== */
+
+
 /*
 ** Execute a protected parser.
 */
@@ -1094,7 +1194,8 @@ static void f_parser (lum_State *L, void *ud) {
   }
   else {
     checkmode(L, mode, "text");
-    cl = lumY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+    cl = lumY_parser(L, p->z, &p->buff, &p->dyd, p->name, c,
+                     strchr(mode, 'O') != NULL);
   }
   lum_assert(cl->nupvalues == cl->p->sizeupvalues);
   lumF_initupvals(L, cl);
@@ -81,6 +81,8 @@ LUMI_FUNC void lumD_call (lum_State *L, StkId func, int nResults);
 LUMI_FUNC void lumD_callnoyield (lum_State *L, StkId func, int nResults);
 LUMI_FUNC TStatus lumD_closeprotected (lum_State *L, ptrdiff_t level,
                                                      TStatus status);
+LUMI_FUNC TStatus lumD_pcallrec (lum_State *L, StkId func, int nresults,
+                                                 ptrdiff_t ef);
 LUMI_FUNC TStatus lumD_pcall (lum_State *L, Pfunc func, void *u,
                                         ptrdiff_t oldtop, ptrdiff_t ef);
 LUMI_FUNC void lumD_poscall (lum_State *L, CallInfo *ci, int nres);
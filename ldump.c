@@ -235,6 +235,16 @@ static void dumpDebug (DumpState *D, const Proto *f) {
   dumpInt(D, n);
   for (i = 0; i < n; i++)
     dumpString(D, f->upvalues[i].name);
+  n = (D->strip) ? 0 : f->sizeinlineinfo;
+  dumpInt(D, n);
+  for (i = 0; i < n; i++) {
+    dumpInt(D, f->inlineinfo[i].startpc);
+    dumpInt(D, f->inlineinfo[i].endpc);
+    dumpInt(D, f->inlineinfo[i].line);
+    dumpInt(D, f->inlineinfo[i].proto);
+    dumpByte(D, f->inlineinfo[i].reg);
+    dumpByte(D, f->inlineinfo[i].base);
+  }
 }
 
 
@@ -11,6 +11,7 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lum.h"
 
@@ -250,6 +251,7 @@ Proto *lumF_newproto (lum_State *L) {
   GCObject *o = lumC_newobj(L, LUM_VPROTO, sizeof(Proto));
   Proto *f = gco2p(o);
   f->k = NULL;
+  f->kcache = NULL;
   f->sizek = 0;
   f->p = NULL;
   f->sizep = 0;
@@ -266,6 +268,9 @@ Proto *lumF_newproto (lum_State *L) {
   f->maxstacksize = 0;
   f->locvars = NULL;
   f->sizelocvars = 0;
+  f->inlineinfo = NULL;
+  f->sizeinlineinfo = 0;
+  f->cache = NULL;
   f->linedefined = 0;
   f->lastlinedefined = 0;
   f->source = NULL;
@@ -277,7 +282,9 @@ lu_mem lumF_protosize (Proto *p) {
   lu_mem sz = cast(lu_mem, sizeof(Proto))
             + cast_uint(p->sizep) * sizeof(Proto*)
             + cast_uint(p->sizek) * sizeof(TValue)
+            + (p->kcache ? cast_uint(p->sizek) * sizeof(unsigned) : 0)
             + cast_uint(p->sizelocvars) * sizeof(LocVar)
+            + cast_uint(p->sizeinlineinfo) * sizeof(InlineInfo)
             + cast_uint(p->sizeupvalues) * sizeof(Upvaldesc);
   if (!(p->flag & PF_FIXED)) {
     sz += cast_uint(p->sizecode) * sizeof(Instruction);
@@ -288,6 +295,21 @@ lu_mem lumF_protosize (Proto *p) {
 }
 
 
+/*
+** Create the node-index cache for the constants of a complete prototype
+** (see 'lumH_fastgetk'). Its entries are only hints, so any initial
+** value would do.
+*/
+void lumF_initkcache (lum_State *L, Proto *f) {
+  lum_assert(f->kcache == NULL);
+  if (f->sizek > 0) {
+    unsigned *c = lumM_newvector(L, f->sizek, unsigned);
+    memset(c, 0, cast_sizet(f->sizek) * sizeof(unsigned));
+    f->kcache = c;
+  }
+}
+
+
 void lumF_freeproto (lum_State *L, Proto *f) {
   if (!(f->flag & PF_FIXED)) {
     lumM_freearray(L, f->code, cast_sizet(f->sizecode));
@@ -296,7 +318,10 @@ void lumF_freeproto (lum_State *L, Proto *f) {
   }
   lumM_freearray(L, f->p, cast_sizet(f->sizep));
   lumM_freearray(L, f->k, cast_sizet(f->sizek));
+  if (f->kcache != NULL)
+    lumM_freearray(L, f->kcache, cast_sizet(f->sizek));
   lumM_freearray(L, f->locvars, cast_sizet(f->sizelocvars));
+  lumM_freearray(L, f->inlineinfo, cast_sizet(f->sizeinlineinfo));
   lumM_freearray(L, f->upvalues, cast_sizet(f->sizeupvalues));
   lumM_free(L, f);
 }
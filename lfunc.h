@@ -57,6 +57,7 @@ LUMI_FUNC void lumF_closeupval (lum_State *L, StkId level);
 LUMI_FUNC StkId lumF_close (lum_State *L, StkId level, TStatus status, int yy);
 LUMI_FUNC void lumF_unlinkupval (UpVal *uv);
 LUMI_FUNC lu_mem lumF_protosize (Proto *p);
+LUMI_FUNC void lumF_initkcache (lum_State *L, Proto *f);
 LUMI_FUNC void lumF_freeproto (lum_State *L, Proto *f);
 LUMI_FUNC const char *lumF_getlocalname (const Proto *func, int local_number,
                                          int pc);
@@ -9,11 +9,13 @@
 
 #include "lprefix.h"
 
+#include <limits.h>
 #include <string.h>
 
 
 #include "lum.h"
 
+#include "lapi.h"
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
@@ -24,6 +26,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lvm.h"
 
 
 /*
@@ -40,6 +43,16 @@
 #define CWUFIN	10
 
 
+/*
+** Minimum number of free C levels needed to run a finalizer in a
+** regular step; with less room, the finalizer would only fail with
+** a "C stack overflow", so it stays pending for a later step.
+*/
+#define FINCCALLS	10
+
+#define cancallfin(L)	(getCcalls(L) + FINCCALLS < LUMI_MAXCCALLS)
+
+
 /* mask with all color bits */
 #define maskcolors	(bitmask(BLACKBIT) | WHITEBITS)
 
@@ -93,6 +106,8 @@
 
 
 static void reallymarkobject (global_State *g, GCObject *o);
+static void ephkeymarked (struct EphIndex *ei, const GCObject *o);
+static int ephadd (global_State *g, GCObject *key, TValue *value);
 static void atomic (lum_State *L);
 static void entersweep (lum_State *L);
 
@@ -149,6 +164,8 @@ static l_mem objsize (GCObject *o) {
     case LUM_VLNGSTR: {
       TString *ts = gco2ts(o);
       res = lumS_sizelngstr(ts->u.lnglen, ts->shrlen);
+      if (ts->shrlen == LSTRCAT)  /* add its separate content */
+        res += ts->u.lnglen + 1;
       break;
     }
     case LUM_VUPVAL: {
@@ -282,6 +299,10 @@ void lumC_barrierback_ (lum_State *L, GCObject *o) {
 
 void lumC_fix (lum_State *L, GCObject *o) {
   global_State *g = G(L);
+  if (!iswhite(o)) {  /* string from a shared pool? */
+    lum_assert(o->tt == LUM_VSHRSTR && g->strpool != NULL);
+    return;  /* it is already fixed for all states */
+  }
   lum_assert(g->allgc == o);  /* object must be 1st in 'allgc' list! */
   set2gray(o);  /* they will be gray forever */
   setage(o, G_OLD);  /* and old forever */
@@ -303,6 +324,8 @@ GCObject *lumC_newobjdt (lum_State *L, lu_byte tt, size_t sz, size_t offset) {
   o->tt = tt;
   o->next = g->allgc;
   g->allgc = o;
+  if (l_unlikely((g->allocsample -= cast(l_mem, sz)) < 0))
+    lumG_allocsample(L, o, sz);  /* reached a sampling point */
   return o;
 }
 
@@ -325,6 +348,28 @@ GCObject *lumC_newobj (lum_State *L, lu_byte tt, size_t sz) {
 */
 
 
+/*
+** Mark the parts of a rope. Ropes grow to the left and their right
+** parts are never ropes, so the left spine is marked with a loop (it
+** can be very long) and the marking of each other part ends right away.
+*/
+static void markrope (global_State *g, TString *ts) {
+  for (;;) {
+    TString *left = ropeleft(ts);
+    markobject(g, roperight(ts));
+    if (!iswhite(left) || !isrope(left)) {
+      markobject(g, left);
+      break;
+    }
+    g->GCmarked += objsize(obj2gco(left));
+    if (l_unlikely(g->ephindex != NULL))  /* converging ephemerons? */
+      ephkeymarked(g->ephindex, obj2gco(left));
+    set2black(left);
+    ts = left;
+  }
+}
+
+
 /*
 ** Mark an object.  Userdata with no user values, strings, and closed
 ** upvalues are visited and turned black here.  Open upvalues are
@@ -339,12 +384,19 @@ GCObject *lumC_newobj (lum_State *L, lu_byte tt, size_t sz) {
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
   g->GCmarked += objsize(o);
+  if (l_unlikely(g->ephindex != NULL))  /* converging ephemerons? */
+    ephkeymarked(g->ephindex, o);
   switch (o->tt) {
-    case LUM_VSHRSTR:
-    case LUM_VLNGSTR: {
+    case LUM_VSHRSTR: {
       set2black(o);  /* nothing to visit */
       break;
     }
+    case LUM_VLNGSTR: {
+      set2black(o);
+      if (l_unlikely(isrope(gco2ts(o))))
+        markrope(g, gco2ts(o));
+      break;
+    }
     case LUM_VUPVAL: {
       UpVal *uv = gco2upv(o);
       if (upisopen(uv))
@@ -548,8 +600,11 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
       clearkey(n);  /* clear its key */
     else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
       hasclears = 1;  /* table must be cleared */
-      if (valiswhite(gval(n)))  /* value not marked yet? */
+      if (valiswhite(gval(n))) {  /* value not marked yet? */
         hasww = 1;  /* white-white entry */
+        if (g->ephindex != NULL)  /* converging with an index? */
+          ephadd(g, gckeyN(n), gval(n));  /* wait for its key */
+      }
     }
     else if (valiswhite(gval(n))) {  /* value not marked yet? */
       marked = 1;
@@ -621,10 +676,15 @@ static l_mem traverseudata (global_State *g, Udata *u) {
 /*
 ** Traverse a prototype. (While a prototype is being build, its
 ** arrays can be larger than needed; the extra slots are filled with
-** NULL, so the use of 'markobjectN')
+** NULL, so the use of 'markobjectN'.) The closure cache is weak: it is
+** cleared if the cached closure was not marked yet, so that it can be
+** collected. (A closure stored there later sends the prototype back to
+** gray; see 'pushclosure'.)
 */
 static l_mem traverseproto (global_State *g, Proto *f) {
   int i;
+  if (f->cache && iswhite(f->cache))
+    f->cache = NULL;  /* allow cache to be collected */
   markobjectN(g, f->source);
   for (i = 0; i < f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
@@ -634,6 +694,7 @@ static l_mem traverseproto (global_State *g, Proto *f) {
     markobjectN(g, f->p[i]);
   for (i = 0; i < f->sizelocvars; i++)  /* mark local-variable names */
     markobjectN(g, f->locvars[i].varname);
+  genlink(g, obj2gco(f));  /* cache may have been touched */
   return 1 + f->sizek + f->sizeupvalues + f->sizep + f->sizelocvars;
 }
 
@@ -730,9 +791,11 @@ static void propagateall (global_State *g) {
 ** Traverse all ephemeron tables propagating marks from keys to values.
 ** Repeat until it converges, that is, nothing new is marked. 'dir'
 ** inverts the direction of the traversals, trying to speed up
-** convergence on chains in the same table.
+** convergence on chains in the same table. This is quadratic in the
+** worst case (long chains of entries); it is used only when there is
+** no memory for the index used by 'convergeephemerons'.
 */
-static void convergeephemerons (global_State *g) {
+static void convergeephemeronsloop (global_State *g) {
   int changed;
   int dir = 0;
   do {
@@ -753,6 +816,177 @@ static void convergeephemerons (global_State *g) {
   } while (changed);  /* repeat until no more changes */
 }
 
+
+/*
+** Index of white->white ephemeron entries, keyed by their keys. When
+** a key in the index is marked, 'reallymarkobject' moves its entries
+** to the 'ready' list, where their values wait to be marked. So, each
+** entry is visited a constant number of times, instead of once for
+** each traversal of its table. The index uses memory directly from the
+** allocation function, as the atomic phase cannot raise errors; if
+** that memory is not available, the collector falls back to
+** 'convergeephemeronsloop'.
+*/
+typedef struct EphEntry {
+  const GCObject *key;
+  const TValue *value;
+  int next;  /* next entry in its bucket or in 'ready' list */
+} EphEntry;
+
+typedef struct EphIndex {
+  EphEntry *entry;
+  int *bucket;  /* heads of hash chains (-1 is an empty chain) */
+  int nentries;  /* number of entries in use */
+  int size;  /* size of 'entry' and 'bucket' (a power of 2) */
+  int ready;  /* list of entries whose keys were marked */
+  int oom;  /* true if some entry could not be added */
+} EphIndex;
+
+
+#define ephhash(o,size)	\
+	cast_int((point2uint(o) ^ (point2uint(o) >> 9)) & cast_uint((size) - 1))
+
+
+/*
+** Object 'o' is being marked; move all its entries to the 'ready' list.
+*/
+static void ephkeymarked (EphIndex *ei, const GCObject *o) {
+  if (ei->size > 0) {
+    int *p = &ei->bucket[ephhash(o, ei->size)];
+    while (*p != -1) {
+      EphEntry *e = &ei->entry[*p];
+      if (e->key == o) {  /* found an entry with key 'o'? */
+        int i = *p;
+        *p = e->next;  /* remove it from its bucket */
+        e->next = ei->ready;  /* link it to 'ready' list */
+        ei->ready = i;
+      }
+      else
+        p = &e->next;
+    }
+  }
+}
+
+
+/*
+** Double the size of the index, rehashing the entries in its buckets.
+** (Entries in the 'ready' list keep their indices.)
+*/
+static int ephgrow (global_State *g, EphIndex *ei) {
+  int oldsize = ei->size;
+  int size = (oldsize == 0) ? 64 : 2 * oldsize;
+  size_t esize = sizeof(EphEntry);
+  EphEntry *ne;
+  int *nb = cast(int *, (*g->frealloc)(g->ud, NULL, 0,
+                                       cast_sizet(size) * sizeof(int)));
+  if (nb == NULL) return 0;
+  ne = cast(EphEntry *, (*g->frealloc)(g->ud, ei->entry,
+             cast_sizet(oldsize) * esize, cast_sizet(size) * esize));
+  if (ne == NULL) {
+    (*g->frealloc)(g->ud, nb, cast_sizet(size) * sizeof(int), 0);
+    return 0;
+  }
+  ei->entry = ne;
+  memset(nb, -1, cast_sizet(size) * sizeof(int));
+  while (oldsize-- > 0) {  /* rehash old buckets */
+    int i = ei->bucket[oldsize];
+    while (i != -1) {
+      EphEntry *e = &ne[i];
+      int next = e->next;
+      int h = ephhash(e->key, size);
+      e->next = nb[h];
+      nb[h] = i;
+      i = next;
+    }
+  }
+  (*g->frealloc)(g->ud, ei->bucket, cast_sizet(ei->size) * sizeof(int), 0);
+  ei->bucket = nb;
+  ei->size = size;
+  return 1;
+}
+
+
+/*
+** Add entry 'key' -> 'value' to the index.
+*/
+static int ephadd (global_State *g, GCObject *key, TValue *value) {
+  EphIndex *ei = g->ephindex;
+  int i, h;
+  if (ei->nentries >= ei->size && !ephgrow(g, ei)) {
+    ei->oom = 1;  /* index will be incomplete */
+    return 0;
+  }
+  i = ei->nentries++;
+  h = ephhash(key, ei->size);
+  ei->entry[i].key = key;
+  ei->entry[i].value = value;
+  ei->entry[i].next = ei->bucket[h];
+  ei->bucket[h] = i;
+  return 1;
+}
+
+
+/*
+** Propagate marks from keys to values in all ephemeron tables. First,
+** traverse all tables in the 'ephemeron' list with the index active;
+** this marks values with marked keys and indexes all white->white
+** entries. (Tables reached later by the propagation are traversed with
+** the index active too.) Then, alternate between propagating marks
+** and marking values from the 'ready' list, until both are empty. At
+** that point, no white key in the index has a marked key, so the
+** algorithm converged. Finally, traverse again the tables left in the
+** 'ephemeron' list (without the index), to link each one in its final
+** list; this last traversal marks nothing new.
+*/
+static void convergeephemerons (global_State *g) {
+  EphIndex ei;
+  GCObject *w;
+  GCObject *next = g->ephemeron;  /* get ephemeron list */
+  if (next == NULL)
+    return;  /* nothing to be done */
+  ei.entry = NULL; ei.bucket = NULL;
+  ei.nentries = ei.size = ei.oom = 0;
+  ei.ready = -1;
+  g->ephindex = &ei;
+  g->ephemeron = NULL;  /* tables return to this list when traversed */
+  while ((w = next) != NULL) {  /* for each ephemeron table */
+    Table *h = gco2t(w);
+    next = h->gclist;
+    nw2black(h);  /* out of the list (for now) */
+    traverseephemeron(g, h, 0);
+  }
+  while (g->gray != NULL || ei.ready != -1) {
+    if (g->gray != NULL)
+      propagateall(g);
+    else {  /* mark value from a ready entry */
+      EphEntry *e = &ei.entry[ei.ready];
+      ei.ready = e->next;
+      if (valiswhite(e->value))  /* not marked yet? */
+        reallymarkobject(g, gcvalue(e->value));
+    }
+  }
+  g->ephindex = NULL;
+  if (ei.size > 0) {  /* free index */
+    (*g->frealloc)(g->ud, ei.entry, cast_sizet(ei.size) * sizeof(EphEntry), 0);
+    (*g->frealloc)(g->ud, ei.bucket, cast_sizet(ei.size) * sizeof(int), 0);
+  }
+  if (ei.oom)  /* index is incomplete? */
+    convergeephemeronsloop(g);  /* use the slow method */
+  else {  /* relink tables */
+    next = g->ephemeron;
+    g->ephemeron = NULL;
+    while ((w = next) != NULL) {
+      Table *h = gco2t(w);
+      int marked;
+      next = h->gclist;
+      nw2black(h);
+      marked = traverseephemeron(g, h, 0);
+      lum_assert(!marked);  /* index left nothing behind */
+      UNUSED(marked);
+    }
+  }
+}
+
 /* }====================================================== */
 
 
@@ -815,6 +1049,8 @@ static void freeupval (lum_State *L, UpVal *uv) {
 
 static void freeobj (lum_State *L, GCObject *o) {
   assert_code(l_mem newmem = gettotalbytes(G(L)) - objsize(o));
+  if (l_unlikely(G(L)->allocprof != NULL))
+    lumG_allocfree(G(L), o);
   switch (o->tt) {
     case LUM_VPROTO:
       lumF_freeproto(L, gco2p(o));
@@ -852,7 +1088,9 @@ static void freeobj (lum_State *L, GCObject *o) {
     case LUM_VLNGSTR: {
       TString *ts = gco2ts(o);
       if (ts->shrlen == LSTRMEM)  /* must free external string? */
-        (*ts->falloc)(ts->ud, ts->contents, ts->u.lnglen + 1, 0);
+        (*ts->x.ext.falloc)(ts->x.ext.ud, ts->contents, ts->u.lnglen + 1, 0);
+      else if (ts->shrlen == LSTRCAT)  /* must free flattened content? */
+        lumM_freemem(L, ts->contents, ts->u.lnglen + 1);
       lumM_freemem(L, ts, lumS_sizelngstr(ts->u.lnglen, ts->shrlen));
       break;
     }
@@ -913,10 +1151,8 @@ static GCObject **sweeptolive (lum_State *L, GCObject **p) {
 ** If possible, shrink string table.
 */
 static void checkSizes (lum_State *L, global_State *g) {
-  if (!g->gcemergency) {
-    if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
-      lumS_resize(L, g->strt.size / 2);
-  }
+  if (!g->gcemergency)
+    lumS_checksize(L);  /* shrink string table, if possible */
 }
 
 
@@ -1273,7 +1509,7 @@ static void finishgencycle (lum_State *L, global_State *g) {
   correctgraylists(g);
   checkSizes(L, g);
   g->gcstate = GCSpropagate;  /* skip restart */
-  if (!g->gcemergency)
+  if (!g->gcemergency && cancallfin(L))
     callallpendingfinalizers(L);
 }
 
@@ -1556,6 +1792,7 @@ static void atomic (lum_State *L) {
   clearbyvalues(g, g->weak, origweak);
   clearbyvalues(g, g->allweak, origall);
   lumS_clearcache(g);
+  lumV_clearidxcache(g);  /* entries may refer to dead objects */
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   lum_assert(g->gray == NULL);
 }
@@ -1647,7 +1884,7 @@ static l_mem singlestep (lum_State *L, int fast) {
       break;
     }
     case GCScallfin: {  /* call finalizers */
-      if (g->tobefnz && !g->gcemergency) {
+      if (g->tobefnz && !g->gcemergency && cancallfin(L)) {
         g->gcstopem = 0;  /* ok collections during finalizers */
         GCTM(L);  /* call one finalizer */
         stepresult = CWUFIN;
@@ -1730,8 +1967,15 @@ void lumC_step (lum_State *L) {
         incstep(L, g);
         break;
       case KGC_GENMINOR:
-        youngcollection(L, g);
-        setminordebt(g);
+        if (L->ndefers > 0 && !g->gcdeferred) {  /* deferral hint open? */
+          g->gcdeferred = 1;  /* postpone this collection (only once) */
+          setminordebt(g);  /* hoping that the hint ends first */
+        }
+        else {
+          youngcollection(L, g);
+          setminordebt(g);
+          g->gcdeferred = 0;
+        }
         break;
     }
     lumi_tracegc(L, 0);  /* for internal debugging */
@@ -1739,6 +1983,38 @@ void lumC_step (lum_State *L) {
 }
 
 
+/*
+** Deferral hints. A hint brackets a piece of work (e.g., a request)
+** whose objects are mostly garbage when it ends. In generational mode,
+** a minor collection in the middle of that work would find those
+** objects still alive, and they would age and eventually become old,
+** to be freed only by a major collection. So, while the running thread
+** has an open hint, a minor collection is postponed once (for one more
+** minor period), and the end of its outermost hint runs the postponed
+** collection right away, when most of those objects are already dead.
+** A hint changes only when a collection runs; objects are allocated
+** and freed as usual. In incremental mode, hints have no effect.
+** Each thread counts its own open hints. Protected calls restore that
+** count when they catch an error, so an error closes the hints opened
+** inside the call.
+*/
+void lumC_begindefer (lum_State *L) {
+  L->ndefers++;
+}
+
+
+int lumC_enddefer (lum_State *L) {
+  global_State *g = G(L);
+  if (L->ndefers == 0 || --L->ndefers > 0)
+    return 0;  /* no hint or not the outermost one */
+  if (g->gckind == KGC_GENMINOR && gcrunning(g) && g->gcdeferred) {
+    lumC_step(L);  /* do the postponed collection */
+    return 1;
+  }
+  return 0;
+}
+
+
 /*
 ** Perform a full collection in incremental mode.
 ** Before running the collection, check 'keepinvariant'; if it is true,
@@ -1781,3 +2057,375 @@ void lumC_fullgc (lum_State *L, int isemergency) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Heap snapshots
+** =======================================================
+*/
+
+/*
+** A heap snapshot is a stream of records describing every live
+** collectable object and the references among them, so that an
+** offline tool can build the object graph and compute dominators and
+** retained sizes. Objects are identified by their addresses. All
+** numbers are written in the same MSB varint encoding used by binary
+** chunks. The stream has the following layout:
+**
+** header: LUM_SIGNATURE "H", format version (a byte)
+** roots:  SNAP_ROOTS, then a list of edges
+** object: SNAP_OBJECT, id, tag (a byte), size, [string], list of edges
+** end:    SNAP_END
+**
+** Object records cover the objects in all lists of the state plus
+** the strings of its shared string pool, if it has one.
+** For strings, [string] is the length of the string followed by its
+** contents (only for short strings, which include all names). A list
+** of edges is a sequence of (kind, name, target id) terminated by a
+** zero byte. The 'name' of an edge depends on its kind: an id of a
+** string (or 0 if unknown) for fields, upvalues, and locals; a
+** number for array indices, stack slots, constants, nested functions,
+** and user values; an id of the key object for other table entries.
+**
+** The snapshot is built without allocating anything from the Lum
+** heap: it uses a fixed buffer in the C stack, flushed to the writer
+** as it fills, so it can be taken even when memory is almost over.
+*/
+
+#define SNAP_VERSION	1
+
+/* record kinds */
+#define SNAP_END	0
+#define SNAP_ROOTS	1
+#define SNAP_OBJECT	2
+
+/* edge kinds */
+#define SE_ENDEDGES	0	/* end of list of edges */
+#define SE_INTERNAL	1	/* other references (name is always 0) */
+#define SE_KEY		2	/* table key (name is 0) */
+#define SE_FIELD	3	/* table value with a string key */
+#define SE_INDEX	4	/* table value with an integer key */
+#define SE_VALUE	5	/* table value with any other key */
+#define SE_METATABLE	6	/* metatable (name is 0) */
+#define SE_UPVALUE	7	/* upvalue of a closure */
+#define SE_LOCAL	8	/* local variable in a thread */
+#define SE_STACK	9	/* other slot in a thread stack */
+#define SE_CONSTANT	10	/* constant of a prototype */
+#define SE_PROTO	11	/* prototype of a closure or nested prototype */
+#define SE_USERVALUE	12	/* user value of a userdata */
+
+
+#if !defined(LUMI_SNAPBUFFSIZE)
+#define LUMI_SNAPBUFFSIZE	512
+#endif
+
+/* size for varint buffers (each byte stores up to 7 bits) */
+#define SNAPVIBS	((sizeof(size_t) * CHAR_BIT + 6) / 7)
+
+
+typedef struct SnapState {
+  lum_State *L;
+  lum_Writer writer;
+  void *data;
+  int status;
+  size_t n;  /* number of bytes in 'buff' */
+  lu_byte buff[LUMI_SNAPBUFFSIZE];
+} SnapState;
+
+
+#define snapid(o)	cast_sizet(o)
+
+
+static void snapflush (SnapState *S) {
+  if (S->status == 0 && S->n > 0) {
+    lum_unlock(S->L);
+    S->status = (*S->writer)(S->L, S->buff, S->n, S->data);
+    lum_lock(S->L);
+  }
+  S->n = 0;
+}
+
+
+static void snapblock (SnapState *S, const void *b, size_t size) {
+  const lu_byte *p = cast(const lu_byte *, b);
+  while (size > 0) {
+    size_t n = LUMI_SNAPBUFFSIZE - S->n;
+    if (n == 0) {
+      snapflush(S);
+      n = LUMI_SNAPBUFFSIZE;
+    }
+    if (n > size) n = size;
+    memcpy(S->buff + S->n, p, n);
+    S->n += n;
+    p += n;
+    size -= n;
+  }
+}
+
+
+static void snapbyte (SnapState *S, int b) {
+  if (S->n == LUMI_SNAPBUFFSIZE)
+    snapflush(S);
+  S->buff[S->n++] = cast_byte(b);
+}
+
+
+/* Dumps an unsigned integer using the MSB Varint encoding */
+static void snapvarint (SnapState *S, size_t x) {
+  lu_byte buff[SNAPVIBS];
+  unsigned n = 1;
+  buff[SNAPVIBS - 1] = x & 0x7f;  /* fill least-significant byte */
+  while ((x >>= 7) != 0)  /* fill other bytes in reverse order */
+    buff[SNAPVIBS - (++n)] = cast_byte((x & 0x7f) | 0x80);
+  snapblock(S, buff + SNAPVIBS - n, n);
+}
+
+
+static void snapedge (SnapState *S, int kind, size_t name, GCObject *o) {
+  if (o != NULL) {
+    snapbyte(S, kind);
+    snapvarint(S, name);
+    snapvarint(S, snapid(o));
+  }
+}
+
+
+#define snapedgeobj(S,k,n,o)	snapedge(S, k, n, obj2gco(o))
+
+#define snapedgeN(S,k,n,o)	{ if (o) snapedgeobj(S,k,n,o); }
+
+#define snapedgevalue(S,k,n,v)	snapedge(S, k, n, gcvalueN(v))
+
+
+static void snaptable (SnapState *S, Table *h) {
+  Node *n, *limit = gnodelast(h);
+  unsigned i;
+  snapedgeN(S, SE_METATABLE, 0, h->metatable);
+  for (i = 0; i < h->asize; i++)
+    snapedge(S, SE_INDEX, cast_sizet(i) + 1, gcvalarr(h, i));
+  for (n = gnode(h, 0); n < limit; n++) {
+    if (isempty(gval(n)) || keyisdead(n))
+      continue;  /* dead entry */
+    snapedge(S, SE_KEY, 0, gckeyN(n));
+    if (keytt(n) == ctb(LUM_VSHRSTR) || keytt(n) == ctb(LUM_VLNGSTR))
+      snapedgevalue(S, SE_FIELD, snapid(gckey(n)), gval(n));
+    else if (keyisinteger(n))
+      snapedgevalue(S, SE_INDEX, cast_sizet(l_castS2U(keyival(n))), gval(n));
+    else {
+      GCObject *k = gckeyN(n);
+      snapedgevalue(S, SE_VALUE, (k == NULL) ? 0 : snapid(k), gval(n));
+    }
+  }
+}
+
+
+static void snapproto (SnapState *S, Proto *f) {
+  int i;
+  snapedgeN(S, SE_INTERNAL, 0, f->source);
+  for (i = 0; i < f->sizek; i++)
+    snapedgevalue(S, SE_CONSTANT, cast_sizet(i) + 1, &f->k[i]);
+  for (i = 0; i < f->sizep; i++)
+    snapedgeN(S, SE_PROTO, cast_sizet(i) + 1, f->p[i]);
+  for (i = 0; i < f->sizeupvalues; i++)
+    snapedgeN(S, SE_INTERNAL, 0, f->upvalues[i].name);
+  for (i = 0; i < f->sizelocvars; i++)
+    snapedgeN(S, SE_INTERNAL, 0, f->locvars[i].varname);
+}
+
+
+static void snapLclosure (SnapState *S, LClosure *cl) {
+  int i;
+  snapedgeN(S, SE_PROTO, 0, cl->p);
+  for (i = 0; i < cl->nupvalues; i++) {
+    TString *name = NULL;
+    if (cl->p != NULL && i < cl->p->sizeupvalues)
+      name = cl->p->upvalues[i].name;
+    snapedgeN(S, SE_UPVALUE, (name == NULL) ? 0 : snapid(name),
+                             cl->upvals[i]);
+  }
+}
+
+
+/*
+** Name of the 'n'-th active local variable of function 'f' at
+** instruction 'pc', or NULL. (Same as 'lumF_getlocalname', but
+** returning the string object.)
+*/
+static TString *snaplocalname (const Proto *f, int n, int pc) {
+  int i;
+  for (i = 0; i < f->sizelocvars && f->locvars[i].startpc <= pc; i++) {
+    if (pc < f->locvars[i].endpc) {  /* is variable active? */
+      n--;
+      if (n == 0)
+        return f->locvars[i].varname;
+    }
+  }
+  return NULL;  /* not found */
+}
+
+
+/*
+** Stack slots of a thread. Slots holding active local variables of
+** Lum functions are named after them; all others are named after
+** their positions in the stack.
+*/
+static void snapthread (SnapState *S, lum_State *th) {
+  CallInfo *ci = &th->base_ci;
+  StkId o = th->stack.p;
+  UpVal *uv;
+  if (o == NULL)
+    return;  /* stack not completely built yet */
+  for (; o < th->top.p; o++) {
+    TString *name = NULL;
+    while (ci != th->ci && o >= ci->next->func.p)
+      ci = ci->next;  /* go to the frame that owns slot 'o' */
+    if (ci != &th->base_ci && isLum(ci) && o > ci->func.p) {
+      Proto *p = ci_func(ci)->p;
+      name = snaplocalname(p, cast_int(o - ci->func.p),
+                              pcRel(ci->u.l.savedpc, p));
+    }
+    if (name != NULL)
+      snapedgevalue(S, SE_LOCAL, snapid(name), s2v(o));
+    else
+      snapedgevalue(S, SE_STACK, cast_sizet(o - th->stack.p), s2v(o));
+  }
+  for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
+    snapedgeobj(S, SE_INTERNAL, 0, uv);
+}
+
+
+static void snapobject (SnapState *S, GCObject *o) {
+  snapbyte(S, SNAP_OBJECT);
+  snapvarint(S, snapid(o));
+  snapbyte(S, o->tt);
+  snapvarint(S, cast_sizet(objsize(o)));
+  switch (o->tt) {
+    case LUM_VSHRSTR: {
+      TString *ts = gco2ts(o);
+      snapvarint(S, cast_sizet(ts->shrlen));
+      snapblock(S, getshrstr(ts), cast_sizet(ts->shrlen));
+      break;
+    }
+    case LUM_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      snapvarint(S, ts->u.lnglen);
+      if (isrope(ts)) {
+        snapedgeobj(S, SE_INTERNAL, 0, ropeleft(ts));
+        snapedgeobj(S, SE_INTERNAL, 0, roperight(ts));
+      }
+      break;
+    }
+    case LUM_VUPVAL: {
+      snapedgevalue(S, SE_INTERNAL, 0, gco2upv(o)->v.p);
+      break;
+    }
+    case LUM_VUSERDATA: {
+      Udata *u = gco2u(o);
+      int i;
+      snapedgeN(S, SE_METATABLE, 0, u->metatable);
+      for (i = 0; i < u->nuvalue; i++)
+        snapedgevalue(S, SE_USERVALUE, cast_sizet(i) + 1, &u->uv[i].uv);
+      break;
+    }
+    case LUM_VLCL: snapLclosure(S, gco2lcl(o)); break;
+    case LUM_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      for (i = 0; i < cl->nupvalues; i++)
+        snapedgevalue(S, SE_UPVALUE, 0, &cl->upvalue[i]);
+      break;
+    }
+    case LUM_VTABLE: snaptable(S, gco2t(o)); break;
+    case LUM_VPROTO: snapproto(S, gco2p(o)); break;
+    case LUM_VTHREAD: snapthread(S, gco2th(o)); break;
+    default: lum_assert(0);
+  }
+  snapbyte(S, SE_ENDEDGES);
+}
+
+
+/*
+** Dump all objects in list 'p'. During a sweep phase, lists may still
+** contain dead objects, which may refer to already freed objects;
+** they are not part of the heap anymore, so they are skipped.
+*/
+static void snaplist (SnapState *S, global_State *g, GCObject *p) {
+  int sweeping = issweepphase(g);
+  for (; p != NULL && S->status == 0; p = p->next) {
+    if (!(sweeping && isdead(g, p)))
+      snapobject(S, p);
+  }
+}
+
+
+/*
+** Dump the strings of a shared pool. They are not in the lists of any
+** state, but objects refer to them like to any other string. As with
+** fixed strings, all of them are dumped, used or not.
+*/
+static void snappool (SnapState *S, const lum_StrPool *pool) {
+  int i;
+  for (i = 0; i < pool->size && S->status == 0; i++) {
+    TString *ts = pool->slots[i].ts;
+    if (ts != NULL)
+      snapobject(S, obj2gco(ts));
+  }
+}
+
+
+static void dosnapshot (lum_State *L, void *ud) {
+  global_State *g = G(L);
+  SnapState *S = cast(SnapState *, ud);
+  int i;
+  snapblock(S, LUM_SIGNATURE "H", sizeof(LUM_SIGNATURE "H") - 1);
+  snapbyte(S, SNAP_VERSION);
+  /* roots */
+  snapbyte(S, SNAP_ROOTS);
+  snapedgevalue(S, SE_INTERNAL, 0, &g->l_registry);
+  snapedgeobj(S, SE_INTERNAL, 0, mainthread(g));
+  snapedgeobj(S, SE_INTERNAL, 0, L);
+  for (i = 0; i < LUM_NUMTYPES; i++)
+    snapedgeN(S, SE_METATABLE, cast_sizet(i), g->mt[i]);
+  for (i = 0; i < TM_N; i++)
+    snapedgeobj(S, SE_INTERNAL, 0, g->tmname[i]);
+  snapedgeobj(S, SE_INTERNAL, 0, g->memerrmsg);
+  { GCObject *o;  /* objects being finalized are also roots */
+    for (o = g->tobefnz; o != NULL; o = o->next)
+      snapedge(S, SE_INTERNAL, 0, o);
+  }
+  snapbyte(S, SE_ENDEDGES);
+  /* objects */
+  snaplist(S, g, g->allgc);
+  snaplist(S, g, g->finobj);
+  snaplist(S, g, g->tobefnz);
+  snaplist(S, g, g->fixedgc);
+  if (g->strpool != NULL)
+    snappool(S, g->strpool);
+  snapbyte(S, SNAP_END);
+  snapflush(S);
+}
+
+
+/*
+** Write a snapshot of the heap. The collector is stopped while
+** writing, and it must be restarted even if the writer raises an
+** error, which is then propagated.
+*/
+int lumC_heapsnapshot (lum_State *L, lum_Writer writer, void *data) {
+  global_State *g = G(L);
+  lu_byte oldgcstp = g->gcstp;
+  SnapState S;
+  TStatus status;
+  S.L = L;
+  S.writer = writer;
+  S.data = data;
+  S.status = 0;
+  S.n = 0;
+  g->gcstp |= GCSTPGC;  /* keep lists unchanged while dumping */
+  status = lumD_rawrunprotected(L, dosnapshot, &S);
+  g->gcstp = oldgcstp;
+  if (l_unlikely(status != LUM_OK))
+    lumD_throw(L, status);  /* re-raise the error */
+  return S.status;
+}
+
+/* }====================================================== */
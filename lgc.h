@@ -254,6 +254,8 @@
 LUMI_FUNC void lumC_fix (lum_State *L, GCObject *o);
 LUMI_FUNC void lumC_freeallobjects (lum_State *L);
 LUMI_FUNC void lumC_step (lum_State *L);
+LUMI_FUNC void lumC_begindefer (lum_State *L);
+LUMI_FUNC int lumC_enddefer (lum_State *L);
 LUMI_FUNC void lumC_runtilstate (lum_State *L, int state, int fast);
 LUMI_FUNC void lumC_fullgc (lum_State *L, int isemergency);
 LUMI_FUNC GCObject *lumC_newobj (lum_State *L, lu_byte tt, size_t sz);
@@ -263,6 +265,7 @@ LUMI_FUNC void lumC_barrier_ (lum_State *L, GCObject *o, GCObject *v);
 LUMI_FUNC void lumC_barrierback_ (lum_State *L, GCObject *o);
 LUMI_FUNC void lumC_checkfinalizer (lum_State *L, GCObject *o, Table *mt);
 LUMI_FUNC void lumC_changemode (lum_State *L, int newmode);
+LUMI_FUNC int lumC_heapsnapshot (lum_State *L, lum_Writer writer, void *data);
 
 
 #endif
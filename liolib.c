@@ -668,10 +668,16 @@ static int g_write (lum_State *L, FILE *f, int arg) {
     char buff[LUM_N2SBUFFSZ];
     const char *s;
     size_t len = lum_numbertocstring(L, arg, buff);  /* try as a number */
+    lumL_StrBuff *sb;
     if (len > 0) {  /* did conversion work (value was a number)? */
       s = buff;
       len--;
     }
+    else if ((sb = (lumL_StrBuff *)lumL_testudata(L, arg,
+                                          LUM_STRBUFFHANDLE)) != NULL) {
+      s = (sb->b != NULL) ? sb->b : "";  /* write buffer contents */
+      len = sb->n;
+    }
     else  /* must be a string */
       s = lumL_checklstring(L, arg, &len);
     status = status && (fwrite(s, sizeof(char), len, f) == len);
@@ -79,7 +79,8 @@ void lumX_init (lum_State *L) {
   for (i=0; i<NUM_RESERVED; i++) {
     TString *ts = lumS_new(L, lumX_tokens[i]);
     lumC_fix(L, obj2gco(ts));  /* reserved words are never collected */
-    ts->extra = cast_byte(i+1);  /* reserved word */
+    if (ts->extra == 0)  /* not marked yet? (shared strings already are) */
+      ts->extra = cast_byte(i+1);  /* reserved word */
   }
 }
 
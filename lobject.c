@@ -282,6 +282,172 @@ static lum_Number lum_strx2number (const char *s, char **endptr) {
 #define L_MAXLENNUM	200
 #endif
 
+
+/*
+** {==================================================================
+** Fast paths for decimal conversions of floats
+** ===================================================================
+*/
+
+/*
+** Most numerals in programs and data are short decimal numerals, and
+** most floats have short decimal representations. For these cases,
+** conversions can be done with a few float operations that are exact
+** or correctly rounded, giving the same results of 'lum_str2number'
+** and LUM_NUMBER_FMT, and avoiding 'strtod'/'snprintf'. These fast
+** paths need IEEE doubles with no extra precision in the operations,
+** and assume LUM_NUMBER_FMT as "%.15g". (Define 'LUM_NOFASTFLT' to
+** turn them off.)
+*/
+#if !defined(LUM_NOFASTFLT) && LUM_FLOAT_TYPE == LUM_FLOAT_DOUBLE && \
+    defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0 && \
+    DBL_MANT_DIG == 53 && DBL_DIG == 15
+#define l_fastflt
+
+/* number of significant digits that fit exactly in a double */
+#define MAXFASTDIG	DBL_DIG
+
+/* powers of 10 exactly representable as doubles */
+static const lum_Number pow10tab[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAXPOW10	22
+
+
+/*
+** Convert a decimal numeral with at most MAXFASTDIG significant
+** digits and a decimal exponent (after moving the dot to the end of the
+** digits) within +-MAXPOW10. The significand and the power of 10 are
+** exact, so a single multiplication or division gives the correctly
+** rounded result. Returns NULL for other numerals (including those
+** not ending after their trailing spaces), which must go through the
+** general conversion.
+*/
+static const char *l_str2dfast (const char *s, lum_Number *result) {
+  lum_Number m = 0;  /* significand */
+  int nd = 0;  /* number of significant digits */
+  int e = 0;  /* decimal exponent */
+  int hasdigit = 0;
+  int neg;
+  while (lisspace(cast_uchar(*s))) s++;  /* skip initial spaces */
+  neg = isneg(&s);
+  for (; lisdigit(cast_uchar(*s)); s++) {
+    hasdigit = 1;
+    if (m != 0 || *s != '0') {  /* not a leading zero? */
+      if (++nd > MAXFASTDIG) return NULL;
+      m = m * 10 + (*s - '0');
+    }
+  }
+  if (*s == '.') {
+    for (s++; lisdigit(cast_uchar(*s)); s++) {
+      hasdigit = 1;
+      e--;
+      if (m != 0 || *s != '0') {  /* not a leading zero? */
+        if (++nd > MAXFASTDIG) return NULL;
+        m = m * 10 + (*s - '0');
+      }
+    }
+  }
+  if (!hasdigit)
+    return NULL;
+  if (*s == 'e' || *s == 'E') {
+    int exp1 = 0;
+    int eneg;
+    s++;  /* skip 'e' */
+    eneg = isneg(&s);
+    if (!lisdigit(cast_uchar(*s)))
+      return NULL;
+    for (; lisdigit(cast_uchar(*s)); s++) {
+      if (exp1 > 2 * MAXPOW10) return NULL;  /* too large */
+      exp1 = exp1 * 10 + (*s - '0');
+    }
+    e += (eneg ? -exp1 : exp1);
+  }
+  while (lisspace(cast_uchar(*s))) s++;  /* skip trailing spaces */
+  if (*s != '\0')
+    return NULL;
+  if (m == 0)
+    e = 0;  /* zero has any exponent */
+  else if (e < -MAXPOW10 || e > MAXPOW10)
+    return NULL;
+  m = (e < 0) ? m / pow10tab[-e] : m * pow10tab[e];
+  *result = neg ? -m : m;
+  return s;
+}
+
+
+/*
+** Write in 'buff' the decimal numeral for 'n', which is 'd' (an
+** integral float) times 10^-k, in a fixed notation. Returns the length
+** of the result.
+*/
+static int fixednumeral (char *buff, lum_Number n, lum_Number d, int k) {
+  char digs[MAXFASTDIG];
+  int nd = 0;  /* number of digits in 'digs' (in reverse order) */
+  int len = 0;
+  int i;
+  do {  /* all operations are exact, as 'd' < 2^53 */
+    lum_Number q = l_floor(d / 10);
+    digs[nd++] = cast_char('0' + cast_int(d - q * 10));
+    d = q;
+  } while (d > 0);
+  if (n < 0)
+    buff[len++] = '-';
+  if (nd <= k) {  /* no integral part? */
+    buff[len++] = '0';
+    buff[len++] = lum_getlocaledecpoint();
+    for (i = nd; i < k; i++)
+      buff[len++] = '0';
+  }
+  for (i = nd - 1; i >= 0; i--) {
+    buff[len++] = digs[i];
+    if (i == k && k > 0)
+      buff[len++] = lum_getlocaledecpoint();
+  }
+  if (k == 0) {  /* looks like an integer? */
+    buff[len++] = lum_getlocaledecpoint();
+    buff[len++] = '0';  /* adds '.0' to result */
+  }
+  buff[len] = '\0';
+  return len;
+}
+
+
+/*
+** Try to convert float 'n' to its shortest numeral, when that numeral
+** has at most MAXFASTDIG significant digits and a fixed notation with
+** "%.15g". For each number 'k' of decimal places, the only candidate
+** numeral is 'n' * 10^k rounded to an integer 'd' (the error in that
+** product is much smaller than 0.5), and that numeral reads back as 'n'
+** iff 'd' / 10^k == 'n' (a correctly rounded division of exact values).
+** So, the first 'k' that works gives the shortest numeral, which is the
+** numeral "%.15g" would produce. Returns 0 if it cannot convert 'n'.
+*/
+static int tostringfast (lum_Number n, char *buff) {
+  lum_Number a = l_mathop(fabs)(n);
+  int k;
+  if (!(a >= 1e-4 && a < 1e15))  /* no fixed notation (or NaN)? */
+    return 0;
+  for (k = 0; k <= MAXPOW10; k++) {
+    lum_Number t = a * pow10tab[k];
+    lum_Number d = l_floor(t);
+    if (t - d >= 0.5)
+      d += 1;  /* round 't' */
+    if (d >= 1e15)  /* too many digits? */
+      return 0;
+    if (d / pow10tab[k] == a)  /* numeral reads back as 'n'? */
+      return fixednumeral(buff, n, d, k);
+  }
+  return 0;
+}
+
+#endif
+
+/* }================================================================== */
+
+
 /*
 ** Convert string 's' to a Lum number (put in 'result'). Return NULL on
 ** fail or the address of the ending '\0' on success. ('mode' == 'x')
@@ -312,8 +478,14 @@ static const char *l_str2dloc (const char *s, lum_Number *result, int mode) {
 */
 static const char *l_str2d (const char *s, lum_Number *result) {
   const char *endptr;
-  const char *pmode = strpbrk(s, ".xXnN");  /* look for special chars */
-  int mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
+  const char *pmode;
+  int mode;
+#if defined(l_fastflt)
+  if ((endptr = l_str2dfast(s, result)) != NULL)  /* simple numeral? */
+    return endptr;
+#endif
+  pmode = strpbrk(s, ".xXnN");  /* look for special chars */
+  mode = pmode ? ltolower(cast_uchar(*pmode)) : 0;
   if (mode == 'n')  /* reject 'inf' and 'nan' */
     return NULL;
   endptr = l_str2dloc(s, result, mode);  /* try to convert */
@@ -424,10 +596,16 @@ int lumO_utf8esc (char *buff, unsigned long x) {
 ** its end.
 */
 static int tostringbuffFloat (lum_Number n, char *buff) {
+  int len;
+  lum_Number check;
+#if defined(l_fastflt)
+  if ((len = tostringfast(n, buff)) > 0)  /* short numeral? */
+    return len;
+#endif
   /* first conversion */
-  int len = l_sprintf(buff, LUM_N2SBUFFSZ, LUM_NUMBER_FMT,
+  len = l_sprintf(buff, LUM_N2SBUFFSZ, LUM_NUMBER_FMT,
                             (LUMI_UACNUMBER)n);
-  lum_Number check = lum_str2number(buff, NULL);  /* read it back */
+  check = lum_str2number(buff, NULL);  /* read it back */
   if (check != n) {  /* not enough precision? */
     /* convert again with more precision */
     len = l_sprintf(buff, LUM_N2SBUFFSZ, LUM_NUMBER_FMT_N,
@@ -397,6 +397,8 @@ typedef struct GCObject {
 #define LSTRREG		-1  /* regular long string */
 #define LSTRFIX		-2  /* fixed external long string */
 #define LSTRMEM		-3  /* external long string with deallocation */
+#define LSTRROPE	-4  /* rope (concatenation not done yet) */
+#define LSTRCAT		-5  /* flattened rope (content in a separate block) */
 
 
 /*
@@ -409,25 +411,42 @@ typedef struct TString {
   unsigned int hash;
   union {
     size_t lnglen;  /* length for long strings */
-    struct TString *hnext;  /* linked list for hash table */
   } u;
   char *contents;  /* pointer to content in long strings */
-  lum_Alloc falloc;  /* deallocation function for external strings */
-  void *ud;  /* user data for external strings */
+  union {
+    struct {  /* external strings */
+      lum_Alloc falloc;  /* deallocation function */
+      void *ud;  /* user data */
+    } ext;
+    struct {  /* ropes */
+      struct TString *left;  /* first part (may be a rope) */
+      struct TString *right;  /* last part (never a rope) */
+    } rope;
+  } x;
 } TString;
 
 
 #define strisshr(ts)	((ts)->shrlen >= 0)
 
 
+/*
+** A rope has no contents of its own; they are the contents of its left
+** part followed by the contents of its right part. Ropes must be
+** flattened (see 'lumS_flatten') before their contents can be used.
+*/
+#define isrope(ts)	((ts)->shrlen == LSTRROPE)
+#define ropeleft(ts)	check_exp(isrope(ts), (ts)->x.rope.left)
+#define roperight(ts)	check_exp(isrope(ts), (ts)->x.rope.right)
+
+
 /*
 ** Get the actual string (array of bytes) from a 'TString'. (Generic
 ** version and specialized versions for long and short strings.)
 */
 #define rawgetshrstr(ts)  (cast_charp(&(ts)->contents))
 #define getshrstr(ts)	check_exp(strisshr(ts), rawgetshrstr(ts))
-#define getlngstr(ts)	check_exp(!strisshr(ts), (ts)->contents)
-#define getstr(ts) 	(strisshr(ts) ? rawgetshrstr(ts) : (ts)->contents)
+#define getlngstr(ts)	check_exp(!strisshr(ts) && !isrope(ts), (ts)->contents)
+#define getstr(ts) 	(strisshr(ts) ? rawgetshrstr(ts) : getlngstr(ts))
 
 
 /* get string length from 'TString *ts' */
@@ -439,7 +458,7 @@ typedef struct TString {
 #define getlstr(ts, len)  \
 	(strisshr(ts) \
 	? (cast_void((len) = cast_sizet((ts)->shrlen)), rawgetshrstr(ts)) \
-	: (cast_void((len) = (ts)->u.lnglen), (ts)->contents))
+	: (cast_void((len) = (ts)->u.lnglen), getlngstr(ts)))
 
 /* }================================================================== */
 
@@ -579,6 +598,23 @@ typedef struct AbsLineInfo {
 } AbsLineInfo;
 
 
+/*
+** Description of a call inlined by the compiler: the code in
+** [startpc, endpc) is a copy of the body of the function 'p[proto]',
+** called from line 'line' through the local variable in register 'reg'
+** and with its parameters starting at register 'base'. (The debug
+** interface uses this information to show that call as a frame.)
+*/
+typedef struct InlineInfo {
+  int startpc;
+  int endpc;
+  int line;
+  int proto;
+  lu_byte reg;
+  lu_byte base;
+} InlineInfo;
+
+
 /*
 ** Flags in Prototypes
 */
@@ -601,15 +637,19 @@ typedef struct Proto {
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int sizeabslineinfo;  /* size of 'abslineinfo' */
+  int sizeinlineinfo;  /* size of 'inlineinfo' */
   int linedefined;  /* debug information  */
   int lastlinedefined;  /* debug information  */
   TValue *k;  /* constants used by the function */
+  unsigned *kcache;  /* for each constant key, node where it was found */
   Instruction *code;  /* opcodes */
   struct Proto **p;  /* functions defined inside the function */
   Upvaldesc *upvalues;  /* upvalue information */
   ls_byte *lineinfo;  /* information about source lines (debug information) */
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
+  InlineInfo *inlineinfo;  /* inlined calls, sorted by 'startpc' */
+  struct LClosure *cache;  /* last-created closure with this prototype */
   TString  *source;  /* used for debug information */
   GCObject *gclist;
 } Proto;
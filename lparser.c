@@ -783,6 +783,7 @@ static void close_func (LexState *ls) {
   lumM_shrinkvector(L, f->abslineinfo, f->sizeabslineinfo,
                        fs->nabslineinfo, AbsLineInfo);
   lumM_shrinkvector(L, f->k, f->sizek, fs->nk, TValue);
+  lumF_initkcache(L, f);
   lumM_shrinkvector(L, f->p, f->sizep, fs->np, Proto *);
   lumM_shrinkvector(L, f->locvars, f->sizelocvars, fs->ndebugvars, LocVar);
   lumM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
@@ -1952,7 +1953,8 @@ static void mainfunc (LexState *ls, FuncState *fs) {
 
 
 LClosure *lumY_parser (lum_State *L, ZIO *z, Mbuffer *buff,
-                       Dyndata *dyd, const char *name, int firstchar) {
+                       Dyndata *dyd, const char *name, int firstchar,
+                       int optimize) {
   LexState lexstate;
   FuncState funcstate;
   LClosure *cl = lumF_newLclosure(L, 1);  /* create main closure */
@@ -1967,6 +1969,7 @@ LClosure *lumY_parser (lum_State *L, ZIO *z, Mbuffer *buff,
   lumC_objbarrier(L, funcstate.f, funcstate.f->source);
   lexstate.buff = buff;
   lexstate.dyd = dyd;
+  lexstate.optimize = cast_byte(optimize);
   dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
   lumX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);
@@ -168,7 +168,8 @@ LUMI_FUNC lu_byte lumY_nvarstack (FuncState *fs);
 LUMI_FUNC void lumY_checklimit (FuncState *fs, int v, int l,
                                 const char *what);
 LUMI_FUNC LClosure *lumY_parser (lum_State *L, ZIO *z, Mbuffer *buff,
-                                 Dyndata *dyd, const char *name, int firstchar);
+                                 Dyndata *dyd, const char *name, int firstchar,
+                                 int optimize);
 
 
 #endif
@@ -68,58 +68,103 @@ void lumE_setdebt (global_State *g, l_mem debt) {
 }
 
 
+/*
+** {==================================================================
+** CallInfo blocks
+** ===================================================================
+*/
+
+/*
+** CallInfo structures are allocated in blocks of consecutive entries,
+** so that the entries of a call stack are (mostly) contiguous in
+** memory. Inside a block, all entries are already chained through
+** their 'previous'/'next' fields, so that entering a new call does not
+** allocate anything. Each new block is twice the size of the previous
+** one, up to a maximum. Blocks are released only as a whole, starting
+** from the last one; entries never move, so pointers to them remain
+** valid.
+*/
+
+#define MINCIBLOCK	4
+#define MAXCIBLOCK	128
+
+
+typedef struct CIBlock {
+  struct CIBlock *previous;  /* previous block of this thread */
+  int size;  /* number of entries in 'ci' */
+  CallInfo ci[1];
+} CIBlock;
+
+
+#define sizeCIblock(n)  \
+	(offsetof(CIBlock, ci) + cast_sizet(n) * sizeof(CallInfo))
+
+
 CallInfo *lumE_extendCI (lum_State *L) {
-  CallInfo *ci;
+  CIBlock *last = L->ciblocks;
+  int n = (last == NULL) ? MINCIBLOCK
+                         : (last->size < MAXCIBLOCK) ? 2 * last->size
+                                                     : MAXCIBLOCK;
+  CIBlock *b;
+  int i;
   lum_assert(L->ci->next == NULL);
-  ci = lumM_new(L, CallInfo);
+  b = cast(CIBlock *, lumM_malloc_(L, sizeCIblock(n), 0));
   lum_assert(L->ci->next == NULL);
-  L->ci->next = ci;
-  ci->previous = L->ci;
-  ci->next = NULL;
-  ci->u.l.trap = 0;
-  L->nci++;
-  return ci;
+  b->previous = last;
+  b->size = n;
+  for (i = 0; i < n; i++) {
+    CallInfo *ci = &b->ci[i];
+    ci->previous = (i == 0) ? L->ci : ci - 1;
+    ci->next = (i == n - 1) ? NULL : ci + 1;
+    ci->u.l.trap = 0;
+  }
+  L->ci->next = b->ci;
+  L->ciblocks = b;
+  L->nci += n;
+  return b->ci;
 }
 
 
 /*
-** free all CallInfo structures not in use by a thread
+** free all CallInfo structures of a thread
 */
 static void freeCI (lum_State *L) {
-  CallInfo *ci = L->ci;
-  CallInfo *next = ci->next;
-  ci->next = NULL;
-  while ((ci = next) != NULL) {
-    next = ci->next;
-    lumM_free(L, ci);
-    L->nci--;
+  CIBlock *b = L->ciblocks;
+  L->base_ci.next = NULL;
+  while (b != NULL) {
+    CIBlock *previous = b->previous;
+    L->nci -= b->size;
+    lumM_freemem(L, b, sizeCIblock(b->size));
+    b = previous;
   }
+  L->ciblocks = NULL;
 }
 
 
 /*
-** free half of the CallInfo structures not in use by a thread,
-** keeping the first one.
+** free the CallInfo blocks not in use by a thread, keeping one of
+** them (if there is any) as a reserve.
 */
 void lumE_shrinkCI (lum_State *L) {
-  CallInfo *ci = L->ci->next;  /* first free CallInfo */
-  CallInfo *next;
-  if (ci == NULL)
-    return;  /* no extra elements */
-  while ((next = ci->next) != NULL) {  /* two extra elements? */
-    CallInfo *next2 = next->next;  /* next's next */
-    ci->next = next2;  /* remove next from the list */
-    L->nci--;
-    lumM_free(L, next);  /* free next */
-    if (next2 == NULL)
-      break;  /* no more elements */
-    else {
-      next2->previous = ci;
-      ci = next2;  /* continue */
-    }
+  CIBlock *b = L->ciblocks;
+  CallInfo *ci;
+  int nfree = 0;  /* number of entries not in use */
+  for (ci = L->ci->next; ci != NULL; ci = ci->next)
+    nfree++;
+  /* while next-to-last block is also free, last one is not needed */
+  while (b != NULL && b->previous != NULL &&
+         nfree - b->size >= b->previous->size) {
+    CIBlock *previous = b->previous;
+    nfree -= b->size;
+    L->nci -= b->size;
+    previous->ci[previous->size - 1].next = NULL;
+    lumM_freemem(L, b, sizeCIblock(b->size));
+    L->ciblocks = b = previous;
   }
 }
 
+/* }================================================================== */
+
 
 /*
 ** Called when 'getCcalls(L)' larger or equal to LUMI_MAXCCALLS.
@@ -222,9 +267,11 @@ static void preinit_thread (lum_State *L, global_State *g) {
   G(L) = g;
   L->stack.p = NULL;
   L->ci = NULL;
+  L->ciblocks = NULL;
   L->nci = 0;
   L->twups = L;  /* thread has no upvalues */
   L->nCcalls = 0;
+  L->nnyrec = 0;
   L->errorJmp = NULL;
   L->hook = NULL;
   L->hookmask = 0;
@@ -235,12 +282,15 @@ static void preinit_thread (lum_State *L, global_State *g) {
   L->status = LUM_OK;
   L->errfunc = 0;
   L->oldpc = 0;
+  L->ndefers = 0;
 }
 
 
 lu_mem lumE_threadsize (lum_State *L) {
-  lu_mem sz = cast(lu_mem, sizeof(LX))
-            + cast_uint(L->nci) * sizeof(CallInfo);
+  lu_mem sz = cast(lu_mem, sizeof(LX));
+  CIBlock *b;
+  for (b = L->ciblocks; b != NULL; b = b->previous)
+    sz += sizeCIblock(b->size);
   if (L->stack.p != NULL)
     sz += cast_uint(stacksize(L) + EXTRA_STACK) * sizeof(StackValue);
   return sz;
@@ -249,6 +299,7 @@ lu_mem lumE_threadsize (lum_State *L) {
 
 static void close_state (lum_State *L) {
   global_State *g = G(L);
+  lumG_allocstop(g);  /* no more samples */
   if (!completestate(g))  /* closing a partially built state? */
     lumC_freeallobjects(L);  /* just collect its objects */
   else {  /* closing a fully built state */
@@ -258,6 +309,8 @@ static void close_state (lum_State *L) {
     lumi_userstateclose(L);
   }
   lumM_freearray(L, G(L)->strt.hash, cast_sizet(G(L)->strt.size));
+  if (G(L)->strt.old != NULL)  /* was resizing the string table? */
+    lumM_freearray(L, G(L)->strt.old, cast_sizet(G(L)->strt.oldsize));
   freestack(L);
   lum_assert(gettotalbytes(g) == sizeof(global_State));
   (*g->frealloc)(g->ud, g, sizeof(global_State), 0);  /* free main block */
@@ -303,6 +356,7 @@ void lumE_freethread (lum_State *L, lum_State *L1) {
 
 TStatus lumE_resetthread (lum_State *L, TStatus status) {
   CallInfo *ci = L->ci = &L->base_ci;  /* unwind CallInfo list */
+  L->ndefers = 0;  /* hints do not survive an unwinding */
   setnilvalue(s2v(L->stack.p));  /* 'function' entry for basic 'ci' */
   ci->func.p = L->stack.p;
   ci->callstatus = CIST_C;
@@ -330,7 +384,8 @@ LUM_API int lum_closethread (lum_State *L, lum_State *from) {
 }
 
 
-LUM_API lum_State *lum_newstate (lum_Alloc f, void *ud, unsigned seed) {
+static lum_State *newstate (lum_Alloc f, void *ud, unsigned seed,
+                                               const lum_StrPool *pool) {
   int i;
   lum_State *L;
   global_State *g = cast(global_State*,
@@ -351,13 +406,18 @@ LUM_API lum_State *lum_newstate (lum_Alloc f, void *ud, unsigned seed) {
   g->seed = seed;
   g->gcstp = GCSTPGC;  /* no GC while building state */
   g->strt.size = g->strt.nuse = 0;
-  g->strt.hash = NULL;
+  g->strt.oldsize = g->strt.moved = 0;
+  g->strt.hash = g->strt.old = NULL;
+  g->strpool = pool;
+  memset(g->idxcache, 0, sizeof(g->idxcache));
+  g->idxepoch = 1;  /* entries have epoch 0, so they are invalid */
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
+  g->gcdeferred = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
@@ -365,6 +425,9 @@ LUM_API lum_State *lum_newstate (lum_Alloc f, void *ud, unsigned seed) {
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->allocprof = NULL;
+  g->ephindex = NULL;
+  g->allocsample = MAX_LMEM;
   g->GCtotalbytes = sizeof(global_State);
   g->GCmarked = 0;
   g->GCdebt = 0;
@@ -385,6 +448,40 @@ LUM_API lum_State *lum_newstate (lum_Alloc f, void *ud, unsigned seed) {
 }
 
 
+LUM_API lum_State *lum_newstate (lum_Alloc f, void *ud, unsigned seed) {
+  return newstate(f, ud, seed, NULL);
+}
+
+
+/*
+** Create a state that shares the strings of 'pool'. (The state uses
+** the same seed for its hashes.) The pool must outlive the state.
+*/
+LUM_API lum_State *lum_newpooledstate (lum_Alloc f, void *ud,
+                                       const lum_StrPool *pool) {
+  return newstate(f, ud, pool->seed, pool);
+}
+
+
+/*
+** Create a pool with all short strings currently used by state 'L'
+** (including those from its own pool, if it has one).
+*/
+LUM_API lum_StrPool *lum_newstrpool (lum_State *L) {
+  lum_StrPool *pool;
+  lum_lock(L);
+  lumC_fullgc(L, 0);  /* remove dead strings */
+  pool = lumS_newpool(L);
+  lum_unlock(L);
+  return pool;
+}
+
+
+LUM_API void lum_freestrpool (lum_StrPool *pool) {
+  lumS_freepool(pool);
+}
+
+
 LUM_API void lum_close (lum_State *L) {
   lum_lock(L);
   L = mainthread(G(L));  /* only the main thread can be closed */
@@ -404,9 +501,12 @@ void lumE_warning (lum_State *L, const char *msg, int tocont) {
 */
 void lumE_warnerror (lum_State *L, const char *where) {
   TValue *errobj = s2v(L->top.p - 1);  /* error object */
-  const char *msg = (ttisstring(errobj))
-                  ? getstr(tsvalue(errobj))
-                  : "error object is not a string";
+  const char *msg = (!ttisstring(errobj))
+                  ? "error object is not a string"
+                  : (isrope(tsvalue(errobj)) &&
+                     !lumS_tryflatten(L, tsvalue(errobj)))
+                  ? "not enough memory"
+                  : getstr(tsvalue(errobj));
   /* produce warning "error in %s (%s)" (where, msg) */
   lumE_warning(L, "error in ", 1);
   lumE_warning(L, where, 1);
@@ -103,6 +103,12 @@ typedef struct CallInfo CallInfo;
 /* true if this thread does not have non-yieldable calls in the stack */
 #define yieldable(L)		(((L)->nCcalls & 0xffff0000) == 0)
 
+/*
+** true if this thread has no non-yieldable calls above its innermost
+** recover point (see 'lumD_pcallrec')
+*/
+#define recoverable(L)	(((L)->nCcalls & 0xffff0000) == (L)->nnyrec)
+
 /* real number of C calls */
 #define getCcalls(L)	((L)->nCcalls & 0xffff)
 
@@ -153,6 +159,29 @@ struct lum_longjmp;  /* defined in ldo.c */
 #endif
 
 
+/*
+** Size of the cache for '__index' chains (must be a power of 2).
+*/
+#if !defined(IDXCACHE_N)
+#define IDXCACHE_N		128
+#endif
+
+
+/*
+** Entry in the cache for '__index' chains: 'slot' is where the chain
+** finds the result of indexing with short string 'key' any value that
+** has metatable 'mt' and no field 'key' of its own (or NULL, if that
+** chain cannot be cached). The entry is valid only while 'epoch' is
+** the current epoch of the cache.
+*/
+typedef struct IdxCache {
+  struct Table *mt;
+  TString *key;
+  l_uint32 epoch;
+  const TValue *slot;
+} IdxCache;
+
+
 #define BASIC_STACK_SIZE        (2*LUM_MINSTACK)
 
 #define stacksize(th)	cast_int((th)->stack_last.p - (th)->stack.p)
@@ -164,13 +193,46 @@ struct lum_longjmp;  /* defined in ldo.c */
 #define KGC_GENMAJOR	2	/* generational in major mode */
 
 
+/*
+** The string table uses open addressing with linear probing. Each slot
+** keeps the hash of its string, so that probes seldom touch strings
+** that do not match. When the table is resized, the previous array is
+** kept in 'old' and its strings are moved to the new array a few at a
+** time (see 'lstring.c').
+*/
+typedef struct StrSlot {
+  unsigned int hash;  /* hash of 'ts' (or kind of a free slot) */
+  TString *ts;  /* string in this slot (NULL if slot is free) */
+} StrSlot;
+
+
 typedef struct stringtable {
-  TString **hash;  /* array of buckets (linked lists of strings) */
-  int nuse;  /* number of elements */
-  int size;  /* number of buckets */
+  StrSlot *hash;  /* array of slots */
+  StrSlot *old;  /* previous array, while being emptied (or NULL) */
+  int nuse;  /* number of elements (in both arrays) */
+  int size;  /* number of slots in 'hash' */
+  int oldsize;  /* number of slots in 'old' */
+  int moved;  /* number of slots of 'old' already moved to 'hash' */
 } stringtable;
 
 
+/*
+** A string pool is an immutable set of short strings shared by several
+** states. Its strings are not in the lists of any state and are gray
+** and old, like fixed strings; so, no collector ever writes to them.
+** The pool and its strings live in a single block.
+*/
+struct lum_StrPool {
+  lum_Alloc frealloc;  /* function used to allocate the pool */
+  void *ud;  /* auxiliary data to 'frealloc' */
+  size_t totalsize;  /* size of the whole block */
+  unsigned int seed;  /* seed of the hashes of the strings */
+  int size;  /* number of slots (a power of 2) */
+  int nuse;  /* number of strings */
+  StrSlot slots[1];  /* (actual size is 'size') */
+};
+
+
 /*
 ** Information about a call.
 ** About union 'u':
@@ -198,6 +260,7 @@ struct CallInfo {
       lum_KFunction k;  /* continuation in case of yields */
       ptrdiff_t old_errfunc;
       lum_KContext ctx;  /* context info. in case of yields */
+      int old_ndefers;  /* open hints when a protected call started */
     } c;
   } u;
   union {
@@ -301,11 +364,14 @@ struct lum_State {
   struct lum_State *twups;  /* list of threads with open upvalues */
   struct lum_longjmp *errorJmp;  /* current error recover point */
   CallInfo base_ci;  /* CallInfo for first level (C host) */
+  struct CIBlock *ciblocks;  /* last block of CallInfo structures */
   volatile lum_Hook hook;
   ptrdiff_t errfunc;  /* current error handling function (stack index) */
   l_uint32 nCcalls;  /* number of nested non-yieldable or C calls */
+  l_uint32 nnyrec;  /* non-yieldable calls at innermost recover point */
   int oldpc;  /* last pc traced */
-  int nci;  /* number of items in 'ci' list */
+  int ndefers;  /* number of open deferral hints */
+  int nci;  /* number of items in 'ci' list (excluding 'base_ci') */
   int basehookcount;
   int hookcount;
   volatile l_signalT hookmask;
@@ -336,6 +402,7 @@ typedef struct global_State {
   l_mem GCmarked;  /* number of objects marked in a GC cycle */
   l_mem GCmajorminor;  /* auxiliary counter to control major-minor shifts */
   stringtable strt;  /* hash table for strings */
+  const lum_StrPool *strpool;  /* shared strings (or NULL) */
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
   unsigned int seed;  /* randomized seed for hashes */
@@ -346,6 +413,7 @@ typedef struct global_State {
   lu_byte gcstopem;  /* stops emergency collections */
   lu_byte gcstp;  /* control whether GC is running */
   lu_byte gcemergency;  /* true if this is an emergency collection */
+  lu_byte gcdeferred;  /* true if a minor collection was postponed */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -356,6 +424,9 @@ typedef struct global_State {
   GCObject *allweak;  /* list of all-weak tables */
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
+  struct AllocProf *allocprof;  /* allocation profiler (NULL if off) */
+  struct EphIndex *ephindex;  /* index for ephemeron convergence */
+  l_mem allocsample;  /* bytes to be allocated before next sample */
   /* fields for generational collector */
   GCObject *survival;  /* start of objects that survived one GC cycle */
   GCObject *old1;  /* start of old1 objects */
@@ -370,6 +441,8 @@ typedef struct global_State {
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUM_NUMTYPES];  /* metatables for basic types */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+  l_uint32 idxepoch;  /* current epoch of 'idxcache' */
+  IdxCache idxcache[IDXCACHE_N];  /* cache for '__index' chains */
   lum_WarnFunction warnf;  /* warning function */
   void *ud_warn;         /* auxiliary data to 'warnf' */
   LX mainth;  /* main thread of this state */
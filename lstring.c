@@ -25,7 +25,7 @@
 /*
 ** Maximum size for string table.
 */
-#define MAXSTRTB	cast_int(lumM_limitN(INT_MAX, TString*))
+#define MAXSTRTB	cast_int(lumM_limitN(INT_MAX, StrSlot))
 
 /*
 ** Initial size for the string table (must be power of 2).
@@ -38,81 +38,451 @@
 #endif
 
 
+static TString *createstrobj (lum_State *L, size_t totalsize, lu_byte tag,
+                              unsigned h);
+
+
+/*
+** {======================================================
+** Ropes
+** =======================================================
+*/
+
+/*
+** Ropes grow to the left: the right part of a rope is never a rope.
+** So, the pieces of a string can be visited from its end with a
+** simple loop, whatever the depth of the rope. 'nextpiece' gets in
+** 's'/'l' the last piece of '*ts' and leaves in '*ts' what comes before
+** that piece (NULL if nothing).
+*/
+static void nextpiece (TString **ts, const char **s, size_t *l) {
+  TString *p = *ts;
+  if (isrope(p)) {
+    *ts = ropeleft(p);
+    p = roperight(p);
+  }
+  else
+    *ts = NULL;
+  *s = getlstr(p, *l);
+}
+
+
+/*
+** Copy the contents of rope 'ts' to 'buff'.
+*/
+void lumS_copyrope (TString *ts, char *buff) {
+  char *e = buff + ts->u.lnglen;  /* pieces are copied from the end */
+  while (ts != NULL) {
+    const char *s;
+    size_t l;
+    nextpiece(&ts, &s, &l);
+    e -= l;
+    memcpy(e, s, l * sizeof(char));
+  }
+  lum_assert(e == buff);
+}
+
+
+/*
+** Compare the contents of two strings with equal lengths, at least one
+** of them a rope, piece by piece from their ends.
+*/
+static int eqpieces (TString *a, TString *b) {
+  const char *sa = NULL, *sb = NULL;
+  size_t la = 0, lb = 0;
+  for (;;) {
+    if (la == 0) {
+      if (a == NULL)
+        return 1;  /* both strings ended */
+      nextpiece(&a, &sa, &la);
+    }
+    else if (lb == 0)
+      nextpiece(&b, &sb, &lb);
+    else {
+      size_t n = (la < lb) ? la : lb;
+      if (memcmp(sa + la - n, sb + lb - n, n * sizeof(char)) != 0)
+        return 0;
+      la -= n; lb -= n;
+    }
+  }
+}
+
+
+TString *lumS_newrope (lum_State *L, TString *left, TString *right) {
+  size_t l = tsslen(left) + tsslen(right);
+  TString *ts = createstrobj(L, lumS_sizelngstr(l, LSTRROPE), LUM_VLNGSTR,
+                                G(L)->seed);
+  lum_assert(!strisshr(left) && !isrope(right));
+  ts->u.lnglen = l;
+  ts->shrlen = LSTRROPE;
+  ts->contents = NULL;
+  ts->x.rope.left = left;
+  ts->x.rope.right = right;
+  return ts;
+}
+
+
+/*
+** Do the concatenation represented by rope 'ts', which becomes a
+** regular string with its contents in a separate block. (Its parts
+** are no longer referenced, and will be collected if not used
+** elsewhere.) Returns 0 if there is no memory for the contents.
+*/
+int lumS_tryflatten (lum_State *L, TString *ts) {
+  size_t l = ts->u.lnglen;
+  char *buff = cast_charp(lumM_realloc_(L, NULL, 0, (l + 1) * sizeof(char)));
+  if (buff == NULL)
+    return 0;
+  lumS_copyrope(ts, buff);
+  buff[l] = '\0';  /* ending 0 */
+  ts->contents = buff;
+  ts->shrlen = LSTRCAT;
+  return 1;
+}
+
+
+void lumS_flatten (lum_State *L, TString *ts) {
+  if (!lumS_tryflatten(L, ts))
+    lumM_error(L);
+}
+
+/* }====================================================== */
+
+
 /*
 ** equality for long strings
 */
 int lumS_eqlngstr (TString *a, TString *b) {
   size_t len = a->u.lnglen;
   lum_assert(a->tt == LUM_VLNGSTR && b->tt == LUM_VLNGSTR);
-  return (a == b) ||  /* same instance or... */
-    ((len == b->u.lnglen) &&  /* equal length and ... */
-     (memcmp(getlngstr(a), getlngstr(b), len) == 0));  /* equal contents */
+  if (a == b)  /* same instance? */
+    return 1;
+  else if (len != b->u.lnglen)  /* different lengths? */
+    return 0;
+  else if (l_unlikely(isrope(a) || isrope(b)))
+    return eqpieces(a, b);
+  else  /* compare contents */
+    return (memcmp(getlngstr(a), getlngstr(b), len) == 0);
 }
 
 
-unsigned lumS_hash (const char *str, size_t l, unsigned seed) {
-  unsigned int h = seed ^ cast_uint(l);
+l_sinline unsigned hashbytes (unsigned h, const char *str, size_t l) {
   for (; l > 0; l--)
     h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
   return h;
 }
 
 
+unsigned lumS_hash (const char *str, size_t l, unsigned seed) {
+  return hashbytes(seed ^ cast_uint(l), str, l);
+}
+
+
+/*
+** Hash the contents of rope 'ts' piece by piece, giving the same result
+** as 'lumS_hash' over its flattened contents.
+*/
+static unsigned hashpieces (TString *ts) {
+  unsigned h = ts->hash ^ cast_uint(ts->u.lnglen);  /* 'hash' is seed */
+  while (ts != NULL) {
+    const char *s;
+    size_t l;
+    nextpiece(&ts, &s, &l);
+    h = hashbytes(h, s, l);
+  }
+  return h;
+}
+
+
+/*
+** A long string computes its hash on demand and keeps it. A rope keeps
+** it too (so that using it as a key more than once does not walk its
+** pieces again), and so does the string it becomes when flattened.
+*/
 unsigned lumS_hashlongstr (TString *ts) {
   lum_assert(ts->tt == LUM_VLNGSTR);
   if (ts->extra == 0) {  /* no hash? */
-    size_t len = ts->u.lnglen;
-    ts->hash = lumS_hash(getlngstr(ts), len, ts->hash);
+    if (l_unlikely(isrope(ts)))
+      ts->hash = hashpieces(ts);
+    else
+      ts->hash = lumS_hash(getlngstr(ts), ts->u.lnglen, ts->hash);
     ts->extra = 1;  /* now it has its hash */
   }
   return ts->hash;
 }
 
 
-static void tablerehash (TString **vect, int osize, int nsize) {
+/*
+** Free slots have a NULL 'ts' and their 'hash' tells their kind: an
+** empty slot ends a probe sequence; a dead slot (which held a string
+** that was removed) does not. Dead slots only appear in the old array
+** of a table being resized; in the current array, removals shift back
+** the entries that follow, so that it has no dead slots.
+*/
+#define EMPTYSLOT	0
+#define DEADSLOT	1
+
+#define isemptyslot(s)	((s)->ts == NULL && (s)->hash == EMPTYSLOT)
+
+#define nextslot(i,size)	(((i) + 1) & ((size) - 1))
+
+
+/*
+** Main slot for hash 'h'. Hashes of similar strings (e.g., "k1", "k2",
+** ...) differ little in their lower bits, which would create long runs
+** of used slots with linear probing; so, the hash is mixed first.
+*/
+l_sinline int mainslot (unsigned int h, int size) {
+  h = (h ^ (h >> 16)) * 0x45d9f3bu;
+  h ^= h >> 16;
+  return cast_int(lmod(h, size));
+}
+
+
+/*
+** Maximum number of strings for a table with 'size' slots: 3/4 of its
+** size, rounded down, so that even the smallest array (with 2 slots)
+** keeps an empty slot.
+*/
+#define maxload(size)	(((size) >> 1) + ((size) >> 2))
+
+
+/*
+** Number of slots of the old array moved to the new one in each
+** insertion or removal, while a resize is in progress. Growth starts
+** a resize at 3/4 of the old size, so that the new array (with twice
+** the size) gets another 3/4 of the old size before it needs to grow
+** again; moving 2 slots each time would be enough to empty the old
+** array before that.
+*/
+#if !defined(STRTBMOVE)
+#define STRTBMOVE	4
+#endif
+
+
+static void clearslots (StrSlot *v, int size) {
   int i;
-  for (i = osize; i < nsize; i++)  /* clear new elements */
-    vect[i] = NULL;
-  for (i = 0; i < osize; i++) {  /* rehash old part of the array */
-    TString *p = vect[i];
-    vect[i] = NULL;
-    while (p) {  /* for each string in the list */
-      TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, nsize);  /* new position */
-      p->u.hnext = vect[h];  /* chain it into array */
-      vect[h] = p;
-      p = hnext;
+  for (i = 0; i < size; i++) {
+    v[i].hash = EMPTYSLOT;
+    v[i].ts = NULL;
+  }
+}
+
+
+/*
+** Put a string in array 'v', which must have an empty slot.
+*/
+static void putslot (StrSlot *v, int size, unsigned int h, TString *ts) {
+  int i = mainslot(h, size);
+  while (v[i].ts != NULL)
+    i = nextslot(i, size);
+  v[i].hash = h;
+  v[i].ts = ts;
+}
+
+
+/*
+** Remove the entry in slot 'i' of the current array 'v', moving back
+** the following entries of the same run that would not be found
+** through an empty slot at 'i'. (An entry at 'j' can fill slot 'i'
+** when its main position is not cyclically in the range (i, j].)
+*/
+static void delslot (StrSlot *v, int size, int i) {
+  int j = i;
+  for (;;) {
+    int k;
+    j = nextslot(j, size);
+    if (v[j].ts == NULL)  /* end of run? */
+      break;
+    k = mainslot(v[j].hash, size);  /* main position of entry 'j' */
+    if ((i < j) ? (k <= i || k > j) : (k <= i && k > j)) {
+      v[i] = v[j];  /* move it back */
+      i = j;
+    }
+  }
+  v[i].hash = EMPTYSLOT;
+  v[i].ts = NULL;
+}
+
+
+/*
+** Search for string 'ts' in array 'v'; return its slot or -1.
+*/
+static int findslot (StrSlot *v, int size, TString *ts) {
+  int i = mainslot(ts->hash, size);
+  while (v[i].ts != ts) {
+    if (isemptyslot(&v[i]))
+      return -1;
+    i = nextslot(i, size);
+  }
+  return i;
+}
+
+
+/*
+** Search for a short string with the given contents and hash in
+** array 'v'.
+*/
+static TString *searchstr (const StrSlot *v, int size, const char *str,
+                                                 size_t l, unsigned int h) {
+  int i = mainslot(h, size);
+  for (;;) {
+    TString *ts = v[i].ts;
+    if (ts == NULL) {
+      if (v[i].hash == EMPTYSLOT)  /* end of probe sequence? */
+        return NULL;
     }
+    else if (v[i].hash == h && l == cast_uint(ts->shrlen) &&
+             memcmp(str, getshrstr(ts), l * sizeof(char)) == 0)
+      return ts;
+    i = nextslot(i, size);
   }
 }
 
 
 /*
-** Resize the string table. If allocation fails, keep the current size.
-** (This can degrade performance, but any non-zero size should work
+** Move up to 'n' slots of the old array to the current one. Moved
+** slots become dead, so that searches in the old array still go
+** through them.
+*/
+static void movestrings (stringtable *tb, int n) {
+  lum_assert(tb->old != NULL);
+  while (n-- > 0 && tb->moved < tb->oldsize) {
+    StrSlot *s = &tb->old[tb->moved++];
+    if (s->ts != NULL) {
+      putslot(tb->hash, tb->size, s->hash, s->ts);
+      s->hash = DEADSLOT;
+      s->ts = NULL;
+    }
+  }
+}
+
+
+/*
+** Free the old array if all its slots were moved.
+*/
+static void endresize (lum_State *L, stringtable *tb) {
+  if (tb->old != NULL && tb->moved == tb->oldsize) {
+    lumM_freearray(L, tb->old, cast_sizet(tb->oldsize));
+    tb->old = NULL;
+    tb->oldsize = tb->moved = 0;
+  }
+}
+
+
+/*
+** Start resizing the string table to 'nsize' slots. The strings are
+** moved to the new array incrementally, by later insertions and
+** removals. (A previous resize still in progress is completed first.)
+** If allocation fails, keep the current size. (This can degrade
+** performance, but any size with at least one empty slot works
 ** correctly.)
 */
 void lumS_resize (lum_State *L, int nsize) {
   stringtable *tb = &G(L)->strt;
-  int osize = tb->size;
-  TString **newvect;
-  if (nsize < osize)  /* shrinking table? */
-    tablerehash(tb->hash, osize, nsize);  /* depopulate shrinking part */
-  newvect = lumM_reallocvector(L, tb->hash, osize, nsize, TString*);
-  if (l_unlikely(newvect == NULL)) {  /* reallocation failed? */
-    if (nsize < osize)  /* was it shrinking table? */
-      tablerehash(tb->hash, nsize, osize);  /* restore to original size */
-    /* leave table as it was */
+  StrSlot *newvect;
+  if (tb->old != NULL) {  /* previous resize not finished? */
+    movestrings(tb, tb->oldsize);  /* finish it */
+    endresize(L, tb);
+  }
+  newvect = lumM_reallocvector(L, NULL, 0, nsize, StrSlot);
+  if (l_unlikely(newvect == NULL))  /* allocation failed? */
+    return;  /* leave table as it was */
+  clearslots(newvect, nsize);
+  tb->old = tb->hash;
+  tb->oldsize = tb->size;
+  tb->moved = 0;
+  tb->hash = newvect;
+  tb->size = nsize;
+}
+
+
+/*
+** Called by the collector at the end of each cycle: finish a resize
+** still in progress (which otherwise advances only with insertions and
+** removals) and, if the string table is too big, start shrinking it.
+*/
+void lumS_checksize (lum_State *L) {
+  stringtable *tb = &G(L)->strt;
+  if (tb->old != NULL) {  /* resize in progress? */
+    movestrings(tb, tb->oldsize - tb->moved);  /* finish it */
+    endresize(L, tb);
   }
-  else {  /* allocation succeeded */
-    tb->hash = newvect;
-    tb->size = nsize;
-    if (nsize > osize)
-      tablerehash(newvect, osize, nsize);  /* rehash for new size */
+  if (tb->nuse < tb->size / 4)  /* string table too big? */
+    lumS_resize(L, tb->size / 2);
+}
+
+
+void lumS_remove (lum_State *L, TString *ts) {
+  stringtable *tb = &G(L)->strt;
+  int i = findslot(tb->hash, tb->size, ts);
+  if (i >= 0)  /* in the current array? */
+    delslot(tb->hash, tb->size, i);
+  else {  /* must be in the old array */
+    i = findslot(tb->old, tb->oldsize, ts);
+    lum_assert(i >= 0);
+    tb->old[i].hash = DEADSLOT;
+    tb->old[i].ts = NULL;
+  }
+  tb->nuse--;
+  if (tb->old != NULL)  /* resizing? */
+    movestrings(tb, STRTBMOVE);  /* (old array is freed elsewhere, as
+                                    this is called while freeing an
+                                    object) */
+}
+
+
+static void growstrtab (lum_State *L, stringtable *tb) {
+  if (l_unlikely(tb->nuse == INT_MAX)) {  /* too many strings? */
+    lumC_fullgc(L, 1);  /* try to free some... */
+    if (tb->nuse == INT_MAX)  /* still too many? */
+      lumM_error(L);  /* cannot even create a message... */
   }
+  if (tb->size <= MAXSTRTB / 2)  /* can grow string table? */
+    lumS_resize(L, tb->size * 2);
+  if (l_unlikely(tb->nuse >= tb->size - 1))  /* no room for another one? */
+    lumM_error(L);  /* (the array must keep an empty slot) */
 }
 
 
+/*
+** Checks whether short string exists and reuses it or creates a new one.
+*/
+static TString *internshrstr (lum_State *L, const char *str, size_t l) {
+  TString *ts;
+  global_State *g = G(L);
+  stringtable *tb = &g->strt;
+  unsigned int h = lumS_hash(str, l, g->seed);
+  lum_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
+  if (g->strpool != NULL) {  /* is there a shared pool? */
+    ts = searchstr(g->strpool->slots, g->strpool->size, str, l, h);
+    if (ts != NULL)
+      return ts;
+  }
+  ts = searchstr(tb->hash, tb->size, str, l, h);
+  if (ts == NULL && tb->old != NULL)  /* not found and resizing? */
+    ts = searchstr(tb->old, tb->oldsize, str, l, h);
+  if (ts != NULL) {  /* found! */
+    if (isdead(g, ts))  /* dead (but not collected yet)? */
+      changewhite(ts);  /* resurrect it */
+    return ts;
+  }
+  /* else must create a new string */
+  if (tb->nuse >= maxload(tb->size))  /* need to grow string table? */
+    growstrtab(L, tb);
+  ts = createstrobj(L, sizestrshr(l), LUM_VSHRSTR, h);
+  ts->shrlen = cast(ls_byte, l);
+  getshrstr(ts)[l] = '\0';  /* ending 0 */
+  memcpy(getshrstr(ts), str, l * sizeof(char));
+  putslot(tb->hash, tb->size, h, ts);
+  tb->nuse++;
+  if (tb->old != NULL) {  /* resizing? */
+    movestrings(tb, STRTBMOVE);
+    endresize(L, tb);
+  }
+  return ts;
+}
+
 /*
 ** Clear API string cache. (Entries cannot be empty, so fill them with
 ** a non-collectable string.)
@@ -134,8 +504,8 @@ void lumS_init (lum_State *L) {
   global_State *g = G(L);
   int i, j;
   stringtable *tb = &G(L)->strt;
-  tb->hash = lumM_newvector(L, MINSTRTABSIZE, TString*);
-  tablerehash(tb->hash, 0, MINSTRTABSIZE);  /* clear array */
+  tb->hash = lumM_newvector(L, MINSTRTABSIZE, StrSlot);
+  clearslots(tb->hash, MINSTRTABSIZE);
   tb->size = MINSTRTABSIZE;
   /* pre-create memory-error message */
   g->memerrmsg = lumS_newliteral(L, MEMERRMSG);
@@ -149,14 +519,14 @@ void lumS_init (lum_State *L) {
 size_t lumS_sizelngstr (size_t len, int kind) {
   switch (kind) {
     case LSTRREG:  /* regular long string */
-      /* don't need 'falloc'/'ud', but need space for content */
-      return offsetof(TString, falloc) + (len + 1) * sizeof(char);
+      /* don't need 'x', but need space for content */
+      return offsetof(TString, x) + (len + 1) * sizeof(char);
     case LSTRFIX:  /* fixed external long string */
-      /* don't need 'falloc'/'ud' */
-      return offsetof(TString, falloc);
-    default:  /* external long string with deallocation */
-      lum_assert(kind == LSTRMEM);
-      return sizeof(TString);
+      /* don't need 'x' */
+      return offsetof(TString, x);
+    default:  /* external long string with deallocation or rope */
+      lum_assert(kind == LSTRMEM || kind == LSTRROPE || kind == LSTRCAT);
+      return sizeof(TString);  /* (flattened content is not included) */
   }
 }
 
@@ -181,67 +551,110 @@ TString *lumS_createlngstrobj (lum_State *L, size_t l) {
   TString *ts = createstrobj(L, totalsize, LUM_VLNGSTR, G(L)->seed);
   ts->u.lnglen = l;
   ts->shrlen = LSTRREG;  /* signals that it is a regular long string */
-  ts->contents = cast_charp(ts) + offsetof(TString, falloc);
+  ts->contents = cast_charp(ts) + offsetof(TString, x);
   ts->contents[l] = '\0';  /* ending 0 */
   return ts;
 }
 
 
-void lumS_remove (lum_State *L, TString *ts) {
-  stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
-  while (*p != ts)  /* find previous element */
-    p = &(*p)->u.hnext;
-  *p = (*p)->u.hnext;  /* remove element from its list */
-  tb->nuse--;
+
+/*
+** {======================================================
+** Shared string pools
+** =======================================================
+*/
+
+typedef union { LUMI_MAXALIGN; } PoolAlign;
+
+/* round 'n' up to keep the alignment of the next item in a pool */
+#define poolalign(n)  \
+	(((n) + sizeof(PoolAlign) - 1) / sizeof(PoolAlign) * sizeof(PoolAlign))
+
+
+/*
+** Total size needed by the strings in array 'v'
+*/
+static size_t sizepoolstrs (const StrSlot *v, int size) {
+  size_t total = 0;
+  int i;
+  for (i = 0; i < size; i++) {
+    TString *ts = v[i].ts;
+    if (ts != NULL)
+      total += poolalign(sizestrshr(cast_uint(ts->shrlen)));
+  }
+  return total;
 }
 
 
-static void growstrtab (lum_State *L, stringtable *tb) {
-  if (l_unlikely(tb->nuse == INT_MAX)) {  /* too many strings? */
-    lumC_fullgc(L, 1);  /* try to free some... */
-    if (tb->nuse == INT_MAX)  /* still too many? */
-      lumM_error(L);  /* cannot even create a message... */
+/*
+** Copy the strings in array 'v' into pool 'pool', starting at '*next'
+*/
+static void copypoolstrs (lum_StrPool *pool, char **next,
+                          const StrSlot *v, int size) {
+  int i;
+  for (i = 0; i < size; i++) {
+    TString *ts = v[i].ts;
+    if (ts != NULL) {
+      size_t sz = sizestrshr(cast_uint(ts->shrlen));
+      TString *ns = cast(TString *, *next);
+      memcpy(ns, ts, sz);  /* copy header (hash, 'extra') and contents */
+      ns->next = NULL;  /* not in any list */
+      ns->marked = cast_byte(G_OLD);  /* gray and old forever */
+      putslot(pool->slots, pool->size, ns->hash, ns);
+      pool->nuse++;
+      *next += poolalign(sz);
+    }
   }
-  if (tb->size <= MAXSTRTB / 2)  /* can grow string table? */
-    lumS_resize(L, tb->size * 2);
 }
 
 
 /*
-** Checks whether short string exists and reuses it or creates a new one.
+** Create a pool with copies of all short strings in the string table
+** of 'L' and in its pool. Returns NULL if it cannot allocate the pool.
 */
-static TString *internshrstr (lum_State *L, const char *str, size_t l) {
-  TString *ts;
+lum_StrPool *lumS_newpool (lum_State *L) {
   global_State *g = G(L);
   stringtable *tb = &g->strt;
-  unsigned int h = lumS_hash(str, l, g->seed);
-  TString **list = &tb->hash[lmod(h, tb->size)];
-  lum_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
-  for (ts = *list; ts != NULL; ts = ts->u.hnext) {
-    if (l == cast_uint(ts->shrlen) &&
-        (memcmp(str, getshrstr(ts), l * sizeof(char)) == 0)) {
-      /* found! */
-      if (isdead(g, ts))  /* dead (but not collected yet)? */
-        changewhite(ts);  /* resurrect it */
-      return ts;
-    }
-  }
-  /* else must create a new string */
-  if (tb->nuse >= tb->size) {  /* need to grow string table? */
-    growstrtab(L, tb);
-    list = &tb->hash[lmod(h, tb->size)];  /* rehash with new size */
-  }
-  ts = createstrobj(L, sizestrshr(l), LUM_VSHRSTR, h);
-  ts->shrlen = cast(ls_byte, l);
-  getshrstr(ts)[l] = '\0';  /* ending 0 */
-  memcpy(getshrstr(ts), str, l * sizeof(char));
-  ts->u.hnext = *list;
-  *list = ts;
-  tb->nuse++;
-  return ts;
+  const lum_StrPool *opool = g->strpool;
+  lum_StrPool *pool;
+  int n = tb->nuse + ((opool != NULL) ? opool->nuse : 0);
+  int size = MINSTRTABSIZE;
+  size_t slotsize, totalsize;
+  char *next;
+  while (size / 2 < n)  /* keep pool at most half full */
+    size *= 2;
+  slotsize = poolalign(offsetof(lum_StrPool, slots) +
+                       cast_sizet(size) * sizeof(StrSlot));
+  totalsize = slotsize + sizepoolstrs(tb->hash, tb->size) +
+                         sizepoolstrs(tb->old, tb->oldsize);
+  if (opool != NULL)
+    totalsize += sizepoolstrs(opool->slots, opool->size);
+  pool = cast(lum_StrPool *, (*g->frealloc)(g->ud, NULL, 0, totalsize));
+  if (pool == NULL)
+    return NULL;
+  pool->frealloc = g->frealloc;
+  pool->ud = g->ud;
+  pool->totalsize = totalsize;
+  pool->seed = g->seed;
+  pool->size = size;
+  pool->nuse = 0;
+  clearslots(pool->slots, size);
+  next = cast_charp(pool) + slotsize;
+  copypoolstrs(pool, &next, tb->hash, tb->size);
+  copypoolstrs(pool, &next, tb->old, tb->oldsize);
+  if (opool != NULL)
+    copypoolstrs(pool, &next, opool->slots, opool->size);
+  lum_assert(next == cast_charp(pool) + totalsize && pool->nuse == n);
+  return pool;
+}
+
+
+void lumS_freepool (lum_StrPool *pool) {
+  (*pool->frealloc)(pool->ud, pool, pool->totalsize, 0);
 }
 
+/* }====================================================== */
+
 
 /*
 ** new string (with explicit length)
@@ -347,8 +760,8 @@ TString *lumS_newextlstr (lum_State *L,
       (*falloc)(ud, cast_voidp(s), len + 1, 0);  /* free external string */
       lumM_error(L);  /* re-raise memory error */
     }
-    ne.ts->falloc = falloc;
-    ne.ts->ud = ud;
+    ne.ts->x.ext.falloc = falloc;
+    ne.ts->x.ext.ud = ud;
   }
   ne.ts->shrlen = ne.kind;
   ne.ts->u.lnglen = len;
@@ -30,6 +30,28 @@
 #endif
 
 
+/*
+** A concatenation whose first operand has at least MINROPELEN bytes
+** creates a rope instead of copying that operand. Small pieces appended
+** to a rope are merged into its last part while that part has at most
+** ROPECHUNK bytes.
+*/
+#if !defined(MINROPELEN)
+#define MINROPELEN	512
+#endif
+
+#if !defined(ROPECHUNK)
+#define ROPECHUNK	256
+#endif
+
+
+/*
+** Make sure that string 'ts' has its contents in a single block, so
+** that they can be accessed with 'getstr'.
+*/
+#define lumS_flat(L,ts)	{ if (l_unlikely(isrope(ts))) lumS_flatten(L, ts); }
+
+
 /*
 ** Size of a short TString: Size of the header plus space for the string
 ** itself (including final '\0').
@@ -58,6 +80,9 @@ LUMI_FUNC unsigned lumS_hash (const char *str, size_t l, unsigned seed);
 LUMI_FUNC unsigned lumS_hashlongstr (TString *ts);
 LUMI_FUNC int lumS_eqlngstr (TString *a, TString *b);
 LUMI_FUNC void lumS_resize (lum_State *L, int newsize);
+LUMI_FUNC void lumS_checksize (lum_State *L);
+LUMI_FUNC lum_StrPool *lumS_newpool (lum_State *L);
+LUMI_FUNC void lumS_freepool (lum_StrPool *pool);
 LUMI_FUNC void lumS_clearcache (global_State *g);
 LUMI_FUNC void lumS_init (lum_State *L);
 LUMI_FUNC void lumS_remove (lum_State *L, TString *ts);
@@ -69,5 +94,9 @@ LUMI_FUNC TString *lumS_createlngstrobj (lum_State *L, size_t l);
 LUMI_FUNC TString *lumS_newextlstr (lum_State *L,
 		const char *s, size_t len, lum_Alloc falloc, void *ud);
 LUMI_FUNC size_t lumS_sizelngstr (size_t len, int kind);
+LUMI_FUNC TString *lumS_newrope (lum_State *L, TString *left, TString *right);
+LUMI_FUNC void lumS_copyrope (TString *ts, char *buff);
+LUMI_FUNC int lumS_tryflatten (lum_State *L, TString *ts);
+LUMI_FUNC void lumS_flatten (lum_State *L, TString *ts);
 
 #endif
@@ -94,41 +94,122 @@ static int str_sub (lum_State *L) {
 }
 
 
+/*
+** {======================================================
+** Bulk operations on bytes
+** =======================================================
+*/
+
+#define WORDSIZE	sizeof(size_t)
+
+/* word with byte 'b' in all its bytes */
+#define BYTES(b)	((~(size_t)0 / 0xFF) * (b))
+
+
+/*
+** Reverse the order of the bytes in word 'w', swapping the bytes in
+** each 16-bit half, then the halves in each 32-bit half, and then the
+** 32-bit halves. (Compilers usually turn that into one instruction.)
+*/
+static size_t revword (size_t w) {
+  size_t m8 = ~(size_t)0 / 0xFFFF * 0xFF;
+  size_t m16 = ~(size_t)0 / 0xFFFFFFFF * 0xFFFF;
+  w = ((w >> 8) & m8) | ((w & m8) << 8);
+  w = ((w >> 16) & m16) | ((w & m16) << 16);
+  if (WORDSIZE > 4)  /* (double shifts avoid too large shift counts) */
+    w = (w >> 16 >> 16) | (w << 16 << 16);
+  return w;
+}
+
+
 static int str_reverse (lum_State *L) {
-  size_t l, i;
+  size_t l, i = 0;
   lumL_Buffer b;
   const char *s = lumL_checklstring(L, 1, &l);
   char *p = lumL_buffinitsize(L, &b, l);
-  for (i = 0; i < l; i++)
+  for (; l - i >= WORDSIZE; i += WORDSIZE) {  /* whole words */
+    size_t w;
+    memcpy(&w, s + (l - i - WORDSIZE), WORDSIZE);
+    w = revword(w);
+    memcpy(p + i, &w, WORDSIZE);
+  }
+  for (; i < l; i++)
     p[i] = s[l - i - 1];
   lumL_pushresultsize(&b, l);
   return 1;
 }
 
 
-static int str_lower (lum_State *L) {
-  size_t l;
+/*
+** Words with only ASCII bytes can have their case changed a word at a
+** time. In all locales the ASCII letters change case as in the C
+** locale, except 'i' and 'I' in Turkish locales, which this function
+** checks. (It uses the actual 'toupper' and 'tolower', so that it
+** follows the locale in effect, even if it is local to a thread.)
+*/
+static int asciicase (void) {
+  return (toupper('i') == 'I' && tolower('I') == 'i');
+}
+
+
+/*
+** Change the case of the ASCII letters in word 'w' from 'A'-'Z' (if
+** 'first' is 'A') or from 'a'-'z' (if 'first' is 'a'), flipping their
+** bit 0x20. For each byte 'c' without its high bit, 'c + 0x80 - first'
+** has its high bit set iff 'c >= first', and 'c + 0x80 - first - 26'
+** has it set iff 'c > first + 25'. (These sums do not carry into the
+** next byte.) 'w' must have only ASCII bytes.
+*/
+static size_t flipcase (size_t w, unsigned first) {
+  size_t c = w & BYTES(0x7F);
+  size_t ge = c + BYTES(0x80 - first);
+  size_t gt = c + BYTES(0x80 - first - 26);
+  size_t m = (ge ^ gt) & ~w & BYTES(0x80);
+  return w ^ (m >> 2);
+}
+
+
+/* change the case of bytes 's[0..n-1]' into 'p' according to the locale */
+static void mapbytes (char *p, const char *s, size_t n, int upper) {
   size_t i;
+  for (i = 0; i < n; i++) {
+    int c = cast_uchar(s[i]);
+    p[i] = cast_char(upper ? toupper(c) : tolower(c));
+  }
+}
+
+
+static int casemap (lum_State *L, int upper) {
+  size_t l, i = 0;
   lumL_Buffer b;
   const char *s = lumL_checklstring(L, 1, &l);
   char *p = lumL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = cast_char(tolower(cast_uchar(s[i])));
+  if (l >= WORDSIZE && asciicase()) {
+    unsigned first = upper ? 'a' : 'A';
+    for (; l - i >= WORDSIZE; i += WORDSIZE) {
+      size_t w;
+      memcpy(&w, s + i, WORDSIZE);
+      if ((w & BYTES(0x80)) == 0) {  /* only ASCII bytes? */
+        w = flipcase(w, first);
+        memcpy(p + i, &w, WORDSIZE);
+      }
+      else
+        mapbytes(p + i, s + i, WORDSIZE, upper);
+    }
+  }
+  mapbytes(p + i, s + i, l - i, upper);  /* rest of the string */
   lumL_pushresultsize(&b, l);
   return 1;
 }
 
 
+static int str_lower (lum_State *L) {
+  return casemap(L, 0);
+}
+
+
 static int str_upper (lum_State *L) {
-  size_t l;
-  size_t i;
-  lumL_Buffer b;
-  const char *s = lumL_checklstring(L, 1, &l);
-  char *p = lumL_buffinitsize(L, &b, l);
-  for (i=0; i<l; i++)
-    p[i] = cast_char(toupper(cast_uchar(s[i])));
-  lumL_pushresultsize(&b, l);
-  return 1;
+  return casemap(L, 1);
 }
 
 
@@ -143,16 +224,22 @@ static int str_rep (lum_State *L) {
     return lumL_error(L, "resulting string too large");
   else {
     size_t totallen = ((size_t)n * (l + lsep)) - lsep;
+    size_t rest = totallen - l;  /* 'n - 1' copies of separator + 's' */
+    size_t done;  /* how much of 'rest' is already filled */
     lumL_Buffer b;
     char *p = lumL_buffinitsize(L, &b, totallen);
-    while (n-- > 1) {  /* first n-1 copies (followed by separator) */
-      memcpy(p, s, l * sizeof(char)); p += l;
-      if (lsep > 0) {  /* empty 'memcpy' is not that cheap */
-        memcpy(p, sep, lsep * sizeof(char));
-        p += lsep;
+    memcpy(p, s, l * sizeof(char));  /* first copy */
+    if (rest > 0) {
+      char *q = p + l;
+      memcpy(q, sep, lsep * sizeof(char));
+      memcpy(q + lsep, s, l * sizeof(char));
+      /* double the filled part until it fills everything */
+      for (done = l + lsep; done < rest; ) {
+        size_t m = (done <= rest - done) ? done : rest - done;
+        memcpy(q + done, q, m * sizeof(char));
+        done += m;
       }
     }
-    memcpy(p, s, l * sizeof(char));  /* last copy (not followed by separator) */
     lumL_pushresultsize(&b, totallen);
   }
   return 1;
@@ -177,6 +264,9 @@ static int str_byte (lum_State *L) {
 }
 
 
+/* }====================================================== */
+
+
 static int str_char (lum_State *L) {
   int n = lum_gettop(L);  /* number of arguments */
   int i;
@@ -979,6 +1069,173 @@ static int str_gsub (lum_State *L) {
 
 
 
+/*
+** {======================================================
+** SPLITTING
+** =======================================================
+*/
+
+/* state for 'split' */
+typedef struct SplitState {
+  const char *sep;  /* separator (plain string or pattern) */
+  size_t lsep;  /* length of separator */
+  int plain;  /* true iff separator is a plain string */
+  int anchor;  /* true iff pattern separator matches only at start */
+  MatchState ms;  /* match state for pattern separators */
+} SplitState;
+
+
+/*
+** Find the first separator in 's' (which ends at 'ss->ms.src_end').
+** Return its start and put its end in '*e', or return NULL if there is
+** no separator. Empty matches of a pattern separator are ignored; an
+** anchored one can only match at the start of the subject.
+** Plain searches rely on 'memchr', which C libraries usually implement
+** with word-wide or vector instructions.
+*/
+static const char *nextsep (SplitState *ss, const char *s, const char **e) {
+  size_t l = ct_diff2sz(ss->ms.src_end - s);
+  if (ss->plain) {
+    const char *p = (ss->lsep == 1)
+                  ? (const char *)memchr(s, *ss->sep, l)
+                  : lmemfind(s, l, ss->sep, ss->lsep);
+    if (p != NULL)
+      *e = p + ss->lsep;
+    return p;
+  }
+  else {
+    if (ss->anchor && s != ss->ms.src_init)
+      return NULL;  /* past the start of the subject */
+    for (; s < ss->ms.src_end; s++) {
+      const char *res;
+      reprepstate(&ss->ms);
+      if ((res = match(&ss->ms, s, ss->sep)) != NULL && res != s) {
+        *e = res;
+        return s;
+      }
+      if (ss->anchor) break;
+    }
+    return NULL;  /* not found */
+  }
+}
+
+
+/*
+** Count the fields that splitting 's' with a plain separator will
+** produce, up to 'max'.
+*/
+static lum_Integer countfields (SplitState *ss, const char *s,
+                                lum_Integer max) {
+  lum_Integer n = 1;
+  const char *e;
+  while (n < max && nextsep(ss, s, &e) != NULL) {
+    n++;
+    s = e;
+  }
+  return n;
+}
+
+
+/*
+** Add field [s, e) of subject 'src' as the next element(s) of the
+** table on the top of the stack, either as a string or as its start
+** and end positions.
+*/
+static void addfield (lum_State *L, const char *src, const char *s,
+                      const char *e, int positions, lum_Integer *n) {
+  if (positions) {
+    lum_pushinteger(L, ct_diff2S(s - src) + 1);
+    lum_rawseti(L, -2, ++*n);
+    lum_pushinteger(L, ct_diff2S(e - src));
+  }
+  else
+    lum_pushlstring(L, s, ct_diff2sz(e - s));
+  lum_rawseti(L, -2, ++*n);
+}
+
+
+static int str_split (lum_State *L) {
+  size_t ls;
+  const char *src = lumL_checklstring(L, 1, &ls);
+  lum_Integer max = lumL_optinteger(L, 4, LUM_MAXINTEGER);
+  int positions = lum_toboolean(L, 5);
+  const char *s = src;
+  const char *e;
+  lum_Integer nf = 0;  /* number of fields (or positions) added */
+  lum_Integer i;
+  SplitState ss;
+  ss.sep = lumL_checklstring(L, 2, &ss.lsep);
+  ss.plain = lum_toboolean(L, 3) || nospecials(ss.sep, ss.lsep);
+  lumL_argcheck(L, ss.lsep > 0, 2, "empty separator");
+  ss.anchor = (!ss.plain && *ss.sep == '^');
+  if (ss.anchor) {
+    ss.sep++; ss.lsep--;  /* skip anchor character */
+  }
+  lumL_argcheck(L, max > 0, 4, "maximum number of fields must be positive");
+  prepstate(&ss.ms, L, src, ls, ss.sep, ss.lsep);
+  if (ss.plain) {  /* can count the fields cheaply? */
+    lum_Integer n = countfields(&ss, src, max);
+    if (positions) n *= 2;
+    lum_createtable(L, (n <= INT_MAX) ? cast_int(n) : INT_MAX, 0);
+  }
+  else
+    lum_newtable(L);
+  for (i = 1; i < max; i++) {
+    const char *p = nextsep(&ss, s, &e);
+    if (p == NULL) break;  /* no more separators */
+    addfield(L, src, s, p, positions, &nf);
+    s = e;
+  }
+  addfield(L, src, s, ss.ms.src_end, positions, &nf);  /* last field */
+  return 1;
+}
+
+
+static int lines_aux (lum_State *L) {
+  size_t ls;
+  const char *s = lum_tolstring(L, lum_upvalueindex(1), &ls);
+  size_t pos = cast_sizet(lum_tointeger(L, lum_upvalueindex(2)));
+  int mode = cast_int(lum_tointeger(L, lum_upvalueindex(3)));
+  const char *nl;
+  size_t len, next;
+  if (pos >= ls)
+    return 0;  /* no more lines */
+  nl = (const char *)memchr(s + pos, '\n', ls - pos);
+  len = (nl != NULL) ? ct_diff2sz(nl - (s + pos)) : ls - pos;
+  next = pos + len + (nl != NULL);  /* skip newline, if present */
+  lum_pushinteger(L, cast_st2S(next));
+  lum_replace(L, lum_upvalueindex(2));
+  switch (mode) {
+    case 0:  /* "l" */
+      lum_pushlstring(L, s + pos, len);
+      return 1;
+    case 1:  /* "L" */
+      lum_pushlstring(L, s + pos, next - pos);
+      return 1;
+    default:  /* "p" */
+      lum_pushinteger(L, cast_st2S(pos) + 1);
+      lum_pushinteger(L, cast_st2S(pos + len));
+      return 2;
+  }
+}
+
+
+static int str_lines (lum_State *L) {
+  static const char *const modes[] = {"l", "L", "p", NULL};
+  int mode;
+  lumL_checkstring(L, 1);
+  mode = lumL_checkoption(L, 2, "l", modes);
+  lum_settop(L, 1);  /* keep subject in the closure */
+  lum_pushinteger(L, 0);  /* current position */
+  lum_pushinteger(L, mode);
+  lum_pushcclosure(L, lines_aux, 3);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** {======================================================
 ** STRING FORMAT
@@ -1082,6 +1339,93 @@ static int lum_number2strx (lum_State *L, char *buff, unsigned sz,
 #define MAX_ITEM	120
 
 
+/*
+** Fast path for formats '%g' and '%.<p>g' (without flags or width),
+** with up to 15 significant digits, when the result has a fixed
+** notation. The digits come from 'x' * 10^k rounded to an integer; the
+** error in that product (less than 0.07) cannot change that rounding,
+** unless the product is too close to a tie, which is left to 'snprintf'.
+** Needs IEEE doubles with no extra precision in the operations.
+** Returns -1 if it cannot format 'x'.
+*/
+#if !defined(LUM_NOFASTFLT) && LUM_FLOAT_TYPE == LUM_FLOAT_DOUBLE && \
+    defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0 && \
+    DBL_MANT_DIG == 53
+
+static int fmtgfast (char *buff, const char *form, lum_Number x) {
+  static const lum_Number pow10tab[] = {  /* exact powers of 10 */
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+  };
+  /* (these are all a little above their exact values) */
+  static const lum_Number negpow10[] = {1e-4, 1e-3, 1e-2, 1e-1};
+  char digs[15];
+  const char *spec = form + 1;  /* skip '%' */
+  lum_Number a = l_mathop(fabs)(x);
+  lum_Number t, d;
+  int p = 6;  /* precision */
+  int e;  /* decimal exponent of 'x' */
+  int k;  /* number of decimal places */
+  int nd = 0;  /* number of digits in 'digs' (in reverse order) */
+  int len = 0;
+  if (*spec == '.') {  /* precision? */
+    p = 0;
+    for (spec++; isdigit(cast_uchar(*spec)); spec++)
+      p = p * 10 + (*spec - '0');
+    if (p == 0) p = 1;
+  }
+  if ((*spec != 'g' && *spec != 'G') || spec[1] != '\0' || p > 15 ||
+      !(a >= 1e-4 && a < pow10tab[p]))  /* no fixed notation (or NaN)? */
+    return -1;
+  if (a >= 1)
+    for (e = 0; a >= pow10tab[e + 1]; e++) ;
+  else
+    for (e = -1; a < negpow10[e + 4]; e--) ;
+  k = p - 1 - e;
+  t = a * pow10tab[k];
+  d = l_floor(t);
+  if (l_mathop(fabs)(t - d - 0.5) < 0.1)  /* too close to a tie? */
+    return -1;
+  else if (t - d > 0.5)
+    d += 1;  /* round up */
+  if (d >= pow10tab[p]) {  /* rounding went to a new digit? */
+    d /= 10;
+    if (--k < 0)  /* exponent reached the precision? */
+      return -1;  /* result has an exponent */
+  }
+  do {  /* collect digits; all operations are exact, as 'd' < 2^53 */
+    lum_Number q = l_floor(d / 10);
+    int dg = cast_int(d - q * 10);
+    if (dg != 0 || nd > 0 || k == 0)  /* not a trailing zero? */
+      digs[nd++] = cast_char('0' + dg);
+    else
+      k--;  /* remove trailing zero from the decimal places */
+    d = q;
+  } while (d > 0);
+  if (x < 0)
+    buff[len++] = '-';
+  if (nd <= k) {  /* no integral part? */
+    buff[len++] = '0';
+    buff[len++] = lum_getlocaledecpoint();
+    for (e = nd; e < k; e++)
+      buff[len++] = '0';
+  }
+  while (nd > 0) {
+    buff[len++] = digs[--nd];
+    if (nd == k && k > 0)
+      buff[len++] = lum_getlocaledecpoint();
+  }
+  buff[len] = '\0';
+  return len;
+}
+
+#else
+
+#define fmtgfast(buff,form,x)	(-1)
+
+#endif
+
+
 /* valid flags in a format specification */
 #if !defined(L_FMTFLAGSF)
 
@@ -1263,113 +1607,406 @@ static void addlenmod (char *form, const char *lenmod) {
 }
 
 
-static int str_format (lum_State *L) {
-  int top = lum_gettop(L);
-  int arg = 1;
+/*
+** A compiled format is a userdata (with metatable LUM_FORMATTER)
+** holding the format items, and with the format string as its user
+** value, which keeps alive the literal parts pointed by the items.
+** Each item is a literal part followed by a conversion (if any), whose
+** specification was already checked and completed with its length
+** modifier.
+*/
+#define LUM_FORMATTER	"FORMATTER"
+
+typedef struct FmtItem {
+  const char *lit;  /* literal part */
+  size_t litlen;  /* length of the literal part */
+  char conv;  /* conversion specifier ('\0' if none) */
+  char simple;  /* true if conversion has no flags, width, or precision */
+  char form[MAX_FORMAT];  /* format for the conversion ('%...') */
+} FmtItem;
+
+typedef struct Formatter {
+  int nitems;  /* number of items */
+  size_t litsize;  /* total size of the literal parts */
+  FmtItem items[1];  /* (actual size is 'nitems') */
+} Formatter;
+
+
+/*
+** Number of slots in each cache of compiled formats. (Each slot keeps
+** one format; see 'lookupslot'.)
+*/
+#if !defined(LUM_FMTCACHE)
+#define LUM_FMTCACHE	64
+#endif
+
+
+/*
+** Check a conversion specification in 'it->form' (already with its
+** specifier) and add to it its length modifier.
+*/
+l_sinline void checkconv (lum_State *L, FmtItem *it) {
+  it->simple = (it->form[2] == '\0');
+  switch (it->conv) {
+    case 'c': case 'p':
+      checkformat(L, it->form, L_FMTFLAGSC, 0);
+      break;
+    case 'd': case 'i':
+      checkformat(L, it->form, L_FMTFLAGSI, 1);
+      addlenmod(it->form, LUM_INTEGER_FRMLEN);
+      break;
+    case 'u':
+      checkformat(L, it->form, L_FMTFLAGSU, 1);
+      addlenmod(it->form, LUM_INTEGER_FRMLEN);
+      break;
+    case 'o': case 'x': case 'X':
+      checkformat(L, it->form, L_FMTFLAGSX, 1);
+      addlenmod(it->form, LUM_INTEGER_FRMLEN);
+      break;
+    case 'a': case 'A': case 'f':
+    case 'e': case 'E': case 'g': case 'G':
+      checkformat(L, it->form, L_FMTFLAGSF, 1);
+      addlenmod(it->form, LUM_NUMBER_FRMLEN);
+      break;
+    case 'q':
+      if (!it->simple)  /* modifiers? */
+        lumL_error(L, "specifier '%%q' cannot have modifiers");
+      break;
+    case 's':
+      if (!it->simple)
+        checkformat(L, it->form, L_FMTFLAGSC, 1);
+      break;
+    default:  /* also treat cases 'pnLlh' */
+      lumL_error(L, "invalid conversion '%s' to 'format'", it->form);
+  }
+}
+
+
+/*
+** Read the next item of a format string, from 'strfrmt' up to
+** 'strfrmt_end', into 'it'. Returns the position after the item.
+*/
+l_sinline const char *getitem (lum_State *L, const char *strfrmt,
+                            const char *strfrmt_end, FmtItem *it) {
+  it->lit = strfrmt;
+  it->conv = '\0';
+  while (strfrmt < strfrmt_end && *strfrmt != L_ESC)
+    strfrmt++;
+  it->litlen = ct_diff2sz(strfrmt - it->lit);
+  if (strfrmt < strfrmt_end) {  /* stopped at a '%'? */
+    if (*++strfrmt == L_ESC) {  /* %%? */
+      it->litlen++;  /* keep one '%' in the literal part */
+      strfrmt++;
+    }
+    else {  /* format item */
+      strfrmt = getformat(L, strfrmt, it->form);
+      it->conv = *strfrmt++;
+      checkconv(L, it);
+    }
+  }
+  return strfrmt;
+}
+
+
+/*
+** Compile the format string at index 'arg' and push the result.
+*/
+static Formatter *compileformat (lum_State *L, int arg) {
   size_t sfl;
   const char *strfrmt = lumL_checklstring(L, arg, &sfl);
-  const char *strfrmt_end = strfrmt+sfl;
-  const char *flags;
-  lumL_Buffer b;
-  lumL_buffinit(L, &b);
+  const char *strfrmt_end = strfrmt + sfl;
+  const char *p;
+  int n = 1;  /* maximum number of items */
+  Formatter *fmt;
+  FmtItem *it;
+  for (p = strfrmt; (p = (const char *)memchr(p, L_ESC,
+                             ct_diff2sz(strfrmt_end - p))) != NULL; p++)
+    n++;  /* each '%' may start a new item */
+  fmt = (Formatter *)lum_newuserdatauv(L, offsetof(Formatter, items) +
+                                          cast_sizet(n) * sizeof(FmtItem), 1);
+  fmt->nitems = 0;
+  fmt->litsize = 0;
+  lum_pushvalue(L, arg);
+  lum_setiuservalue(L, -2, 1);  /* keep the format string */
+  it = fmt->items;
   while (strfrmt < strfrmt_end) {
-    if (*strfrmt != L_ESC)
-      lumL_addchar(&b, *strfrmt++);
-    else if (*++strfrmt == L_ESC)
-      lumL_addchar(&b, *strfrmt++);  /* %% */
-    else { /* format item */
-      char form[MAX_FORMAT];  /* to store the format ('%...') */
-      unsigned maxitem = MAX_ITEM;  /* maximum length for the result */
-      char *buff = lumL_prepbuffsize(&b, maxitem);  /* to put result */
-      int nb = 0;  /* number of bytes in result */
-      if (++arg > top)
-        return lumL_argerror(L, arg, "no value");
-      strfrmt = getformat(L, strfrmt, form);
-      switch (*strfrmt++) {
-        case 'c': {
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          nb = l_sprintf(buff, maxitem, form, (int)lumL_checkinteger(L, arg));
-          break;
-        }
-        case 'd': case 'i':
-          flags = L_FMTFLAGSI;
-          goto intcase;
-        case 'u':
-          flags = L_FMTFLAGSU;
-          goto intcase;
-        case 'o': case 'x': case 'X':
-          flags = L_FMTFLAGSX;
-         intcase: {
-          lum_Integer n = lumL_checkinteger(L, arg);
-          checkformat(L, form, flags, 1);
-          addlenmod(form, LUM_INTEGER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUMI_UACINT)n);
-          break;
-        }
-        case 'a': case 'A':
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, LUM_NUMBER_FRMLEN);
-          nb = lum_number2strx(L, buff, maxitem, form,
-                                  lumL_checknumber(L, arg));
-          break;
-        case 'f':
-          maxitem = MAX_ITEMF;  /* extra space for '%f' */
-          buff = lumL_prepbuffsize(&b, maxitem);
-          /* FALLTHROUGH */
-        case 'e': case 'E': case 'g': case 'G': {
-          lum_Number n = lumL_checknumber(L, arg);
-          checkformat(L, form, L_FMTFLAGSF, 1);
-          addlenmod(form, LUM_NUMBER_FRMLEN);
-          nb = l_sprintf(buff, maxitem, form, (LUMI_UACNUMBER)n);
-          break;
-        }
-        case 'p': {
-          const void *p = lum_topointer(L, arg);
-          checkformat(L, form, L_FMTFLAGSC, 0);
-          if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
-            p = "(null)";  /* result */
-            form[strlen(form) - 1] = 's';  /* format it as a string */
-          }
-          nb = l_sprintf(buff, maxitem, form, p);
+    strfrmt = getitem(L, strfrmt, strfrmt_end, it);
+    fmt->litsize += it->litlen;
+    fmt->nitems++;
+    it++;
+  }
+  lumL_setmetatable(L, LUM_FORMATTER);
+  return fmt;
+}
+
+
+/*
+** A cache of compiled formats is a table, in upvalue 1 of the functions
+** that use it, with LUM_FMTCACHE slots in its array part. A slot keeps
+** either a format string seen once or the compiled form of a format
+** string (a full userdata with that string as its first user value).
+** A format string can be only in the slot selected by its address, so
+** that a lookup costs one array access plus a comparison; a new format
+** replaces the one in its slot.
+**
+** 'lookupslot' sets 'slot' to the slot for the format string at index
+** 'arg' and returns what that slot has for it: LUM_TUSERDATA for its
+** compiled form, which is pushed; LUM_TSTRING if the format was seen
+** once; or LUM_TNIL if it is not in the cache.
+*/
+static int lookupslot (lum_State *L, int arg, int *slot) {
+  unsigned h = point2uint(lum_topointer(L, arg)) >> 4;
+  int tt;
+  *slot = cast_int(h % LUM_FMTCACHE) + 1;
+  tt = lum_rawgeti(L, lum_upvalueindex(1), *slot);
+  if (tt == LUM_TUSERDATA) {  /* a compiled form? */
+    lum_getiuservalue(L, -1, 1);  /* get its format string */
+    if (lum_rawequal(L, -1, arg)) {  /* cache hit? */
+      lum_pop(L, 1);  /* leave only the compiled form */
+      return LUM_TUSERDATA;
+    }
+    lum_pop(L, 1);
+    tt = LUM_TNIL;  /* slot has another format */
+  }
+  else if (tt == LUM_TSTRING && !lum_rawequal(L, -1, arg))
+    tt = LUM_TNIL;  /* slot has another format */
+  lum_pop(L, 1);  /* remove slot contents */
+  return tt;
+}
+
+
+/*
+** Store the value on the top of the stack in slot 'slot' of the cache.
+** (The value stays on the stack.)
+*/
+static void setslot (lum_State *L, int slot) {
+  lum_pushvalue(L, -1);
+  lum_rawseti(L, lum_upvalueindex(1), slot);
+}
+
+
+/*
+** Get a compiled format for the format string at index 'arg', from
+** the cache of compiled formats or compiling it, and push it. Compiling
+** pays only when the format is used again, so, if 'direct' is true, a
+** format seen for the first time is only marked in the cache and the
+** function returns NULL (pushing nothing); the caller should then
+** interpret the format directly.
+*/
+static const Formatter *getformatter (lum_State *L, int arg, int direct) {
+  const Formatter *fmt;
+  int slot;
+  int tt;
+  lumL_checkstring(L, arg);
+  tt = lookupslot(L, arg, &slot);
+  if (tt == LUM_TUSERDATA)  /* cache hit? */
+    return (const Formatter *)lum_touserdata(L, -1);
+  else if (tt == LUM_TNIL && direct) {  /* not seen yet? */
+    lum_pushvalue(L, arg);
+    lum_rawseti(L, lum_upvalueindex(1), slot);  /* mark it as seen */
+    return NULL;
+  }
+  fmt = compileformat(L, arg);
+  setslot(L, slot);
+  return fmt;
+}
+
+
+/*
+** Convert integer 'n' to decimal in 'buff', without 'snprintf'.
+*/
+static int int2dec (char *buff, lum_Integer n) {
+  char digs[MAX_ITEM];
+  int nd = 0;
+  int len = 0;
+  lum_Unsigned u = l_castS2U(n);
+  if (n < 0) {
+    buff[len++] = '-';
+    u = 0u - u;
+  }
+  do {
+    digs[nd++] = cast_char('0' + cast_int(u % 10));
+    u /= 10;
+  } while (u > 0);
+  while (nd > 0)
+    buff[len++] = digs[--nd];
+  buff[len] = '\0';
+  return len;
+}
+
+
+/*
+** Format the value at index 'arg' with format item 'it' (which must
+** have a conversion) and add the result to buffer 'b'.
+*/
+l_sinline void additem (lum_State *L, lumL_Buffer *b, const FmtItem *it,
+                                                   int arg) {
+  const char *form = it->form;
+  unsigned maxitem = MAX_ITEM;  /* maximum length for the result */
+  char *buff = lumL_prepbuffsize(b, maxitem);  /* to put result */
+  int nb = 0;  /* number of bytes in result */
+  switch (it->conv) {
+    case 'c': {
+      nb = l_sprintf(buff, maxitem, form, (int)lumL_checkinteger(L, arg));
+      break;
+    }
+    case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': {
+      lum_Integer n = lumL_checkinteger(L, arg);
+      if (it->simple && (it->conv == 'd' || it->conv == 'i'))
+        nb = int2dec(buff, n);
+      else
+        nb = l_sprintf(buff, maxitem, form, (LUMI_UACINT)n);
+      break;
+    }
+    case 'a': case 'A':
+      nb = lum_number2strx(L, buff, maxitem, form,
+                              lumL_checknumber(L, arg));
+      break;
+    case 'f':
+      maxitem = MAX_ITEMF;  /* extra space for '%f' */
+      buff = lumL_prepbuffsize(b, maxitem);
+      /* FALLTHROUGH */
+    case 'e': case 'E': case 'g': case 'G': {
+      lum_Number n = lumL_checknumber(L, arg);
+      nb = fmtgfast(buff, form, n);
+      if (nb < 0)  /* no fast conversion? */
+        nb = l_sprintf(buff, maxitem, form, (LUMI_UACNUMBER)n);
+      break;
+    }
+    case 'p': {
+      const void *p = lum_topointer(L, arg);
+      char pform[MAX_FORMAT];
+      if (p == NULL) {  /* avoid calling 'printf' with argument NULL */
+        p = "(null)";  /* result */
+        strcpy(pform, form);
+        pform[strlen(pform) - 1] = 's';  /* format it as a string */
+        form = pform;
+      }
+      nb = l_sprintf(buff, maxitem, form, p);
+      break;
+    }
+    case 'q': {
+      addliteral(L, b, arg);
+      break;
+    }
+    case 's': {
+      size_t l;
+      const char *s;
+      lumL_StrBuff *sb;
+      if (it->simple) {  /* no modifiers? */
+        if (lum_type(L, arg) == LUM_TSTRING) {
+          s = lum_tolstring(L, arg, &l);
+          lumL_addlstring(b, s, l);  /* copy it directly */
           break;
         }
-        case 'q': {
-          if (form[2] != '\0')  /* modifiers? */
-            return lumL_error(L, "specifier '%%q' cannot have modifiers");
-          addliteral(L, &b, arg);
+        else if ((sb = (lumL_StrBuff *)lumL_testudata(L, arg,
+                                           LUM_STRBUFFHANDLE)) != NULL) {
+          lumL_addlstring(b, sb->b, sb->n);  /* add its contents */
           break;
         }
-        case 's': {
-          size_t l;
-          const char *s = lumL_tolstring(L, arg, &l);
-          if (form[2] == '\0')  /* no modifiers? */
-            lumL_addvalue(&b);  /* keep entire string */
-          else {
-            lumL_argcheck(L, l == strlen(s), arg, "string contains zeros");
-            checkformat(L, form, L_FMTFLAGSC, 1);
-            if (strchr(form, '.') == NULL && l >= 100) {
-              /* no precision and string is too long to be formatted */
-              lumL_addvalue(&b);  /* keep entire string */
-            }
-            else {  /* format the string into 'buff' */
-              nb = l_sprintf(buff, maxitem, form, s);
-              lum_pop(L, 1);  /* remove result from 'lumL_tolstring' */
-            }
-          }
-          break;
+      }
+      s = lumL_tolstring(L, arg, &l);
+      if (it->simple)  /* no modifiers? */
+        lumL_addvalue(b);  /* keep entire string */
+      else {
+        lumL_argcheck(L, l == strlen(s), arg, "string contains zeros");
+        if (strchr(form, '.') == NULL && l >= 100) {
+          /* no precision and string is too long to be formatted */
+          lumL_addvalue(b);  /* keep entire string */
         }
-        default: {  /* also treat cases 'pnLlh' */
-          return lumL_error(L, "invalid conversion '%s' to 'format'", form);
+        else {  /* format the string into 'buff' */
+          nb = l_sprintf(buff, maxitem, form, s);
+          lum_pop(L, 1);  /* remove result from 'lumL_tolstring' */
         }
       }
-      lum_assert(cast_uint(nb) < maxitem);
-      lumL_addsize(&b, cast_uint(nb));
+      break;
+    }
+    default: lum_assert(0);
+  }
+  lum_assert(cast_uint(nb) < maxitem);
+  lumL_addsize(b, cast_uint(nb));
+}
+
+
+/*
+** Format the values from index 'arg' + 1 up to 'top' with compiled
+** format 'fmt' and push the result.
+*/
+static int runformat (lum_State *L, const Formatter *fmt, int arg,
+                                                          int top) {
+  int i;
+  lumL_Buffer b;
+  lumL_buffinit(L, &b);
+  lumL_prepbuffsize(&b, fmt->litsize);  /* presize buffer */
+  for (i = 0; i < fmt->nitems; i++) {
+    const FmtItem *it = &fmt->items[i];
+    lumL_addlstring(&b, it->lit, it->litlen);
+    if (it->conv != '\0') {  /* format item? */
+      if (++arg > top)
+        return lumL_argerror(L, arg, "no value");
+      additem(L, &b, it, arg);
+    }
+  }
+  lumL_pushresult(&b);
+  return 1;
+}
+
+
+/*
+** Format the values from index 'arg' + 1 up to 'top' with the format
+** string at index 'arg', reading it item by item, and push the result.
+*/
+static int directformat (lum_State *L, int arg, int top) {
+  size_t sfl;
+  const char *strfrmt = lum_tolstring(L, arg, &sfl);
+  const char *strfrmt_end = strfrmt + sfl;
+  FmtItem it;
+  lumL_Buffer b;
+  lumL_buffinit(L, &b);
+  while (strfrmt < strfrmt_end) {
+    strfrmt = getitem(L, strfrmt, strfrmt_end, &it);
+    lumL_addlstring(&b, it.lit, it.litlen);
+    if (it.conv != '\0') {  /* format item? */
+      if (++arg > top)
+        return lumL_argerror(L, arg, "no value");
+      additem(L, &b, &it, arg);
     }
   }
   lumL_pushresult(&b);
   return 1;
 }
 
+
+/*
+** Format the values after the format string at index 'arg' and push
+** the result.
+*/
+static int formatvalues (lum_State *L, int arg) {
+  int top = lum_gettop(L);
+  const Formatter *fmt = getformatter(L, arg, 1);  /* (stays in the stack) */
+  if (fmt == NULL)  /* first use of this format? */
+    return directformat(L, arg, top);
+  return runformat(L, fmt, arg, top);
+}
+
+
+static int str_format (lum_State *L) {
+  return formatvalues(L, 1);
+}
+
+
+static int str_formatter (lum_State *L) {
+  getformatter(L, 1, 0);
+  return 1;
+}
+
+
+static int fmt_call (lum_State *L) {
+  const Formatter *fmt = (const Formatter *)lumL_checkudata(L, 1,
+                                                           LUM_FORMATTER);
+  return runformat(L, fmt, 1, lum_gettop(L));
+}
+
 /* }====================================================== */
 
 
@@ -1524,15 +2161,15 @@ static KOption getoption (Header *h, const char **fmt, size_t *size) {
 
 /*
 ** Read, classify, and fill other details about the next option.
-** 'psize' is filled with option's size, 'notoalign' with its
-** alignment requirements.
-** Local variable 'size' gets the size to be aligned. (Kpadal option
+** 'psize' is filled with option's size, 'palign' with its alignment
+** (1 if it needs no alignment).
+** Local variable 'align' gets the alignment. (Kpaddalign option
 ** always gets its full alignment, other options are limited by
 ** the maximum alignment ('maxalign'). Kchar option needs no alignment
 ** despite its size.
 */
-static KOption getdetails (Header *h, size_t totalsize, const char **fmt,
-                           size_t *psize, unsigned *ntoalign) {
+static KOption getdetails (Header *h, const char **fmt,
+                           size_t *psize, unsigned *palign) {
   KOption opt = getoption(h, fmt, psize);
   size_t align = *psize;  /* usually, alignment follows size */
   if (opt == Kpaddalign) {  /* 'X' gets alignment from following option */
@@ -1540,22 +2177,100 @@ static KOption getdetails (Header *h, size_t totalsize, const char **fmt,
       lumL_argerror(h->L, 1, "invalid next option for option 'X'");
   }
   if (align <= 1 || opt == Kchar)  /* need no alignment? */
-    *ntoalign = 0;
+    *palign = 1;
   else {
     if (align > h->maxalign)  /* enforce maximum alignment */
       align = h->maxalign;
     if (l_unlikely(!ispow2(align)))  /* not a power of 2? */
       lumL_argerror(h->L, 1, "format asks for alignment not power of 2");
-    else {
-      /* 'szmoda' = totalsize % align */
-      unsigned szmoda = cast_uint(totalsize & (align - 1));
-      *ntoalign = cast_uint((align - szmoda) & (align - 1));
-    }
+    *palign = cast_uint(align);
   }
   return opt;
 }
 
 
+/*
+** Number of padding bytes needed at position 'pos' for alignment
+** 'align' (a power of 2)
+*/
+#define ntoalign(pos,align)  \
+	cast_uint(((align) - ((pos) & ((align) - 1))) & ((align) - 1))
+
+
+/*
+** A compiled format is a list of items, one for each option that
+** packs a value or a padding; the other options (endianness, maximum
+** alignment, and spaces) are already applied to the items. Compiled
+** formats are kept in a cache of compiled formats (upvalue 1).
+*/
+typedef struct PackItem {
+  size_t size;  /* option's size */
+  lu_byte opt;  /* option (a KOption) */
+  lu_byte islittle;  /* endianness */
+  lu_byte align;  /* alignment (1 if none) */
+} PackItem;
+
+
+/* options up to Kzstr pack or unpack a value */
+#define hasvalue(opt)	((opt) <= Kzstr)
+
+
+typedef struct PackFormat {
+  int nitems;  /* number of items */
+  int nvalues;  /* number of values packed/unpacked */
+  int fixed;  /* true iff all items have fixed sizes */
+  PackItem items[1];  /* (actual size is 'nitems') */
+} PackFormat;
+
+
+static const PackFormat *compilepack (lum_State *L, int arg) {
+  Header h;
+  size_t lfmt;
+  const char *fmt = lum_tolstring(L, arg, &lfmt);
+  PackFormat *pf;
+  /* each item uses at least one character of the format */
+  pf = (PackFormat *)lum_newuserdatauv(L, offsetof(PackFormat, items) +
+                                         (lfmt + 1) * sizeof(PackItem), 1);
+  lum_pushvalue(L, arg);
+  lum_setiuservalue(L, -2, 1);  /* keep the format string (for the cache) */
+  pf->nitems = pf->nvalues = 0;
+  pf->fixed = 1;
+  initheader(L, &h);
+  while (*fmt != '\0') {
+    PackItem *it = &pf->items[pf->nitems];
+    unsigned align;
+    KOption opt = getdetails(&h, &fmt, &it->size, &align);
+    if (opt == Knop)
+      continue;  /* its effects are already in 'h' */
+    it->opt = cast_byte(opt);
+    it->islittle = cast_byte(h.islittle);
+    it->align = cast_byte(align);
+    if (hasvalue(opt))
+      pf->nvalues++;
+    if (opt == Kstring || opt == Kzstr)
+      pf->fixed = 0;
+    pf->nitems++;
+  }
+  return pf;
+}
+
+
+/*
+** Get a compiled pack format for the format string at index 'arg', from
+** the cache of compiled formats or compiling it, and push it.
+*/
+static const PackFormat *getpackformat (lum_State *L, int arg) {
+  const PackFormat *pf;
+  int slot;
+  lumL_checkstring(L, arg);
+  if (lookupslot(L, arg, &slot) == LUM_TUSERDATA)  /* cache hit? */
+    return (const PackFormat *)lum_touserdata(L, -1);
+  pf = compilepack(L, arg);
+  setslot(L, slot);
+  return pf;
+}
+
+
 /*
 ** Pack integer 'n' with 'size' bytes and 'islittle' endianness.
 ** The final 'if' handles the case when 'size' is larger than
@@ -1597,31 +2312,32 @@ static void copywithendian (char *dest, const char *src,
 
 static int str_pack (lum_State *L) {
   lumL_Buffer b;
-  Header h;
-  const char *fmt = lumL_checkstring(L, 1);  /* format string */
+  const PackFormat *pf = getpackformat(L, 1);  /* (stays in the stack) */
+  const PackItem *it = pf->items;
+  const PackItem *last = it + pf->nitems;
   int arg = 1;  /* current argument to pack */
   size_t totalsize = 0;  /* accumulate total size of result */
-  initheader(L, &h);
   lum_pushnil(L);  /* mark to separate arguments from string buffer */
+  lum_insert(L, -2);  /* (put it below the compiled format) */
   lumL_buffinit(L, &b);
-  while (*fmt != '\0') {
-    unsigned ntoalign;
-    size_t size;
-    KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
+  for (; it < last; it++) {
+    unsigned ntoalign = ntoalign(totalsize, it->align);
+    size_t size = it->size;
+    int islittle = it->islittle;
     lumL_argcheck(L, size + ntoalign <= MAX_SIZE - totalsize, arg,
                      "result too long");
     totalsize += ntoalign + size;
     while (ntoalign-- > 0)
      lumL_addchar(&b, LUML_PACKPADBYTE);  /* fill alignment */
     arg++;
-    switch (opt) {
+    switch (cast(KOption, it->opt)) {
       case Kint: {  /* signed integers */
         lum_Integer n = lumL_checkinteger(L, arg);
         if (size < SZINT) {  /* need overflow check? */
           lum_Integer lim = (lum_Integer)1 << ((size * NB) - 1);
           lumL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
         }
-        packint(&b, (lum_Unsigned)n, h.islittle, cast_uint(size), (n < 0));
+        packint(&b, (lum_Unsigned)n, islittle, cast_uint(size), (n < 0));
         break;
       }
       case Kuint: {  /* unsigned integers */
@@ -1629,14 +2345,14 @@ static int str_pack (lum_State *L) {
         if (size < SZINT)  /* need overflow check? */
           lumL_argcheck(L, (lum_Unsigned)n < ((lum_Unsigned)1 << (size * NB)),
                            arg, "unsigned overflow");
-        packint(&b, (lum_Unsigned)n, h.islittle, cast_uint(size), 0);
+        packint(&b, (lum_Unsigned)n, islittle, cast_uint(size), 0);
         break;
       }
       case Kfloat: {  /* C float */
         float f = (float)lumL_checknumber(L, arg);  /* get argument */
         char *buff = lumL_prepbuffsize(&b, sizeof(f));
         /* move 'f' to final result, correcting endianness if needed */
-        copywithendian(buff, (char *)&f, sizeof(f), h.islittle);
+        copywithendian(buff, (char *)&f, sizeof(f), islittle);
         lumL_addsize(&b, size);
         break;
       }
@@ -1644,7 +2360,7 @@ static int str_pack (lum_State *L) {
         lum_Number f = lumL_checknumber(L, arg);  /* get argument */
         char *buff = lumL_prepbuffsize(&b, sizeof(f));
         /* move 'f' to final result, correcting endianness if needed */
-        copywithendian(buff, (char *)&f, sizeof(f), h.islittle);
+        copywithendian(buff, (char *)&f, sizeof(f), islittle);
         lumL_addsize(&b, size);
         break;
       }
@@ -1652,7 +2368,7 @@ static int str_pack (lum_State *L) {
         double f = (double)lumL_checknumber(L, arg);  /* get argument */
         char *buff = lumL_prepbuffsize(&b, sizeof(f));
         /* move 'f' to final result, correcting endianness if needed */
-        copywithendian(buff, (char *)&f, sizeof(f), h.islittle);
+        copywithendian(buff, (char *)&f, sizeof(f), islittle);
         lumL_addsize(&b, size);
         break;
       }
@@ -1676,7 +2392,7 @@ static int str_pack (lum_State *L) {
                          len < ((lum_Unsigned)1 << (size * NB)),
                          arg, "string length does not fit in given size");
         /* pack length */
-        packint(&b, (lum_Unsigned)len, h.islittle, cast_uint(size), 0);
+        packint(&b, (lum_Unsigned)len, islittle, cast_uint(size), 0);
         lumL_addlstring(&b, s, len);
         totalsize += len;
         break;
@@ -1702,17 +2418,13 @@ static int str_pack (lum_State *L) {
 
 
 static int str_packsize (lum_State *L) {
-  Header h;
-  const char *fmt = lumL_checkstring(L, 1);  /* format string */
+  const PackFormat *pf = getpackformat(L, 1);
+  int i;
   size_t totalsize = 0;  /* accumulate total size of result */
-  initheader(L, &h);
-  while (*fmt != '\0') {
-    unsigned ntoalign;
-    size_t size;
-    KOption opt = getdetails(&h, totalsize, &fmt, &size, &ntoalign);
-    lumL_argcheck(L, opt != Kstring && opt != Kzstr, 1,
-                     "variable-length format");
-    size += ntoalign;  /* total space used by option */
+  lumL_argcheck(L, pf->fixed, 1, "variable-length format");
+  for (i = 0; i < pf->nitems; i++) {
+    const PackItem *it = &pf->items[i];
+    size_t size = it->size + ntoalign(totalsize, it->align);
     lumL_argcheck(L, totalsize <= LUM_MAXINTEGER - size,
                      1, "format result too large");
     totalsize += size;
@@ -1756,102 +2468,428 @@ static lum_Integer unpackint (lum_State *L, const char *str,
 }
 
 
+/*
+** Unpack item 'it' from position 'pos' of 'data' (with length 'ld'),
+** pushing its value, if it has one. Returns the position after the
+** item.
+*/
+static size_t unpackitem (lum_State *L, const PackItem *it,
+                          const char *data, size_t ld, size_t pos) {
+  size_t size = it->size;
+  int islittle = it->islittle;
+  unsigned ntoalign = ntoalign(pos, it->align);
+  lumL_argcheck(L, ntoalign + size <= ld - pos, 2, "data string too short");
+  pos += ntoalign;  /* skip alignment */
+  switch (cast(KOption, it->opt)) {
+    case Kint:
+    case Kuint: {
+      lum_Integer res = unpackint(L, data + pos, islittle, cast_int(size),
+                                     (it->opt == Kint));
+      lum_pushinteger(L, res);
+      break;
+    }
+    case Kfloat: {
+      float f;
+      copywithendian((char *)&f, data + pos, sizeof(f), islittle);
+      lum_pushnumber(L, (lum_Number)f);
+      break;
+    }
+    case Knumber: {
+      lum_Number f;
+      copywithendian((char *)&f, data + pos, sizeof(f), islittle);
+      lum_pushnumber(L, f);
+      break;
+    }
+    case Kdouble: {
+      double f;
+      copywithendian((char *)&f, data + pos, sizeof(f), islittle);
+      lum_pushnumber(L, (lum_Number)f);
+      break;
+    }
+    case Kchar: {
+      lum_pushlstring(L, data + pos, size);
+      break;
+    }
+    case Kstring: {
+      lum_Unsigned len = (lum_Unsigned)unpackint(L, data + pos,
+                                                 islittle, cast_int(size), 0);
+      lumL_argcheck(L, len <= ld - pos - size, 2, "data string too short");
+      lum_pushlstring(L, data + pos + size, len);
+      pos += len;  /* skip string */
+      break;
+    }
+    case Kzstr: {
+      size_t len = strlen(data + pos);
+      lumL_argcheck(L, pos + len < ld, 2,
+                       "unfinished string for format 'z'");
+      lum_pushlstring(L, data + pos, len);
+      pos += len + 1;  /* skip string plus final '\0' */
+      break;
+    }
+    case Kpaddalign: case Kpadding: case Knop:
+      break;
+  }
+  return pos + size;
+}
+
+
 static int str_unpack (lum_State *L) {
-  Header h;
-  const char *fmt = lumL_checkstring(L, 1);
   size_t ld;
   const char *data = lumL_checklstring(L, 2, &ld);
   size_t pos = posrelatI(lumL_optinteger(L, 3, 1), ld) - 1;
-  int n = 0;  /* number of results */
+  const PackFormat *pf = getpackformat(L, 1);
+  int i;
   lumL_argcheck(L, pos <= ld, 3, "initial position out of string");
-  initheader(L, &h);
-  while (*fmt != '\0') {
-    unsigned ntoalign;
-    size_t size;
-    KOption opt = getdetails(&h, pos, &fmt, &size, &ntoalign);
-    lumL_argcheck(L, ntoalign + size <= ld - pos, 2,
-                    "data string too short");
-    pos += ntoalign;  /* skip alignment */
-    /* stack space for item + next position */
-    lumL_checkstack(L, 2, "too many results");
-    n++;
-    switch (opt) {
-      case Kint:
-      case Kuint: {
-        lum_Integer res = unpackint(L, data + pos, h.islittle,
-                                       cast_int(size), (opt == Kint));
-        lum_pushinteger(L, res);
-        break;
-      }
-      case Kfloat: {
-        float f;
-        copywithendian((char *)&f, data + pos, sizeof(f), h.islittle);
-        lum_pushnumber(L, (lum_Number)f);
-        break;
-      }
-      case Knumber: {
-        lum_Number f;
-        copywithendian((char *)&f, data + pos, sizeof(f), h.islittle);
-        lum_pushnumber(L, f);
-        break;
-      }
-      case Kdouble: {
-        double f;
-        copywithendian((char *)&f, data + pos, sizeof(f), h.islittle);
-        lum_pushnumber(L, (lum_Number)f);
-        break;
-      }
-      case Kchar: {
-        lum_pushlstring(L, data + pos, size);
-        break;
+  /* stack space for all items + next position */
+  lumL_checkstack(L, pf->nvalues + 1, "too many results");
+  for (i = 0; i < pf->nitems; i++)
+    pos = unpackitem(L, &pf->items[i], data, ld, pos);
+  lum_pushinteger(L, cast_st2S(pos) + 1);  /* next position */
+  return pf->nvalues + 1;
+}
+
+
+/*
+** unpackmany(fmt, data [, pos [, n [, columns]]]) --> table, nextpos
+** Unpack 'n' records with format 'fmt' (by default, until the end of
+** 'data'). Without 'columns', the result is a list of records, each one
+** a list with its values; with 'columns', it is a list of columns, each
+** one a list with the corresponding values of all records.
+*/
+static int str_unpackmany (lum_State *L) {
+  size_t ld;
+  const char *data = lumL_checklstring(L, 2, &ld);
+  size_t pos = posrelatI(lumL_optinteger(L, 3, 1), ld) - 1;
+  lum_Integer n = lumL_optinteger(L, 4, -1);  /* -1: until end of data */
+  int columns = lum_toboolean(L, 5);
+  const PackFormat *pf;
+  int nvalues, res;
+  lum_Integer i;
+  size_t avail;  /* expected number of records (0 if unknown) */
+  int j, nrec;
+  lumL_argcheck(L, pos <= ld, 3, "initial position out of string");
+  lumL_argcheck(L, n >= 0 || lum_isnoneornil(L, 4), 4, "negative count");
+  pf = getpackformat(L, 1);
+  nvalues = pf->nvalues;
+  res = lum_gettop(L) + 1;  /* index of result */
+  if (pf->fixed) {  /* can estimate number of records? */
+    size_t recsize = 0;
+    for (j = 0; j < pf->nitems; j++)  /* (ignoring alignment) */
+      recsize += pf->items[j].size;
+    lumL_argcheck(L, recsize > 0, 1, "format has no data");
+    avail = (ld - pos) / recsize;
+  }
+  else  /* each record uses at least one byte ('s' or 'z' options) */
+    avail = (n >= 0) ? ld - pos : 0;
+  if (n >= 0 && l_castS2U(n) < avail)
+    avail = (size_t)n;
+  nrec = (avail <= INT_MAX) ? cast_int(avail) : INT_MAX;
+  if (columns) {
+    lumL_checkstack(L, nvalues + 2, "too many columns");
+    lum_createtable(L, nvalues, 0);  /* result */
+    for (j = 1; j <= nvalues; j++) {
+      lum_createtable(L, nrec, 0);  /* column 'j' (at 'res + j') */
+      lum_pushvalue(L, -1);
+      lum_rawseti(L, res, j);
+    }
+  }
+  else {
+    lumL_checkstack(L, 3, "too many values");
+    lum_createtable(L, nrec, 0);  /* result */
+  }
+  for (i = 1; (n >= 0) ? (i <= n) : (pos < ld); i++) {
+    int k = 0;  /* number of values in current record */
+    if (!columns)
+      lum_createtable(L, nvalues, 0);  /* new record */
+    for (j = 0; j < pf->nitems; j++) {
+      const PackItem *it = &pf->items[j];
+      pos = unpackitem(L, it, data, ld, pos);
+      if (hasvalue(it->opt)) {
+        k++;
+        if (columns)  /* store value in its column */
+          lum_rawseti(L, res + k, i);
+        else
+          lum_rawseti(L, -2, k);
       }
-      case Kstring: {
-        lum_Unsigned len = (lum_Unsigned)unpackint(L, data + pos,
-                                          h.islittle, cast_int(size), 0);
-        lumL_argcheck(L, len <= ld - pos - size, 2, "data string too short");
-        lum_pushlstring(L, data + pos + size, len);
-        pos += len;  /* skip string */
-        break;
+    }
+    if (!columns)
+      lum_rawseti(L, res, i);  /* store record */
+  }
+  lum_settop(L, res);
+  lum_pushinteger(L, cast_st2S(pos) + 1);  /* next position */
+  return 2;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** STRING BUFFERS
+** =======================================================
+*/
+
+
+#define checksb(L,i)  \
+	((lumL_StrBuff *)lumL_checkudata(L, i, LUM_STRBUFFHANDLE))
+
+#define testsb(L,i)  \
+	((lumL_StrBuff *)lumL_testudata(L, i, LUM_STRBUFFHANDLE))
+
+
+/*
+** Returns a pointer to a free area with at least 'sz' bytes in buffer
+** 'sb'. The buffer always keeps space for an extra byte, so that its
+** block can be handed over to an external string (which must end with
+** a '\0').
+*/
+static char *prepsb (lum_State *L, lumL_StrBuff *sb, size_t sz) {
+  if (sb->size - sb->n <= sz) {  /* not enough space? */
+    void *ud;
+    lum_Alloc allocf = lum_getallocf(L, &ud);
+    size_t newsize = (sb->size / 2) * 3;  /* buffer size * 1.5 */
+    char *temp;
+    if (l_unlikely(sz > MAX_SIZE - sb->n - 1))
+      lumL_error(L, "resulting string too large");
+    if (newsize < sb->n + sz + 1 || newsize > MAX_SIZE)
+      newsize = sb->n + sz + 1;  /* newsize was not big enough or too big */
+    if (newsize < LUML_BUFFERSIZE)
+      newsize = LUML_BUFFERSIZE;
+    temp = (char *)allocf(ud, sb->b, sb->size, newsize);
+    if (l_unlikely(temp == NULL)) {  /* allocation error? */
+      lum_pushliteral(L, "not enough memory");
+      lum_error(L);  /* raise a memory error */
+    }
+    sb->b = temp;
+    sb->size = newsize;
+  }
+  return sb->b + sb->n;
+}
+
+
+static void addsb (lum_State *L, lumL_StrBuff *sb, const char *s,
+                                                   size_t l) {
+  if (l > 0) {  /* avoid 'memcpy' when 's' can be NULL */
+    char *p = prepsb(L, sb, l);
+    memcpy(p, s, l * sizeof(char));
+    sb->n += l;
+  }
+}
+
+
+static int str_buffer (lum_State *L) {
+  lum_Integer sz = lumL_optinteger(L, 1, 0);
+  lumL_StrBuff *sb;
+  lumL_argcheck(L, 0 <= sz && l_castS2U(sz) < MAX_SIZE, 1, "out of range");
+  sb = (lumL_StrBuff *)lum_newuserdatauv(L, sizeof(lumL_StrBuff), 0);
+  sb->b = NULL;
+  sb->size = sb->n = 0;
+  lumL_setmetatable(L, LUM_STRBUFFHANDLE);
+  if (sz > 0)
+    prepsb(L, sb, cast_sizet(sz));
+  return 1;
+}
+
+
+static int sb_put (lum_State *L) {
+  lumL_StrBuff *sb = checksb(L, 1);
+  int top = lum_gettop(L);
+  int arg;
+  for (arg = 2; arg <= top; arg++) {
+    lumL_StrBuff *other = testsb(L, arg);
+    if (other != NULL) {  /* another buffer (or itself)? */
+      size_t l = other->n;
+      if (l > 0) {
+        char *p = prepsb(L, sb, l);  /* may move 'other->b' */
+        memcpy(p, other->b, l * sizeof(char));
+        sb->n += l;
       }
-      case Kzstr: {
-        size_t len = strlen(data + pos);
-        lumL_argcheck(L, pos + len < ld, 2,
-                         "unfinished string for format 'z'");
-        lum_pushlstring(L, data + pos, len);
-        pos += len + 1;  /* skip string plus final '\0' */
-        break;
+    }
+    else {
+      char buff[LUM_N2SBUFFSZ];
+      const char *s;
+      size_t l = lum_numbertocstring(L, arg, buff);  /* try as a number */
+      if (l > 0) {  /* did conversion work (value was a number)? */
+        s = buff;
+        l--;
       }
-      case Kpaddalign: case Kpadding: case Knop:
-        n--;  /* undo increment */
-        break;
+      else  /* must be a string */
+        s = lumL_checklstring(L, arg, &l);
+      addsb(L, sb, s, l);
     }
-    pos += size;
   }
-  lum_pushinteger(L, cast_st2S(pos) + 1);  /* next position */
-  return n + 1;
+  lum_settop(L, 1);
+  return 1;  /* return the buffer */
+}
+
+
+static int sb_putf (lum_State *L) {
+  lumL_StrBuff *sb = checksb(L, 1);
+  size_t l;
+  const char *s;
+  formatvalues(L, 2);
+  s = lum_tolstring(L, -1, &l);
+  addsb(L, sb, s, l);
+  lum_settop(L, 1);
+  return 1;  /* return the buffer */
+}
+
+
+static int sb_reserve (lum_State *L) {
+  lumL_StrBuff *sb = checksb(L, 1);
+  lum_Integer sz = lumL_checkinteger(L, 2);
+  lumL_argcheck(L, 0 <= sz && l_castS2U(sz) < MAX_SIZE, 2, "out of range");
+  prepsb(L, sb, cast_sizet(sz));
+  lum_settop(L, 1);
+  return 1;  /* return the buffer */
+}
+
+
+static int sb_reset (lum_State *L) {
+  lumL_StrBuff *sb = checksb(L, 1);
+  sb->n = 0;  /* keep the block for new contents */
+  lum_settop(L, 1);
+  return 1;  /* return the buffer */
+}
+
+
+/*
+** Returns the contents of the buffer as a string, emptying the buffer.
+** Small contents are copied, so that the buffer can reuse its block.
+** Otherwise, the block is handed over to a new external string, which
+** avoids copying the contents.
+*/
+static int sb_tostring (lum_State *L) {
+  lumL_StrBuff *sb = checksb(L, 1);
+  size_t n = sb->n;
+  if (n < LUML_BUFFERSIZE) {  /* small contents? */
+    lum_pushlstring(L, sb->b, n);
+    sb->n = 0;
+  }
+  else {
+    void *ud;
+    lum_Alloc allocf = lum_getallocf(L, &ud);
+    /* shrink block to the string size (it always has space for the '\0') */
+    char *b = (char *)allocf(ud, sb->b, sb->size, n + 1);
+    if (l_unlikely(b == NULL)) {  /* allocation error? */
+      lum_pushliteral(L, "not enough memory");
+      lum_error(L);  /* raise a memory error */
+    }
+    b[n] = '\0';
+    sb->b = NULL;  /* buffer does not own the block anymore */
+    sb->size = sb->n = 0;
+    lum_pushexternalstring(L, b, n, allocf, ud);
+  }
+  return 1;
+}
+
+
+static int sb_len (lum_State *L) {
+  lumL_StrBuff *sb = checksb(L, 1);
+  lum_pushinteger(L, l_castU2S(sb->n));
+  return 1;
+}
+
+
+static int sb_contents (lum_State *L) {
+  lumL_StrBuff *sb = checksb(L, 1);
+  lum_pushlstring(L, sb->b, sb->n);  /* copy contents; keep the buffer */
+  return 1;
+}
+
+
+static int sb_gc (lum_State *L) {
+  lumL_StrBuff *sb = checksb(L, 1);
+  void *ud;
+  lum_Alloc allocf = lum_getallocf(L, &ud);
+  allocf(ud, sb->b, sb->size, 0);  /* free block */
+  sb->b = NULL;
+  sb->size = sb->n = 0;
+  return 0;
+}
+
+
+/*
+** methods for string buffers
+*/
+static const lumL_Reg sbmethods[] = {
+  {"put", sb_put},
+  {"putf", sb_putf},
+  {"reserve", sb_reserve},
+  {"reset", sb_reset},
+  {"tostring", sb_tostring},
+  {NULL, NULL}
+};
+
+
+/*
+** metamethods for string buffers
+*/
+static const lumL_Reg sbmetameth[] = {
+  {"__index", NULL},  /* place holder */
+  {"__len", sb_len},
+  {"__tostring", sb_contents},
+  {"__gc", sb_gc},
+  {NULL, NULL}
+};
+
+
+/*
+** Create the metatable for buffers. Buffer methods get the cache of
+** compiled formats (at the top of the stack) as their upvalue.
+*/
+static void createsbmeta (lum_State *L) {
+  lumL_newmetatable(L, LUM_STRBUFFHANDLE);  /* metatable for buffers */
+  lumL_setfuncs(L, sbmetameth, 0);  /* add metamethods to new metatable */
+  lumL_newlibtable(L, sbmethods);  /* create method table */
+  lum_pushvalue(L, -3);  /* cache of compiled formats */
+  lumL_setfuncs(L, sbmethods, 1);  /* add buffer methods to method table */
+  lum_setfield(L, -2, "__index");  /* metatable.__index = method table */
+  lum_pop(L, 1);  /* pop metatable */
 }
 
 /* }====================================================== */
 
 
 static const lumL_Reg strlib[] = {
+  {"buffer", str_buffer},
   {"byte", str_byte},
   {"char", str_char},
   {"dump", str_dump},
   {"find", str_find},
-  {"format", str_format},
   {"gmatch", gmatch},
   {"gsub", str_gsub},
   {"len", str_len},
+  {"lines", str_lines},
   {"lower", str_lower},
   {"match", str_match},
   {"rep", str_rep},
   {"reverse", str_reverse},
+  {"split", str_split},
   {"sub", str_sub},
   {"upper", str_upper},
+  {NULL, NULL}
+};
+
+
+/*
+** functions that use the cache of compiled formats
+*/
+static const lumL_Reg fmtfuncs[] = {
+  {"format", str_format},
+  {"formatter", str_formatter},
+  {NULL, NULL}
+};
+
+
+/*
+** functions that use the cache of compiled pack formats
+*/
+static const lumL_Reg packfuncs[] = {
   {"pack", str_pack},
   {"packsize", str_packsize},
   {"unpack", str_unpack},
+  {"unpackmany", str_unpackmany},
   {NULL, NULL}
 };
 
@@ -1876,6 +2914,15 @@ static void createmetatable (lum_State *L) {
 LUMMOD_API int lumopen_string (lum_State *L) {
   lumL_newlib(L, strlib);
   createmetatable(L);
+  lum_createtable(L, LUM_FMTCACHE, 0);  /* cache of compiled formats */
+  createsbmeta(L);
+  lumL_setfuncs(L, fmtfuncs, 1);  /* format functions share the cache */
+  lum_createtable(L, LUM_FMTCACHE, 0);  /* cache of pack formats */
+  lumL_setfuncs(L, packfuncs, 1);
+  lumL_newmetatable(L, LUM_FORMATTER);  /* metatable for compiled formats */
+  lum_pushcfunction(L, fmt_call);
+  lum_setfield(L, -2, "__call");
+  lum_pop(L, 1);  /* pop metatable */
   return 1;
 }
 
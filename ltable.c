@@ -710,6 +710,8 @@ void lumH_resize (lum_State *L, Table *t, unsigned newasize,
   Value *newarray;
   if (newasize > MAXASIZE)
     lumG_runerror(L, "table overflow");
+  if (isinchain(t))  /* cache may point into its hash part? */
+    lumH_unchain(L, t);
   /* create new hash part with appropriate size into 'newt' */
   newt.flags = 0;
   setnodevector(L, &newt, nhsize);
@@ -983,6 +985,24 @@ lu_byte lumH_getshortstr (Table *t, TString *key, TValue *res) {
 }
 
 
+/*
+** Search for a short string, keeping in '*c' the index of the node
+** where it was found (see 'lumH_fastgetk').
+*/
+static const TValue *getshortstrc (Table *t, TString *key, unsigned *c) {
+  const TValue *slot = lumH_Hgetshortstr(t, key);
+  if (!isabstkey(slot))
+    *c = cast_uint(nodefromval(slot) - gnode(t, 0));
+  return slot;
+}
+
+
+lu_byte lumH_getshortstrc (Table *t, TString *key, unsigned *c,
+                                     TValue *res) {
+  return finishnodeget(getshortstrc(t, key, c), res);
+}
+
+
 static const TValue *Hgetlongstr (Table *t, TString *key) {
   TValue ko;
   lum_assert(!strisshr(key));
@@ -1078,19 +1098,36 @@ static int psetint (Table *t, lum_Integer key, TValue *val) {
 
 
 /*
-** This function could be just this:
-**    return finishnodeset(t, lumH_Hgetshortstr(t, key), val);
+** Check whether short string 'key' is "__index". In a table that is
+** part of a cached '__index' chain, assignments to existing fields do
+** not change the cache (which keeps slots, not values), except for
+** that field. (Short strings are internalized, so a cheap comparison
+** of lengths filters most keys.)
+*/
+static int isindexname (const TString *key) {
+  return (key->shrlen == 7 && memcmp(getshrstr(key), "__index", 7) == 0);
+}
+
+
+/*
+** Pre-set short string 'key', whose current slot is 'slot'. This
+** function could be just this:
+**    return finishnodeset(t, slot, val);
 ** However, it optimizes the common case created by constructors (e.g.,
 ** {x=1, y=2}), which creates a key in a table that has no metatable,
 ** it is not old/black, and it already has space for the key.
 */
 
-int lumH_psetshortstr (Table *t, TString *key, TValue *val) {
-  const TValue *slot = lumH_Hgetshortstr(t, key);
+static int psetshortstr (Table *t, TString *key, const TValue *slot,
+                                                  TValue *val) {
   if (!ttisnil(slot)) {  /* key already has a value? (all too common) */
+    if (l_unlikely(isinchain(t) && isindexname(key)))
+      return HINCHAIN;  /* changes a cached '__index' chain */
     setobj(((lum_State*)NULL), cast(TValue*, slot), val);  /* update it */
     return HOK;  /* done */
   }
+  else if (l_unlikely(isinchain(t)))  /* new key may shadow cached ones */
+    return HINCHAIN;
   else if (checknoTM(t->metatable, TM_NEWINDEX)) {  /* no metamethod? */
     if (ttisnil(val))  /* new value is nil? */
       return HOK;  /* done (value is already nil/absent) */
@@ -1111,6 +1148,17 @@ int lumH_psetshortstr (Table *t, TString *key, TValue *val) {
 }
 
 
+int lumH_psetshortstr (Table *t, TString *key, TValue *val) {
+  return psetshortstr(t, key, lumH_Hgetshortstr(t, key), val);
+}
+
+
+int lumH_psetshortstrc (Table *t, TString *key, unsigned *c,
+                                  TValue *val) {
+  return psetshortstr(t, key, getshortstrc(t, key, c), val);
+}
+
+
 int lumH_psetstr (Table *t, TString *key, TValue *val) {
   if (strisshr(key))
     return lumH_psetshortstr(t, key, val);
@@ -1144,6 +1192,12 @@ int lumH_pset (Table *t, const TValue *key, TValue *val) {
 void lumH_finishset (lum_State *L, Table *t, const TValue *key,
                                     TValue *value, int hres) {
   lum_assert(hres != HOK);
+  if (hres == HINCHAIN) {
+    lumH_unchain(L, t);
+    hres = lumH_pset(t, key, value);  /* try again */
+    if (hres == HOK)
+      return;
+  }
   if (hres == HNOTFOUND) {
     TValue aux;
     if (l_unlikely(ttisnil(key)))
@@ -1170,6 +1224,16 @@ void lumH_finishset (lum_State *L, Table *t, const TValue *key,
 }
 
 
+/*
+** Table 't' is going to change: remove it from the '__index' chains
+** and invalidate all results cached for them.
+*/
+void lumH_unchain (lum_State *L, Table *t) {
+  t->flags &= cast_byte(~BITINCHAIN);
+  lumV_clearidxcache(G(L));
+}
+
+
 /*
 ** beware: when using this function you probably need to check a GC
 ** barrier and invalidate the TM cache.
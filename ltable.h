@@ -36,6 +36,18 @@
 #define setdummy(t)		((t)->flags |= BITDUMMY)
 
 
+/*
+** Bit BITINCHAIN set in 'flags' means the table is part of an '__index'
+** chain whose result may be in the index cache (see 'lumV_finishget').
+** Adding a short-string key to such a table, resizing it, or changing
+** its field "__index" must go through 'lumH_unchain'.
+*/
+
+#define BITINCHAIN		(1 << 7)
+#define isinchain(t)		((t)->flags & BITINCHAIN)
+#define setinchain(t)		((t)->flags |= BITINCHAIN)
+
+
 
 /* allocated size for hash nodes */
 #define allocsizenode(t)	(isdummy(t) ? 0 : sizenode(t))
@@ -64,11 +76,34 @@
     else { hres = lumH_psetint(h, k, val); }}
 
 
+/*
+** Fast get/pre-set for a constant short-string key 'k'. '*c' is the
+** index of the node where that key was found last time; the node is
+** checked first and, if it no longer holds the key (or holds it with
+** no value), the functions do a regular search, updating '*c'.
+*/
+#define lumH_fastgetk(t,k,c,res,tag) \
+  { Table *h = t; Node *n = gnode(h, *(c) & (sizenode(h) - 1)); \
+    if (keyisshrstr(n) && keystrval(n) == (k) && \
+        !tagisempty((tag = ttypetag(gval(n))))) \
+      { setobj(cast(lum_State *, NULL), res, gval(n)); } \
+    else { tag = lumH_getshortstrc(h, k, c, res); }}
+
+
+#define lumH_fastsetk(t,k,c,val,hres) \
+  { Table *h = t; Node *n = gnode(h, *(c) & (sizenode(h) - 1)); \
+    if (keyisshrstr(n) && keystrval(n) == (k) && !isempty(gval(n)) && \
+        !isinchain(h)) \
+      { setobj(cast(lum_State *, NULL), gval(n), val); hres = HOK; } \
+    else { hres = lumH_psetshortstrc(h, k, c, val); }}
+
+
 /* results from pset */
 #define HOK		0
 #define HNOTFOUND	1
 #define HNOTATABLE	2
-#define HFIRSTNODE	3
+#define HINCHAIN	3
+#define HFIRSTNODE	4
 
 /*
 ** 'lumH_get*' operations set 'res', unless the value is absent, and
@@ -82,7 +117,9 @@
 ** hash part, the encoding is (HFIRSTNODE + hash index); if the slot is
 ** in the array part, the encoding is (~array index), a negative value.
 ** The value HNOTATABLE is used by the fast macros to signal that the
-** value being indexed is not a table.
+** value being indexed is not a table. The value HINCHAIN signals that
+** the table is in a cached '__index' chain, so the set must be done by
+** 'lumH_finishset'/'lumV_finishset', which first invalidate the cache.
 ** (The size for the array part is limited by the maximum power of two
 ** that fits in an unsigned integer; that is INT_MAX+1. So, the C-index
 ** ranges from 0, which encodes to -1, to INT_MAX, which encodes to
@@ -148,6 +185,8 @@
 
 LUMI_FUNC lu_byte lumH_get (Table *t, const TValue *key, TValue *res);
 LUMI_FUNC lu_byte lumH_getshortstr (Table *t, TString *key, TValue *res);
+LUMI_FUNC lu_byte lumH_getshortstrc (Table *t, TString *key, unsigned *c,
+                                                TValue *res);
 LUMI_FUNC lu_byte lumH_getstr (Table *t, TString *key, TValue *res);
 LUMI_FUNC lu_byte lumH_getint (Table *t, lum_Integer key, TValue *res);
 
@@ -156,11 +195,14 @@ LUMI_FUNC const TValue *lumH_Hgetshortstr (Table *t, TString *key);
 
 LUMI_FUNC int lumH_psetint (Table *t, lum_Integer key, TValue *val);
 LUMI_FUNC int lumH_psetshortstr (Table *t, TString *key, TValue *val);
+LUMI_FUNC int lumH_psetshortstrc (Table *t, TString *key, unsigned *c,
+                                             TValue *val);
 LUMI_FUNC int lumH_psetstr (Table *t, TString *key, TValue *val);
 LUMI_FUNC int lumH_pset (Table *t, const TValue *key, TValue *val);
 
 LUMI_FUNC void lumH_setint (lum_State *L, Table *t, lum_Integer key,
                                                     TValue *value);
+LUMI_FUNC void lumH_unchain (lum_State *L, Table *t);
 LUMI_FUNC void lumH_set (lum_State *L, Table *t, const TValue *key,
                                                  TValue *value);
 
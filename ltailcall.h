@@ -0,0 +1,213 @@
+/*
+** $Id: ltailcall.h $
+** Tail-call-threaded variant of the Lum interpreter
+** See Copyright Notice in lum.h
+*/
+
+/*
+** In this variant, each opcode is implemented by a separate function
+** (a "handler"), which receives the whole state of the interpreter as
+** arguments and ends by calling the handler of the next instruction.
+** As all these calls are tail calls, the compiler can turn them into
+** plain jumps, and each handler can keep the interpreter state in
+** registers, instead of sharing one huge function with all the other
+** opcodes. This works only if the compiler does eliminate those tail
+** calls (otherwise each instruction would use more C stack): compilers
+** with the 'musttail' attribute do it always; gcc does it with '-O2'
+** (but not with '-Og').
+*/
+
+
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define l_musttail	__attribute__((musttail))
+#endif
+#endif
+
+#if !defined(l_musttail) && defined(__GNUC__) && !defined(__OPTIMIZE__)
+#error "tail-call interpreter needs an optimizing compilation"
+#endif
+
+
+/* arguments of all handlers: the state of the interpreter */
+#define VMARGS	lum_State *L, CallInfo *ci, StkId base,  \
+		const Instruction *pc, Instruction i, int trap
+
+typedef void (*VMHandler) (VMARGS);
+
+/* handler for each opcode */
+LUMI_DDEC(const VMHandler lumV_disptab[NUM_OPCODES];)
+
+
+/* transfer control to handler 'h' */
+#if defined(l_musttail)
+#define vmtail(h)	{ l_musttail return h(L, ci, base, pc, i, trap); }
+#else
+#define vmtail(h)	{ h(L, ci, base, pc, i, trap); return; }
+#endif
+
+
+#undef vmcase
+#undef vmbreak
+#undef vmgoto
+#undef vmlabel
+
+#define vmcase(l)	static void vm_##l (VMARGS)
+
+#define vmbreak	{  \
+  vmfetch();  \
+  lum_assert(base == ci->func.p + 1);  \
+  lum_assert(base <= L->top.p && L->top.p <= L->stack_last.p);  \
+  lum_assert(lumP_isIT(i) || (cast_void(L->top.p = base), 1));  \
+  vmtail(lumV_disptab[GET_OPCODE(i)]); }
+
+#define vmgoto(l)	vmtail(l)
+#define vmlabel(l)	/* empty */
+
+/* labels used inside opcodes are the handlers of those opcodes */
+#define l_tforcall	vm_OP_TFORCALL
+#define l_tforloop	vm_OP_TFORLOOP
+
+vmcase(OP_TFORCALL);
+vmcase(OP_TFORLOOP);
+
+/* the closure and constants are not kept in registers */
+#define cl	ci_func(ci)
+#define k	(cl->p->k)
+
+
+/* start running the function of 'ci', with 'trap' already set */
+static void returning (VMARGS) {
+  pc = ci->u.l.savedpc;
+  if (l_unlikely(trap))
+    trap = lumG_tracecall(L);
+  base = ci->func.p + 1;
+  vmbreak;
+}
+
+
+/* start running the function of 'ci' */
+static void startfunc (VMARGS) {
+  trap = L->hookmask;
+  vmtail(returning);
+}
+
+
+/* return from a Lum function */
+static void ret (VMARGS) {
+  if (ci->callstatus & CIST_FRESH)
+    return;  /* end this frame */
+  else {
+    ci = ci->previous;
+    vmtail(returning);  /* continue running caller */
+  }
+}
+
+
+#include "lvmops.h"
+
+
+#undef cl
+#undef k
+
+
+LUMI_DDEF const VMHandler lumV_disptab[NUM_OPCODES] = {
+
+#if 0
+** you can update the following list with this command:
+**
+**  sed -n '/^OP_/\!d; s/OP_/vm_OP_/ ; s/,.*/,/ ; s/\/.*// ; p'  lopcodes.h
+**
+#endif
+
+vm_OP_MOVE,
+vm_OP_LOADI,
+vm_OP_LOADF,
+vm_OP_LOADK,
+vm_OP_LOADKX,
+vm_OP_LOADFALSE,
+vm_OP_LFALSESKIP,
+vm_OP_LOADTRUE,
+vm_OP_LOADNIL,
+vm_OP_GETUPVAL,
+vm_OP_SETUPVAL,
+vm_OP_GETTABUP,
+vm_OP_GETTABLE,
+vm_OP_GETI,
+vm_OP_GETFIELD,
+vm_OP_SETTABUP,
+vm_OP_SETTABLE,
+vm_OP_SETI,
+vm_OP_SETFIELD,
+vm_OP_NEWTABLE,
+vm_OP_SELF,
+vm_OP_ADDI,
+vm_OP_ADDK,
+vm_OP_SUBK,
+vm_OP_MULK,
+vm_OP_MODK,
+vm_OP_POWK,
+vm_OP_DIVK,
+vm_OP_IDIVK,
+vm_OP_BANDK,
+vm_OP_BORK,
+vm_OP_BXORK,
+vm_OP_SHRI,
+vm_OP_SHLI,
+vm_OP_ADD,
+vm_OP_SUB,
+vm_OP_MUL,
+vm_OP_MOD,
+vm_OP_POW,
+vm_OP_DIV,
+vm_OP_IDIV,
+vm_OP_BAND,
+vm_OP_BOR,
+vm_OP_BXOR,
+vm_OP_SHL,
+vm_OP_SHR,
+vm_OP_MMBIN,
+vm_OP_MMBINI,
+vm_OP_MMBINK,
+vm_OP_UNM,
+vm_OP_BNOT,
+vm_OP_NOT,
+vm_OP_LEN,
+vm_OP_CONCAT,
+vm_OP_CLOSE,
+vm_OP_TBC,
+vm_OP_JMP,
+vm_OP_EQ,
+vm_OP_LT,
+vm_OP_LE,
+vm_OP_EQK,
+vm_OP_EQI,
+vm_OP_LTI,
+vm_OP_LEI,
+vm_OP_GTI,
+vm_OP_GEI,
+vm_OP_TEST,
+vm_OP_TESTSET,
+vm_OP_CALL,
+vm_OP_TAILCALL,
+vm_OP_RETURN,
+vm_OP_RETURN0,
+vm_OP_RETURN1,
+vm_OP_FORLOOP,
+vm_OP_FORPREP,
+vm_OP_TFORPREP,
+vm_OP_TFORCALL,
+vm_OP_TFORLOOP,
+vm_OP_SETLIST,
+vm_OP_CLOSURE,
+vm_OP_VARARG,
+vm_OP_VARARGPREP,
+vm_OP_EXTRAARG
+
+};
+
+
+void lumV_execute (lum_State *L, CallInfo *ci) {
+  startfunc(L, ci, NULL, NULL, 0, 0);
+}
+
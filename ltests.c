@@ -316,8 +316,12 @@ static void printobj (global_State *g, GCObject *o) {
            ttypename(novariant(o->tt)), (void *)o,
            isdead(g,o) ? 'd' : isblack(o) ? 'b' : iswhite(o) ? 'w' : 'g',
            "ns01oTt"[getage(o)], o->marked);
-  if (o->tt == LUM_VSHRSTR || o->tt == LUM_VLNGSTR)
-    printf(" '%s'", getstr(gco2ts(o)));
+  if (o->tt == LUM_VSHRSTR || o->tt == LUM_VLNGSTR) {
+    if (isrope(gco2ts(o)))
+      printf(" (rope)");
+    else
+      printf(" '%s'", getstr(gco2ts(o)));
+  }
 }
 
 
@@ -336,7 +340,10 @@ void lum_printvalue (TValue *v) {
       break;
     }
     case LUM_TSTRING: {
-      printf("'%s'", getstr(tsvalue(v)));
+      if (isrope(tsvalue(v)))
+        printf("(rope)");
+      else
+        printf("'%s'", getstr(tsvalue(v)));
       break;
     }
     case LUM_TBOOLEAN: {
@@ -430,6 +437,7 @@ static void checkproto (global_State *g, Proto *f) {
   int i;
   GCObject *fgc = obj2gco(f);
   checkobjrefN(g, fgc, f->source);
+  checkobjrefN(g, fgc, f->cache);
   for (i=0; i<f->sizek; i++) {
     if (iscollectable(f->k + i))
       checkobjref(g, fgc, gcvalue(f->k + i));
@@ -531,7 +539,15 @@ static void checkrefs (global_State *g, GCObject *o) {
     }
     case LUM_VSHRSTR:
     case LUM_VLNGSTR: {
+      TString *ts = gco2ts(o);
       assert(!isgray(o));  /* strings are never gray */
+      if (isrope(ts)) {
+        assert(!strisshr(ropeleft(ts)) && !isrope(roperight(ts)));
+        assert(tsslen(ropeleft(ts)) + tsslen(roperight(ts)) ==
+               ts->u.lnglen);
+        checkobjref(g, o, obj2gco(ropeleft(ts)));
+        checkobjref(g, o, obj2gco(roperight(ts)));
+      }
       break;
     }
     default: assert(0);
@@ -665,6 +681,36 @@ static l_mem checklist (global_State *g, int maybedead, int tof,
 }
 
 
+/*
+** Check the string table: entries keep the hashes of their strings,
+** the current array has no dead slots, and 'nuse' counts the entries
+** of both arrays.
+*/
+static void checkstrtable (global_State *g) {
+  stringtable *tb = &g->strt;
+  int n = 0;
+  int i;
+  for (i = 0; i < tb->size; i++) {
+    TString *ts = tb->hash[i].ts;
+    if (ts == NULL)
+      assert(tb->hash[i].hash == 0);  /* no dead slots */
+    else {
+      assert(ts->tt == LUM_VSHRSTR && tb->hash[i].hash == ts->hash);
+      n++;
+    }
+  }
+  for (i = 0; i < tb->oldsize; i++) {
+    TString *ts = tb->old[i].ts;
+    if (ts != NULL) {
+      assert(i >= tb->moved && tb->old[i].hash == ts->hash);
+      n++;
+    }
+  }
+  assert(tb->old != NULL || tb->oldsize == 0);
+  assert(n == tb->nuse && n < tb->size);
+}
+
+
 int lum_checkmemory (lum_State *L) {
   global_State *g = G(L);
   GCObject *o;
@@ -702,6 +748,7 @@ int lum_checkmemory (lum_State *L) {
   }
   if (keepinvariant(g))
     assert(totalin == totalshould);
+  checkstrtable(g);
   return 0;
 }
 
@@ -1011,6 +1058,27 @@ static int gc_state (lum_State *L) {
 }
 
 
+/*
+** Take a heap snapshot with a writer that raises an error in its
+** call number 'n' + 1 (to test errors while writing snapshots).
+*/
+static int failwriter (lum_State *L, const void *b, size_t size,
+                       void *ud) {
+  int *n = (int *)ud;
+  UNUSED(b); UNUSED(size);
+  if ((*n)-- <= 0)
+    lumL_error(L, "error in snapshot writer");
+  return 0;
+}
+
+
+static int heapsnapshot (lum_State *L) {
+  int n = cast_int(lumL_optinteger(L, 1, 0));
+  lum_pushinteger(L, lum_heapsnapshot(L, failwriter, &n));
+  return 1;
+}
+
+
 static int tracinggc = 0;
 void lumi_tracegctest (lum_State *L, int first) {
   if (!tracinggc) return;
@@ -1146,14 +1214,12 @@ static int string_query (lum_State *L) {
     return 2;
   }
   else if (s < tb->size) {
-    TString *ts;
-    int n = 0;
-    for (ts = tb->hash[s]; ts != NULL; ts = ts->u.hnext) {
-      setsvalue2s(L, L->top.p, ts);
-      api_incr_top(L);
-      n++;
-    }
-    return n;
+    TString *ts = tb->hash[s].ts;
+    if (ts == NULL)  /* free slot? */
+      return 0;
+    setsvalue2s(L, L->top.p, ts);
+    api_incr_top(L);
+    return 1;
   }
   else return 0;
 }
@@ -1277,7 +1343,9 @@ static int makeseed (lum_State *L) {
 static int newstate (lum_State *L) {
   void *ud;
   lum_Alloc f = lum_getallocf(L, &ud);
-  lum_State *L1 = lum_newstate(f, ud, 0);
+  lum_StrPool *pool = cast(lum_StrPool *, lum_touserdata(L, 1));
+  lum_State *L1 = (pool != NULL) ? lum_newpooledstate(f, ud, pool)
+                                 : lum_newstate(f, ud, 0);
   if (L1) {
     lum_atpanic(L1, tpanic);
     lum_pushlightuserdata(L, L1);
@@ -1315,6 +1383,23 @@ static int closestate (lum_State *L) {
   return 0;
 }
 
+
+static int newstrpool (lum_State *L) {
+  lum_State *L1 = lum_isnone(L, 1) ? L : getstate(L);
+  lum_StrPool *pool = lum_newstrpool(L1);
+  lumL_argcheck(L, pool != NULL, 1, "cannot create pool");
+  lum_pushlightuserdata(L, pool);
+  return 1;
+}
+
+
+static int freestrpool (lum_State *L) {
+  lum_StrPool *pool = cast(lum_StrPool *, lum_touserdata(L, 1));
+  lumL_argcheck(L, pool != NULL, 1, "pool expected");
+  lum_freestrpool(pool);
+  return 0;
+}
+
 static int doremote (lum_State *L) {
   lum_State *L1 = getstate(L);
   size_t lcode;
@@ -2098,6 +2183,7 @@ static const struct lumL_Reg tests_funcs[] = {
   {"pobj", gc_printobj},
   {"getref", getref},
   {"hash", hash_query},
+  {"heapsnapshot", heapsnapshot},
   {"log2", log2_aux},
   {"limits", get_limits},
   {"listcode", listcode},
@@ -2108,6 +2194,8 @@ static const struct lumL_Reg tests_funcs[] = {
   {"loadlib", loadlib},
   {"checkpanic", checkpanic},
   {"newstate", newstate},
+  {"newstrpool", newstrpool},
+  {"freestrpool", freestrpool},
   {"newuserdata", newuserdata},
   {"num2int", num2int},
   {"makeseed", makeseed},
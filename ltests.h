@@ -141,6 +141,11 @@ LUM_API void *debug_realloc (void *ud, void *block,
 #define STRCACHE_N	23
 #define STRCACHE_M	5
 
+#define IDXCACHE_N	4
+
+#define MINROPELEN	50
+#define ROPECHUNK	60
+
 #undef LUMI_USER_ALIGNMENT_T
 #define LUMI_USER_ALIGNMENT_T   union { char b[sizeof(void*) * 8]; }
 
@@ -131,10 +131,17 @@ typedef void * (*lum_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 typedef void (*lum_WarnFunction) (void *ud, const char *msg, int tocont);
 
 
+/*
+** Type for pools of strings shared by several states
+*/
+typedef struct lum_StrPool lum_StrPool;
+
+
 /*
 ** Type used by the debug API to collect debug information
 */
 typedef struct lum_Debug lum_Debug;
+typedef struct lum_AllocSite lum_AllocSite;
 
 
 /*
@@ -168,6 +175,15 @@ LUM_API int        (lum_closethread) (lum_State *L, lum_State *from);
 LUM_API lum_CFunction (lum_atpanic) (lum_State *L, lum_CFunction panicf);
 
 
+/*
+** shared string pools
+*/
+LUM_API lum_StrPool *(lum_newstrpool) (lum_State *L);
+LUM_API void         (lum_freestrpool) (lum_StrPool *pool);
+LUM_API lum_State   *(lum_newpooledstate) (lum_Alloc f, void *ud,
+                                           const lum_StrPool *pool);
+
+
 LUM_API lum_Number (lum_version) (lum_State *L);
 
 
@@ -338,6 +354,8 @@ LUM_API void (lum_warning)  (lum_State *L, const char *msg, int tocont);
 #define LUM_GCGEN		7
 #define LUM_GCINC		8
 #define LUM_GCPARAM		9
+#define LUM_GCBEGINDEFER	10
+#define LUM_GCENDDEFER		11
 
 
 /*
@@ -424,6 +442,9 @@ LUM_API void (lum_closeslot) (lum_State *L, int idx);
 
 #define lum_replace(L,idx)	(lum_copy(L, -1, (idx)), lum_pop(L, 1))
 
+#define lum_begindefer(L)	lum_gc(L, LUM_GCBEGINDEFER)
+#define lum_enddefer(L)	lum_gc(L, LUM_GCENDDEFER)
+
 /* }============================================================== */
 
 
@@ -490,6 +511,11 @@ LUM_API lum_Hook (lum_gethook) (lum_State *L);
 LUM_API int (lum_gethookmask) (lum_State *L);
 LUM_API int (lum_gethookcount) (lum_State *L);
 
+LUM_API int (lum_heapsnapshot) (lum_State *L, lum_Writer writer, void *data);
+
+LUM_API int (lum_setallocsample) (lum_State *L, size_t rate);
+LUM_API int (lum_getallocsite) (lum_State *L, int n, lum_AllocSite *s);
+
 
 struct lum_Debug {
   int event;
@@ -511,6 +537,16 @@ struct lum_Debug {
   char short_src[LUM_IDSIZE]; /* (S) */
   /* private part */
   struct CallInfo *i_ci;  /* active function */
+  int i_inline;  /* inlined call in 'i_ci' shown as this frame (or -1) */
+};
+
+
+struct lum_AllocSite {
+  const char *stack;	/* call stack of the site, one frame per line */
+  size_t count;		/* number of sampled allocations */
+  size_t bytes;		/* estimated number of bytes allocated */
+  size_t livecount;	/* number of sampled allocations not yet freed */
+  size_t livebytes;	/* estimated number of bytes still in use */
 };
 
 /* }====================================================================== */
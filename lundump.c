@@ -237,6 +237,7 @@ static void loadConstants (LoadState *S, Proto *f) {
       default: lum_assert(0);
     }
   }
+  lumF_initkcache(S->L, f);
 }
 
 
@@ -316,6 +317,19 @@ static void loadDebug (LoadState *S, Proto *f) {
     n = f->sizeupvalues;  /* must be this many */
   for (i = 0; i < n; i++)
     loadString(S, f, &f->upvalues[i].name);
+  n = loadInt(S);
+  f->inlineinfo = lumM_newvectorchecked(S->L, n, InlineInfo);
+  f->sizeinlineinfo = n;
+  for (i = 0; i < n; i++) {
+    f->inlineinfo[i].startpc = loadInt(S);
+    f->inlineinfo[i].endpc = loadInt(S);
+    f->inlineinfo[i].line = loadInt(S);
+    f->inlineinfo[i].proto = loadInt(S);
+    if (f->inlineinfo[i].proto >= f->sizep)
+      error(S, "bad format for inlined call");
+    f->inlineinfo[i].reg = loadByte(S);
+    f->inlineinfo[i].base = loadByte(S);
+  }
 }
 
 
@@ -25,7 +25,11 @@
 */
 #define LUMC_VERSION	(LUM_VERSION_MAJOR_N*16+LUM_VERSION_MINOR_N)
 
-#define LUMC_FORMAT	0	/* this is the official format */
+/*
+** Format of binary chunks; changes whenever their layout changes
+** (format 1 added the debug information about inlined calls).
+*/
+#define LUMC_FORMAT	1
 
 
 /* load one chunk; from lundump.c */
@@ -12,6 +12,7 @@
 
 #include <assert.h>
 #include <limits.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -80,6 +81,111 @@ static const char *utf8_decode (const char *s, l_uint32 *val, int strict) {
 }
 
 
+/*
+** {======================================================
+** Bulk validation
+** =======================================================
+*/
+
+/* mask with the high bit of each byte of a 'size_t' */
+#define HIGHBITS	((~(size_t)0 / 0xFF) * 0x80)
+
+#define WORDSIZE	sizeof(size_t)
+
+
+/*
+** Skip the ASCII bytes at the beginning of [s, e), checking whole
+** words at a time (four of them at once, while possible). Returns the
+** start of the first word that is not all ASCII. (The caller handles
+** that word and any final piece shorter than a word.)
+*/
+static const char *skipascii (const char *s, const char *e) {
+  size_t w[4];
+  while (e - s >= (ptrdiff_t)sizeof(w)) {
+    memcpy(w, s, sizeof(w));
+    if ((w[0] | w[1] | w[2] | w[3]) & HIGHBITS)
+      break;
+    s += sizeof(w);
+  }
+  while (e - s >= (ptrdiff_t)WORDSIZE) {
+    memcpy(w, s, WORDSIZE);
+    if (w[0] & HIGHBITS)
+      break;
+    s += WORDSIZE;
+  }
+  return s;
+}
+
+
+/*
+** Check the UTF-8 sequence starting with a non-ASCII byte at 's'
+** following the well-formed byte sequences of the Unicode Standard
+** (Table 3-7), which exclude overlong forms, surrogates, and code
+** points larger than MAXUNICODE; that is, the same sequences accepted
+** by 'utf8_decode' in strict mode. Returns the position after the
+** sequence or NULL if it is invalid. (Each byte is checked before the
+** next one is read, so the final '\0' of the string stops the checks
+** at its end.)
+*/
+static const char *nextstrict (const char *s) {
+  const unsigned char *p = (const unsigned char *)s;
+  unsigned int c = p[0];
+  unsigned int lo = 0x80, hi = 0xBF;  /* range for second byte */
+  if (c < 0xC2)  /* continuation byte or overlong 2-byte sequence? */
+    return NULL;
+  else if (c < 0xE0)  /* 2-byte sequence */
+    return iscont(p[1]) ? s + 2 : NULL;
+  else if (c < 0xF0) {  /* 3-byte sequence */
+    if (c == 0xE0) lo = 0xA0;  /* avoid overlong sequences */
+    else if (c == 0xED) hi = 0x9F;  /* avoid surrogates */
+    return (lo <= p[1] && p[1] <= hi && iscont(p[2])) ? s + 3 : NULL;
+  }
+  else if (c < 0xF5) {  /* 4-byte sequence */
+    if (c == 0xF0) lo = 0x90;  /* avoid overlong sequences */
+    else if (c == 0xF4) hi = 0x8F;  /* avoid values above MAXUNICODE */
+    return (lo <= p[1] && p[1] <= hi && iscont(p[2]) && iscont(p[3]))
+           ? s + 4 : NULL;
+  }
+  else  /* code points above MAXUNICODE */
+    return NULL;
+}
+
+
+/*
+** Count in '*n' the characters that start in [s, e), which must be part
+** of a string. Returns NULL if they are all valid, or the position of
+** the first invalid one. Only non-ASCII characters are decoded one by
+** one.
+*/
+static const char *countchars (const char *s, const char *e, int strict,
+                               lum_Integer *n) {
+  lum_Integer count = 0;
+  while (s < e) {
+    if ((unsigned char)*s < 0x80) {  /* ASCII? */
+      const char *s1 = skipascii(s, e);
+      if (s1 == s) {  /* not a whole word of ASCII? */
+        s1++;  /* skip only this character */
+      }
+      count += s1 - s;
+      s = s1;
+    }
+    else {
+      const char *s1 = strict ? nextstrict(s) : utf8_decode(s, NULL, 0);
+      if (s1 == NULL) {  /* invalid sequence? */
+        *n = count;
+        return s;
+      }
+      count++;
+      s = s1;
+    }
+  }
+  *n = count;
+  return NULL;
+}
+
+/* }====================================================== */
+
+
 /*
 ** utf8len(s [, i [, j [, lax]]]) --> number of characters that
 ** start in the range [i,j], or nil + current position if 's' is not
@@ -96,21 +202,37 @@ static int utflen (lum_State *L) {
                    "initial position out of bounds");
   lumL_argcheck(L, --posj < (lum_Integer)len, 3,
                    "final position out of bounds");
-  while (posi <= posj) {
-    const char *s1 = utf8_decode(s + posi, NULL, !lax);
-    if (s1 == NULL) {  /* conversion error? */
+  if (posi <= posj) {
+    const char *e = countchars(s + posi, s + posj + 1, !lax, &n);
+    if (e != NULL) {  /* conversion error? */
       lumL_pushfail(L);  /* return fail ... */
-      lum_pushinteger(L, posi + 1);  /* ... and current position */
+      lum_pushinteger(L, ct_diff2S(e - s) + 1);  /* ... and its position */
       return 2;
     }
-    posi = ct_diff2S(s1 - s);
-    n++;
   }
   lum_pushinteger(L, n);
   return 1;
 }
 
 
+/*
+** valid(s [, lax]) --> true if 's' is well formed, or false + position
+** of its first invalid byte sequence
+*/
+static int utfvalid (lum_State *L) {
+  size_t len;
+  const char *s = lumL_checklstring(L, 1, &len);
+  int lax = lum_toboolean(L, 2);
+  lum_Integer n;
+  const char *e = countchars(s, s + len, !lax, &n);
+  lum_pushboolean(L, e == NULL);
+  if (e == NULL)
+    return 1;
+  lum_pushinteger(L, ct_diff2S(e - s) + 1);
+  return 2;
+}
+
+
 /*
 ** codepoint(s, [i, [j [, lax]]]) -> returns codepoints for all
 ** characters that start in the range [i,j]
@@ -276,6 +398,7 @@ static const lumL_Reg funcs[] = {
   {"char", utfchar},
   {"len", utflen},
   {"codes", iter_codes},
+  {"valid", utfvalid},
   /* placeholders */
   {"charpattern", NULL},
   {NULL, NULL}
@@ -45,6 +45,15 @@
 #endif
 
 
+/*
+** The tail-call interpreter (see 'ltailcall.h') is used only when
+** explicitly asked for.
+*/
+#if !defined(LUM_USE_TAILCALL)
+#define LUM_USE_TAILCALL	0
+#endif
+
+
 
 /* limit for table tag-method chains (to avoid infinite loops) */
 #define MAXTAGLOOP	2000
@@ -86,16 +95,20 @@
 ** If the value is not a string or is a string not representing
 ** a valid numeral (or if coercions from strings to numbers
 ** are disabled via macro 'cvt2num'), do not modify 'result'
-** and return 0.
+** and return 0. (A rope that cannot be flattened for lack of memory
+** is handled as not a numeral, as this function cannot raise errors.)
 */
-static int l_strton (const TValue *obj, TValue *result) {
+static int l_strton (lum_State *L, const TValue *obj, TValue *result) {
   lum_assert(obj != result);
   if (!cvt2num(obj))  /* is object not a string? */
     return 0;
   else {
     TString *st = tsvalue(obj);
     size_t stlen;
-    const char *s = getlstr(st, stlen);
+    const char *s;
+    if (l_unlikely(isrope(st)) && !lumS_tryflatten(L, st))
+      return 0;
+    s = getlstr(st, stlen);
     return (lumO_str2num(s, result) == stlen + 1);
   }
 }
@@ -105,13 +118,13 @@ static int l_strton (const TValue *obj, TValue *result) {
 ** Try to convert a value to a float. The float case is already handled
 ** by the macro 'tonumber'.
 */
-int lumV_tonumber_ (const TValue *obj, lum_Number *n) {
+int lumV_tonumber_ (lum_State *L, const TValue *obj, lum_Number *n) {
   TValue v;
   if (ttisinteger(obj)) {
     *n = cast_num(ivalue(obj));
     return 1;
   }
-  else if (l_strton(obj, &v)) {  /* string coercible to number? */
+  else if (l_strton(L, obj, &v)) {  /* string coercible to number? */
     *n = nvalue(&v);  /* convert result of 'lumO_str2num' to a float */
     return 1;
   }
@@ -154,9 +167,10 @@ int lumV_tointegerns (const TValue *obj, lum_Integer *p, F2Imod mode) {
 /*
 ** try to convert a value to an integer.
 */
-int lumV_tointeger (const TValue *obj, lum_Integer *p, F2Imod mode) {
+int lumV_tointeger (lum_State *L, const TValue *obj, lum_Integer *p,
+                                    F2Imod mode) {
   TValue v;
-  if (l_strton(obj, &v))  /* does 'obj' point to a numerical string? */
+  if (l_strton(L, obj, &v))  /* does 'obj' point to a numerical string? */
     obj = &v;  /* change it to point to its corresponding number */
   return lumV_tointegerns(obj, p, mode);
 }
@@ -180,10 +194,10 @@ int lumV_tointeger (const TValue *obj, lum_Integer *p, F2Imod mode) {
 */
 static int forlimit (lum_State *L, lum_Integer init, const TValue *lim,
                                    lum_Integer *p, lum_Integer step) {
-  if (!lumV_tointeger(lim, p, (step < 0 ? F2Iceil : F2Ifloor))) {
+  if (!lumV_tointeger(L, lim, p, (step < 0 ? F2Iceil : F2Ifloor))) {
     /* not coercible to in integer */
     lum_Number flim;  /* try to convert to float */
-    if (!tonumber(lim, &flim)) /* cannot convert to float? */
+    if (!tonumber(L, lim, &flim)) /* cannot convert to float? */
       lumG_forerror(L, lim, "limit");
     /* else 'flim' is a float out of integer bounds */
     if (lumi_numlt(0, flim)) {  /* if it is positive, it is too large */
@@ -243,11 +257,11 @@ static int forprep (lum_State *L, StkId ra) {
   }
   else {  /* try making all values floats */
     lum_Number init; lum_Number limit; lum_Number step;
-    if (l_unlikely(!tonumber(plimit, &limit)))
+    if (l_unlikely(!tonumber(L, plimit, &limit)))
       lumG_forerror(L, plimit, "limit");
-    if (l_unlikely(!tonumber(pstep, &step)))
+    if (l_unlikely(!tonumber(L, pstep, &step)))
       lumG_forerror(L, pstep, "step");
-    if (l_unlikely(!tonumber(pinit, &init)))
+    if (l_unlikely(!tonumber(L, pinit, &init)))
       lumG_forerror(L, pinit, "initial value");
     if (step == 0)
       lumG_runerror(L, "'for' step is zero");
@@ -285,6 +299,104 @@ static int floatforloop (StkId ra) {
 }
 
 
+/*
+** {==================================================================
+** Cache for '__index' chains
+** ===================================================================
+*/
+
+#define idxentry(g,mt,key)  \
+	(&(g)->idxcache[lmod(point2uint(mt) ^ (key)->hash, IDXCACHE_N)])
+
+
+/*
+** Invalidate all entries in the cache, by changing its epoch. (When
+** the epoch wraps around, all entries are erased, so that old entries
+** cannot become valid again.)
+*/
+void lumV_clearidxcache (global_State *g) {
+  if (l_unlikely(++g->idxepoch == 0)) {
+    int i;
+    for (i = 0; i < IDXCACHE_N; i++)
+      g->idxcache[i].epoch = 0;
+    g->idxepoch = 1;
+  }
+}
+
+
+static Table *getmetatable (lum_State *L, const TValue *o) {
+  switch (ttype(o)) {
+    case LUM_TTABLE: return hvalue(o)->metatable;
+    case LUM_TUSERDATA: return uvalue(o)->metatable;
+    default: return G(L)->mt[ttype(o)];
+  }
+}
+
+
+/*
+** Index with short string 'key' a value with metatable 'mt' that does
+** not have that key, following a chain of '__index' tables. Marks all
+** tables in the chain, so that changes to their keys or to their
+** '__index' fields invalidate the cache. Returns the slot with the
+** result, or NULL if the chain has a function or is too long.
+*/
+static const TValue *indexchain (lum_State *L, Table *mt, TString *key) {
+  int loop;
+  for (loop = 0; loop < MAXTAGLOOP; loop++) {
+    const TValue *tm;
+    const TValue *slot;
+    Table *h;
+    setinchain(mt);  /* a new '__index' would change the chain */
+    tm = fasttm(L, mt, TM_INDEX);
+    if (tm == NULL || !ttistable(tm))
+      return NULL;
+    h = hvalue(tm);
+    setinchain(h);
+    slot = lumH_Hgetshortstr(h, key);
+    if (!isempty(slot))
+      return slot;  /* found it */
+    mt = h->metatable;
+    if (mt == NULL)
+      return &G(L)->nilvalue;  /* end of the chain; result is nil */
+  }
+  return NULL;  /* let 'lumV_finishget' raise the error */
+}
+
+
+/*
+** Try to finish the access 'val = t[key]' for a short-string key using
+** the cache. ('t' must not have that key itself, and its '__index' must
+** be a table.) Returns the tag of the result or LUM_VABSTKEY if the
+** chain cannot be cached. The cache keeps the slot where the result was
+** found, so that assignments to existing fields do not invalidate it;
+** a slot that became empty (its field was erased) is a cache miss.
+*/
+static lu_byte cachedget (lum_State *L, const TValue *t, TString *key,
+                                        StkId val) {
+  global_State *g = G(L);
+  Table *mt = getmetatable(L, t);
+  IdxCache *e;
+  const TValue *res;
+  lum_assert(mt != NULL);
+  e = idxentry(g, mt, key);
+  res = e->slot;
+  if (!(e->mt == mt && e->key == key && e->epoch == g->idxepoch &&
+        (res == NULL || res == &g->nilvalue || !isempty(res)))) {
+    res = indexchain(L, mt, key);  /* (NULL is cached, too) */
+    e->mt = mt;
+    e->key = key;
+    e->epoch = g->idxepoch;
+    e->slot = res;
+  }
+  if (res == NULL)  /* chain cannot be cached? */
+    return LUM_VABSTKEY;
+  setobj2s(L, val, res);
+  return ttypetag(res);
+}
+
+/* }================================================================== */
+
+
 /*
 ** Finish the table access 'val = t[key]' and return the tag of the result.
 */
@@ -312,6 +424,11 @@ lu_byte lumV_finishget (lum_State *L, const TValue *t, TValue *key,
       tag = lumT_callTMres(L, tm, t, key, val);  /* call it */
       return tag;  /* return tag of the result */
     }
+    if (loop == 0 && ttisshrstring(key)) {  /* start of a chain of tables? */
+      lu_byte res = cachedget(L, t, tsvalue(key), val);
+      if (res != LUM_VABSTKEY)
+        return res;
+    }
     t = tm;  /* else try to access 'tm[key]' */
     lumV_fastget(t, key, s2v(val), lumH_get, tag);
     if (!tagisempty(tag))
@@ -333,6 +450,14 @@ void lumV_finishset (lum_State *L, const TValue *t, TValue *key,
     const TValue *tm;  /* '__newindex' metamethod */
     if (hres != HNOTATABLE) {  /* is 't' a table? */
       Table *h = hvalue(t);  /* save 't' table */
+      if (l_unlikely(hres == HINCHAIN)) {  /* 'h' in a cached chain? */
+        lumH_unchain(L, h);
+        hres = lumH_pset(h, key, val);  /* try again */
+        if (hres == HOK) {
+          lumV_finishfastset(L, t, val);
+          return;
+        }
+      }
       tm = fasttm(L, h->metatable, TM_NEWINDEX);  /* get metamethod */
       if (tm == NULL) {  /* no metamethod? */
         lumH_finishset(L, h, key, val, hres);  /* set new value */
@@ -368,13 +493,18 @@ void lumV_finishset (lum_State *L, const TValue *t, TValue *key,
 ** The code is a little tricky because it allows '\0' in the strings
 ** and it uses 'strcoll' (to respect locales) for each segment
 ** of the strings. Note that segments can compare equal but still
-** have different lengths.
+** have different lengths. Ropes are flattened, as 'strcoll' needs
+** contiguous strings.
 */
-static int l_strcmp (const TString *ts1, const TString *ts2) {
+static int l_strcmp (lum_State *L, TString *ts1, TString *ts2) {
   size_t rl1;  /* real length */
-  const char *s1 = getlstr(ts1, rl1);
+  const char *s1;
   size_t rl2;
-  const char *s2 = getlstr(ts2, rl2);
+  const char *s2;
+  lumS_flat(L, ts1);
+  lumS_flat(L, ts2);
+  s1 = getlstr(ts1, rl1);
+  s2 = getlstr(ts2, rl2);
   for (;;) {  /* for each segment */
     int temp = strcoll(s1, s2);
     if (temp != 0)  /* not equal? */
@@ -519,7 +649,7 @@ l_sinline int LEnum (const TValue *l, const TValue *r) {
 static int lessthanothers (lum_State *L, const TValue *l, const TValue *r) {
   lum_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else
     return lumT_callorderTM(L, l, r, TM_LT);
 }
@@ -541,7 +671,7 @@ int lumV_lessthan (lum_State *L, const TValue *l, const TValue *r) {
 static int lessequalothers (lum_State *L, const TValue *l, const TValue *r) {
   lum_assert(!ttisnumber(l) || !ttisnumber(r));
   if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else
     return lumT_callorderTM(L, l, r, TM_LE);
 }
@@ -624,14 +754,60 @@ static void copy2buff (StkId top, int n, char *buff) {
   size_t tl = 0;  /* size already copied */
   do {
     TString *st = tsvalue(s2v(top - n));
-    size_t l;  /* length of string being copied */
-    const char *s = getlstr(st, l);
-    memcpy(buff + tl, s, l * sizeof(char));
+    size_t l = tsslen(st);  /* length of string being copied */
+    if (l_unlikely(isrope(st)))
+      lumS_copyrope(st, buff + tl);
+    else
+      memcpy(buff + tl, getstr(st), l * sizeof(char));
     tl += l;
   } while (--n > 0);
 }
 
 
+/*
+** Concatenate the 'n' strings in the stack from 'top - n' up to
+** 'top - 1', with total length 'tl', when the first one is long: the
+** result is a rope that shares that first string, so that repeated
+** appends to a string do not copy it over and over. The other strings
+** form the right part of the rope. (A single string that is not a rope
+** is used as is.) If the first string is a rope whose right part is
+** small, that part is merged with the new strings, so that repeated
+** small appends do not create a long chain of tiny pieces.
+*/
+static TString *ropeconcat (lum_State *L, StkId top, int n, size_t tl) {
+  TString *left = tsvalue(s2v(top - n));
+  TString *last = NULL;  /* old right part to be merged, if any */
+  TString *right;
+  size_t rl = tl - tsslen(left);  /* length of the new right part */
+  if (isrope(left) && tsslen(roperight(left)) + rl <= ROPECHUNK) {
+    last = roperight(left);
+    left = ropeleft(left);
+    rl += tsslen(last);
+  }
+  if (last == NULL && n == 2 && !isrope(tsvalue(s2v(top - 1))))
+    right = tsvalue(s2v(top - 1));  /* use second string as right part */
+  else {
+    char buff[LUMI_MAXSHORTLEN];
+    char *b = buff;
+    size_t ll = 0;  /* length of 'last' */
+    if (rl > LUMI_MAXSHORTLEN) {  /* is right part a long string? */
+      right = lumS_createlngstrobj(L, rl);
+      b = getlngstr(right);  /* copy strings directly to it */
+    }
+    if (last != NULL) {
+      const char *s = getlstr(last, ll);
+      memcpy(b, s, ll * sizeof(char));
+    }
+    copy2buff(top, n - 1, b + ll);
+    if (rl <= LUMI_MAXSHORTLEN)
+      right = lumS_newlstr(L, buff, rl);
+    /* anchor new part (its copy to the buffer is done) */
+    setsvalue2s(L, top - 1, right);
+  }
+  return lumS_newrope(L, left, right);
+}
+
+
 /*
 ** Main operation for concatenation: concat 'total' values in the stack,
 ** from 'L->top.p - total' up to 'L->top.p - 1'.
@@ -668,6 +844,8 @@ void lumV_concat (lum_State *L, int total) {
         copy2buff(top, n, buff);  /* copy strings to buffer */
         ts = lumS_newlstr(L, buff, tl);
       }
+      else if (tsslen(tsvalue(s2v(top - n))) >= MINROPELEN)
+        ts = ropeconcat(L, top, n, tl);  /* share long first string */
       else {  /* long string; copy strings directly to final result */
         ts = lumS_createlngstrobj(L, tl);
         copy2buff(top, n, getlngstr(ts));
@@ -782,16 +960,44 @@ lum_Integer lumV_shiftl (lum_Integer x, lum_Integer y) {
 }
 
 
+/*
+** check whether cached closure in prototype 'p' may be reused, that is,
+** whether there is a cached closure with the same upvalues needed by
+** new closure to be created.
+*/
+static LClosure *getcached (Proto *p, UpVal **encup, StkId base) {
+  LClosure *c = p->cache;
+  if (c != NULL) {  /* is there a cached closure? */
+    int nup = p->sizeupvalues;
+    Upvaldesc *uv = p->upvalues;
+    int i;
+    for (i = 0; i < nup; i++) {  /* check whether it has right upvalues */
+      TValue *v = uv[i].instack ? s2v(base + uv[i].idx)
+                                : encup[uv[i].idx]->v.p;
+      if (c->upvals[i]->v.p != v)
+        return NULL;  /* wrong upvalue; cannot reuse closure */
+    }
+  }
+  return c;  /* return cached closure (or NULL if no cached closure) */
+}
+
+
 /*
 ** create a new Lum closure, push it in the stack, and initialize
-** its upvalues.
+** its upvalues. Reuse the closure cached in the prototype when it has
+** the same upvalues; otherwise, cache the new closure.
 */
 static void pushclosure (lum_State *L, Proto *p, UpVal **encup, StkId base,
                          StkId ra) {
   int nup = p->sizeupvalues;
   Upvaldesc *uv = p->upvalues;
   int i;
-  LClosure *ncl = lumF_newLclosure(L, nup);
+  LClosure *ncl = getcached(p, encup, base);
+  if (ncl != NULL) {  /* can reuse cached closure? */
+    setclLvalue2s(L, ra, ncl);
+    return;
+  }
+  ncl = lumF_newLclosure(L, nup);
   ncl->p = p;
   setclLvalue2s(L, ra, ncl);  /* anchor new closure in stack */
   for (i = 0; i < nup; i++) {  /* fill in its upvalues */
@@ -801,6 +1007,8 @@ static void pushclosure (lum_State *L, Proto *p, UpVal **encup, StkId base,
       ncl->upvals[i] = encup[uv[i].idx];
     lumC_objbarrier(L, ncl, ncl->upvals[i]);
   }
+  p->cache = ncl;  /* save it on cache for reuse */
+  lumC_objbarrierback(L, obj2gco(p), ncl);  /* keep 'ncl' young */
 }
 
 
@@ -1151,6 +1359,12 @@ void lumV_finishOp (lum_State *L) {
 #define vmcase(l)	case l:
 #define vmbreak		break
 
+/* jump to a label of the interpreter ('lvmops.h' cannot use 'goto') */
+#define vmgoto(l)	goto l
+#define vmlabel(l)	l:
+
+
+#if !LUM_USE_TAILCALL
 
 void lumV_execute (lum_State *L, CallInfo *ci) {
   LClosure *cl;
@@ -1187,730 +1401,22 @@ void lumV_execute (lum_State *L, CallInfo *ci) {
     /* for tests, invalidate top for instructions not expecting it */
     lum_assert(lumP_isIT(i) || (cast_void(L->top.p = base), 1));
     vmdispatch (GET_OPCODE(i)) {
-      vmcase(OP_MOVE) {
-        StkId ra = RA(i);
-        setobjs2s(L, ra, RB(i));
-        vmbreak;
-      }
-      vmcase(OP_LOADI) {
-        StkId ra = RA(i);
-        lum_Integer b = GETARG_sBx(i);
-        setivalue(s2v(ra), b);
-        vmbreak;
-      }
-      vmcase(OP_LOADF) {
-        StkId ra = RA(i);
-        int b = GETARG_sBx(i);
-        setfltvalue(s2v(ra), cast_num(b));
-        vmbreak;
-      }
-      vmcase(OP_LOADK) {
-        StkId ra = RA(i);
-        TValue *rb = k + GETARG_Bx(i);
-        setobj2s(L, ra, rb);
-        vmbreak;
-      }
-      vmcase(OP_LOADKX) {
-        StkId ra = RA(i);
-        TValue *rb;
-        rb = k + GETARG_Ax(*pc); pc++;
-        setobj2s(L, ra, rb);
-        vmbreak;
-      }
-      vmcase(OP_LOADFALSE) {
-        StkId ra = RA(i);
-        setbfvalue(s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_LFALSESKIP) {
-        StkId ra = RA(i);
-        setbfvalue(s2v(ra));
-        pc++;  /* skip next instruction */
-        vmbreak;
-      }
-      vmcase(OP_LOADTRUE) {
-        StkId ra = RA(i);
-        setbtvalue(s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_LOADNIL) {
-        StkId ra = RA(i);
-        int b = GETARG_B(i);
-        do {
-          setnilvalue(s2v(ra++));
-        } while (b--);
-        vmbreak;
-      }
-      vmcase(OP_GETUPVAL) {
-        StkId ra = RA(i);
-        int b = GETARG_B(i);
-        setobj2s(L, ra, cl->upvals[b]->v.p);
-        vmbreak;
-      }
-      vmcase(OP_SETUPVAL) {
-        StkId ra = RA(i);
-        UpVal *uv = cl->upvals[GETARG_B(i)];
-        setobj(L, uv->v.p, s2v(ra));
-        lumC_barrier(L, uv, s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_GETTABUP) {
-        StkId ra = RA(i);
-        TValue *upval = cl->upvals[GETARG_B(i)]->v.p;
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        lumV_fastget(upval, key, s2v(ra), lumH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(lumV_finishget(L, upval, rc, ra, tag));
-        vmbreak;
-      }
-      vmcase(OP_GETTABLE) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = vRC(i);
-        lu_byte tag;
-        if (ttisinteger(rc)) {  /* fast track for integers? */
-          lumV_fastgeti(rb, ivalue(rc), s2v(ra), tag);
-        }
-        else
-          lumV_fastget(rb, rc, s2v(ra), lumH_get, tag);
-        if (tagisempty(tag))
-          Protect(lumV_finishget(L, rb, rc, ra, tag));
-        vmbreak;
-      }
-      vmcase(OP_GETI) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        int c = GETARG_C(i);
-        lu_byte tag;
-        lumV_fastgeti(rb, c, s2v(ra), tag);
-        if (tagisempty(tag)) {
-          TValue key;
-          setivalue(&key, c);
-          Protect(lumV_finishget(L, rb, &key, ra, tag));
-        }
-        vmbreak;
-      }
-      vmcase(OP_GETFIELD) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        lu_byte tag;
-        lumV_fastget(rb, key, s2v(ra), lumH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(lumV_finishget(L, rb, rc, ra, tag));
-        vmbreak;
-      }
-      vmcase(OP_SETTABUP) {
-        int hres;
-        TValue *upval = cl->upvals[GETARG_A(i)]->v.p;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a short string */
-        lumV_fastset(upval, key, rc, hres, lumH_psetshortstr);
-        if (hres == HOK)
-          lumV_finishfastset(L, upval, rc);
-        else
-          Protect(lumV_finishset(L, upval, rb, rc, hres));
-        vmbreak;
-      }
-      vmcase(OP_SETTABLE) {
-        StkId ra = RA(i);
-        int hres;
-        TValue *rb = vRB(i);  /* key (table is in 'ra') */
-        TValue *rc = RKC(i);  /* value */
-        if (ttisinteger(rb)) {  /* fast track for integers? */
-          lumV_fastseti(s2v(ra), ivalue(rb), rc, hres);
-        }
-        else {
-          lumV_fastset(s2v(ra), rb, rc, hres, lumH_pset);
-        }
-        if (hres == HOK)
-          lumV_finishfastset(L, s2v(ra), rc);
-        else
-          Protect(lumV_finishset(L, s2v(ra), rb, rc, hres));
-        vmbreak;
-      }
-      vmcase(OP_SETI) {
-        StkId ra = RA(i);
-        int hres;
-        int b = GETARG_B(i);
-        TValue *rc = RKC(i);
-        lumV_fastseti(s2v(ra), b, rc, hres);
-        if (hres == HOK)
-          lumV_finishfastset(L, s2v(ra), rc);
-        else {
-          TValue key;
-          setivalue(&key, b);
-          Protect(lumV_finishset(L, s2v(ra), &key, rc, hres));
-        }
-        vmbreak;
-      }
-      vmcase(OP_SETFIELD) {
-        StkId ra = RA(i);
-        int hres;
-        TValue *rb = KB(i);
-        TValue *rc = RKC(i);
-        TString *key = tsvalue(rb);  /* key must be a short string */
-        lumV_fastset(s2v(ra), key, rc, hres, lumH_psetshortstr);
-        if (hres == HOK)
-          lumV_finishfastset(L, s2v(ra), rc);
-        else
-          Protect(lumV_finishset(L, s2v(ra), rb, rc, hres));
-        vmbreak;
-      }
-      vmcase(OP_NEWTABLE) {
-        StkId ra = RA(i);
-        unsigned b = cast_uint(GETARG_vB(i));  /* log2(hash size) + 1 */
-        unsigned c = cast_uint(GETARG_vC(i));  /* array size */
-        Table *t;
-        if (b > 0)
-          b = 1u << (b - 1);  /* hash size is 2^(b - 1) */
-        if (TESTARG_k(i)) {  /* non-zero extra argument? */
-          lum_assert(GETARG_Ax(*pc) != 0);
-          /* add it to array size */
-          c += cast_uint(GETARG_Ax(*pc)) * (MAXARG_vC + 1);
-        }
-        pc++;  /* skip extra argument */
-        L->top.p = ra + 1;  /* correct top in case of emergency GC */
-        t = lumH_new(L);  /* memory allocation */
-        sethvalue2s(L, ra, t);
-        if (b != 0 || c != 0)
-          lumH_resize(L, t, c, b);  /* idem */
-        checkGC(L, ra + 1);
-        vmbreak;
-      }
-      vmcase(OP_SELF) {
-        StkId ra = RA(i);
-        lu_byte tag;
-        TValue *rb = vRB(i);
-        TValue *rc = KC(i);
-        TString *key = tsvalue(rc);  /* key must be a short string */
-        setobj2s(L, ra + 1, rb);
-        lumV_fastget(rb, key, s2v(ra), lumH_getshortstr, tag);
-        if (tagisempty(tag))
-          Protect(lumV_finishget(L, rb, rc, ra, tag));
-        vmbreak;
-      }
-      vmcase(OP_ADDI) {
-        op_arithI(L, l_addi, lumi_numadd);
-        vmbreak;
-      }
-      vmcase(OP_ADDK) {
-        op_arithK(L, l_addi, lumi_numadd);
-        vmbreak;
-      }
-      vmcase(OP_SUBK) {
-        op_arithK(L, l_subi, lumi_numsub);
-        vmbreak;
-      }
-      vmcase(OP_MULK) {
-        op_arithK(L, l_muli, lumi_nummul);
-        vmbreak;
-      }
-      vmcase(OP_MODK) {
-        savestate(L, ci);  /* in case of division by 0 */
-        op_arithK(L, lumV_mod, lumV_modf);
-        vmbreak;
-      }
-      vmcase(OP_POWK) {
-        op_arithfK(L, lumi_numpow);
-        vmbreak;
-      }
-      vmcase(OP_DIVK) {
-        op_arithfK(L, lumi_numdiv);
-        vmbreak;
-      }
-      vmcase(OP_IDIVK) {
-        savestate(L, ci);  /* in case of division by 0 */
-        op_arithK(L, lumV_idiv, lumi_numidiv);
-        vmbreak;
-      }
-      vmcase(OP_BANDK) {
-        op_bitwiseK(L, l_band);
-        vmbreak;
-      }
-      vmcase(OP_BORK) {
-        op_bitwiseK(L, l_bor);
-        vmbreak;
-      }
-      vmcase(OP_BXORK) {
-        op_bitwiseK(L, l_bxor);
-        vmbreak;
-      }
-      vmcase(OP_SHRI) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        int ic = GETARG_sC(i);
-        lum_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          pc++; setivalue(s2v(ra), lumV_shiftl(ib, -ic));
-        }
-        vmbreak;
-      }
-      vmcase(OP_SHLI) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        int ic = GETARG_sC(i);
-        lum_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          pc++; setivalue(s2v(ra), lumV_shiftl(ic, ib));
-        }
-        vmbreak;
-      }
-      vmcase(OP_ADD) {
-        op_arith(L, l_addi, lumi_numadd);
-        vmbreak;
-      }
-      vmcase(OP_SUB) {
-        op_arith(L, l_subi, lumi_numsub);
-        vmbreak;
-      }
-      vmcase(OP_MUL) {
-        op_arith(L, l_muli, lumi_nummul);
-        vmbreak;
-      }
-      vmcase(OP_MOD) {
-        savestate(L, ci);  /* in case of division by 0 */
-        op_arith(L, lumV_mod, lumV_modf);
-        vmbreak;
-      }
-      vmcase(OP_POW) {
-        op_arithf(L, lumi_numpow);
-        vmbreak;
-      }
-      vmcase(OP_DIV) {  /* float division (always with floats) */
-        op_arithf(L, lumi_numdiv);
-        vmbreak;
-      }
-      vmcase(OP_IDIV) {  /* floor division */
-        savestate(L, ci);  /* in case of division by 0 */
-        op_arith(L, lumV_idiv, lumi_numidiv);
-        vmbreak;
-      }
-      vmcase(OP_BAND) {
-        op_bitwise(L, l_band);
-        vmbreak;
-      }
-      vmcase(OP_BOR) {
-        op_bitwise(L, l_bor);
-        vmbreak;
-      }
-      vmcase(OP_BXOR) {
-        op_bitwise(L, l_bxor);
-        vmbreak;
-      }
-      vmcase(OP_SHR) {
-        op_bitwise(L, lumV_shiftr);
-        vmbreak;
-      }
-      vmcase(OP_SHL) {
-        op_bitwise(L, lumV_shiftl);
-        vmbreak;
-      }
-      vmcase(OP_MMBIN) {
-        StkId ra = RA(i);
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        TValue *rb = vRB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        StkId result = RA(pi);
-        lum_assert(OP_ADD <= GET_OPCODE(pi) && GET_OPCODE(pi) <= OP_SHR);
-        Protect(lumT_trybinTM(L, s2v(ra), rb, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_MMBINI) {
-        StkId ra = RA(i);
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        int imm = GETARG_sB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        int flip = GETARG_k(i);
-        StkId result = RA(pi);
-        Protect(lumT_trybiniTM(L, s2v(ra), imm, flip, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_MMBINK) {
-        StkId ra = RA(i);
-        Instruction pi = *(pc - 2);  /* original arith. expression */
-        TValue *imm = KB(i);
-        TMS tm = (TMS)GETARG_C(i);
-        int flip = GETARG_k(i);
-        StkId result = RA(pi);
-        Protect(lumT_trybinassocTM(L, s2v(ra), imm, flip, result, tm));
-        vmbreak;
-      }
-      vmcase(OP_UNM) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        lum_Number nb;
-        if (ttisinteger(rb)) {
-          lum_Integer ib = ivalue(rb);
-          setivalue(s2v(ra), intop(-, 0, ib));
-        }
-        else if (tonumberns(rb, nb)) {
-          setfltvalue(s2v(ra), lumi_numunm(L, nb));
-        }
-        else
-          Protect(lumT_trybinTM(L, rb, rb, ra, TM_UNM));
-        vmbreak;
-      }
-      vmcase(OP_BNOT) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        lum_Integer ib;
-        if (tointegerns(rb, &ib)) {
-          setivalue(s2v(ra), intop(^, ~l_castS2U(0), ib));
-        }
-        else
-          Protect(lumT_trybinTM(L, rb, rb, ra, TM_BNOT));
-        vmbreak;
-      }
-      vmcase(OP_NOT) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        if (l_isfalse(rb))
-          setbtvalue(s2v(ra));
-        else
-          setbfvalue(s2v(ra));
-        vmbreak;
-      }
-      vmcase(OP_LEN) {
-        StkId ra = RA(i);
-        Protect(lumV_objlen(L, ra, vRB(i)));
-        vmbreak;
-      }
-      vmcase(OP_CONCAT) {
-        StkId ra = RA(i);
-        int n = GETARG_B(i);  /* number of elements to concatenate */
-        L->top.p = ra + n;  /* mark the end of concat operands */
-        ProtectNT(lumV_concat(L, n));
-        checkGC(L, L->top.p); /* 'lumV_concat' ensures correct top */
-        vmbreak;
-      }
-      vmcase(OP_CLOSE) {
-        StkId ra = RA(i);
-        lum_assert(!GETARG_B(i));  /* 'close must be alive */
-        Protect(lumF_close(L, ra, LUM_OK, 1));
-        vmbreak;
-      }
-      vmcase(OP_TBC) {
-        StkId ra = RA(i);
-        /* create new to-be-closed upvalue */
-        halfProtect(lumF_newtbcupval(L, ra));
-        vmbreak;
-      }
-      vmcase(OP_JMP) {
-        dojump(ci, i, 0);
-        vmbreak;
-      }
-      vmcase(OP_EQ) {
-        StkId ra = RA(i);
-        int cond;
-        TValue *rb = vRB(i);
-        Protect(cond = lumV_equalobj(L, s2v(ra), rb));
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_LT) {
-        op_order(L, l_lti, LTnum, lessthanothers);
-        vmbreak;
-      }
-      vmcase(OP_LE) {
-        op_order(L, l_lei, LEnum, lessequalothers);
-        vmbreak;
-      }
-      vmcase(OP_EQK) {
-        StkId ra = RA(i);
-        TValue *rb = KB(i);
-        /* basic types do not use '__eq'; we can use raw equality */
-        int cond = lumV_rawequalobj(s2v(ra), rb);
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_EQI) {
-        StkId ra = RA(i);
-        int cond;
-        int im = GETARG_sB(i);
-        if (ttisinteger(s2v(ra)))
-          cond = (ivalue(s2v(ra)) == im);
-        else if (ttisfloat(s2v(ra)))
-          cond = lumi_numeq(fltvalue(s2v(ra)), cast_num(im));
-        else
-          cond = 0;  /* other types cannot be equal to a number */
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_LTI) {
-        op_orderI(L, l_lti, lumi_numlt, 0, TM_LT);
-        vmbreak;
-      }
-      vmcase(OP_LEI) {
-        op_orderI(L, l_lei, lumi_numle, 0, TM_LE);
-        vmbreak;
-      }
-      vmcase(OP_GTI) {
-        op_orderI(L, l_gti, lumi_numgt, 1, TM_LT);
-        vmbreak;
-      }
-      vmcase(OP_GEI) {
-        op_orderI(L, l_gei, lumi_numge, 1, TM_LE);
-        vmbreak;
-      }
-      vmcase(OP_TEST) {
-        StkId ra = RA(i);
-        int cond = !l_isfalse(s2v(ra));
-        docondjump();
-        vmbreak;
-      }
-      vmcase(OP_TESTSET) {
-        StkId ra = RA(i);
-        TValue *rb = vRB(i);
-        if (l_isfalse(rb) == GETARG_k(i))
-          pc++;
-        else {
-          setobj2s(L, ra, rb);
-          donextjump(ci);
-        }
-        vmbreak;
-      }
-      vmcase(OP_CALL) {
-        StkId ra = RA(i);
-        CallInfo *newci;
-        int b = GETARG_B(i);
-        int nresults = GETARG_C(i) - 1;
-        if (b != 0)  /* fixed number of arguments? */
-          L->top.p = ra + b;  /* top signals number of arguments */
-        /* else previous instruction set top */
-        savepc(L);  /* in case of errors */
-        if ((newci = lumD_precall(L, ra, nresults)) == NULL)
-          updatetrap(ci);  /* C call; nothing else to be done */
-        else {  /* Lum call: run function in this same C frame */
-          ci = newci;
-          goto startfunc;
-        }
-        vmbreak;
-      }
-      vmcase(OP_TAILCALL) {
-        StkId ra = RA(i);
-        int b = GETARG_B(i);  /* number of arguments + 1 (function) */
-        int n;  /* number of results when calling a C function */
-        int nparams1 = GETARG_C(i);
-        /* delta is virtual 'func' - real 'func' (vararg functions) */
-        int delta = (nparams1) ? ci->u.l.nextraargs + nparams1 : 0;
-        if (b != 0)
-          L->top.p = ra + b;
-        else  /* previous instruction set top */
-          b = cast_int(L->top.p - ra);
-        savepc(ci);  /* several calls here can raise errors */
-        if (TESTARG_k(i)) {
-          lumF_closeupval(L, base);  /* close upvalues from current call */
-          lum_assert(L->tbclist.p < base);  /* no pending tbc variables */
-          lum_assert(base == ci->func.p + 1);
-        }
-        if ((n = lumD_pretailcall(L, ci, ra, b, delta)) < 0)  /* Lum function? */
-          goto startfunc;  /* execute the callee */
-        else {  /* C function? */
-          ci->func.p -= delta;  /* restore 'func' (if vararg) */
-          lumD_poscall(L, ci, n);  /* finish caller */
-          updatetrap(ci);  /* 'lumD_poscall' can change hooks */
-          goto ret;  /* caller returns after the tail call */
-        }
-      }
-      vmcase(OP_RETURN) {
-        StkId ra = RA(i);
-        int n = GETARG_B(i) - 1;  /* number of results */
-        int nparams1 = GETARG_C(i);
-        if (n < 0)  /* not fixed? */
-          n = cast_int(L->top.p - ra);  /* get what is available */
-        savepc(ci);
-        if (TESTARG_k(i)) {  /* may there be open upvalues? */
-          ci->u2.nres = n;  /* save number of returns */
-          if (L->top.p < ci->top.p)
-            L->top.p = ci->top.p;
-          lumF_close(L, base, CLOSEKTOP, 1);
-          updatetrap(ci);
-          updatestack(ci);
-        }
-        if (nparams1)  /* vararg function? */
-          ci->func.p -= ci->u.l.nextraargs + nparams1;
-        L->top.p = ra + n;  /* set call for 'lumD_poscall' */
-        lumD_poscall(L, ci, n);
-        updatetrap(ci);  /* 'lumD_poscall' can change hooks */
-        goto ret;
-      }
-      vmcase(OP_RETURN0) {
-        if (l_unlikely(L->hookmask)) {
-          StkId ra = RA(i);
-          L->top.p = ra;
-          savepc(ci);
-          lumD_poscall(L, ci, 0);  /* no hurry... */
-          trap = 1;
-        }
-        else {  /* do the 'poscall' here */
-          int nres = get_nresults(ci->callstatus);
-          L->ci = ci->previous;  /* back to caller */
-          L->top.p = base - 1;
-          for (; l_unlikely(nres > 0); nres--)
-            setnilvalue(s2v(L->top.p++));  /* all results are nil */
-        }
-        goto ret;
-      }
-      vmcase(OP_RETURN1) {
-        if (l_unlikely(L->hookmask)) {
-          StkId ra = RA(i);
-          L->top.p = ra + 1;
-          savepc(ci);
-          lumD_poscall(L, ci, 1);  /* no hurry... */
-          trap = 1;
-        }
-        else {  /* do the 'poscall' here */
-          int nres = get_nresults(ci->callstatus);
-          L->ci = ci->previous;  /* back to caller */
-          if (nres == 0)
-            L->top.p = base - 1;  /* asked for no results */
-          else {
-            StkId ra = RA(i);
-            setobjs2s(L, base - 1, ra);  /* at least this result */
-            L->top.p = base;
-            for (; l_unlikely(nres > 1); nres--)
-              setnilvalue(s2v(L->top.p++));  /* complete missing results */
-          }
-        }
-       ret:  /* return from a Lum function */
-        if (ci->callstatus & CIST_FRESH)
-          return;  /* end this frame */
-        else {
-          ci = ci->previous;
-          goto returning;  /* continue running caller in this frame */
-        }
-      }
-      vmcase(OP_FORLOOP) {
-        StkId ra = RA(i);
-        if (ttisinteger(s2v(ra + 1))) {  /* integer loop? */
-          lum_Unsigned count = l_castS2U(ivalue(s2v(ra)));
-          if (count > 0) {  /* still more iterations? */
-            lum_Integer step = ivalue(s2v(ra + 1));
-            lum_Integer idx = ivalue(s2v(ra + 2));  /* control variable */
-            chgivalue(s2v(ra), l_castU2S(count - 1));  /* update counter */
-            idx = intop(+, idx, step);  /* add step to index */
-            chgivalue(s2v(ra + 2), idx);  /* update control variable */
-            pc -= GETARG_Bx(i);  /* jump back */
-          }
-        }
-        else if (floatforloop(ra))  /* float loop */
-          pc -= GETARG_Bx(i);  /* jump back */
-        updatetrap(ci);  /* allows a signal to break the loop */
-        vmbreak;
-      }
-      vmcase(OP_FORPREP) {
-        StkId ra = RA(i);
-        savestate(L, ci);  /* in case of errors */
-        if (forprep(L, ra))
-          pc += GETARG_Bx(i) + 1;  /* skip the loop */
-        vmbreak;
-      }
-      vmcase(OP_TFORPREP) {
-       /* before: 'ra' has the iterator function, 'ra + 1' has the state,
-          'ra + 2' has the initial value for the control variable, and
-          'ra + 3' has the closing variable. This opcode then swaps the
-          control and the closing variables and marks the closing variable
-          as to-be-closed.
-       */
-       StkId ra = RA(i);
-       TValue temp;  /* to swap control and closing variables */
-       setobj(L, &temp, s2v(ra + 3));
-       setobjs2s(L, ra + 3, ra + 2);
-       setobj2s(L, ra + 2, &temp);
-        /* create to-be-closed upvalue (if closing var. is not nil) */
-        halfProtect(lumF_newtbcupval(L, ra + 2));
-        pc += GETARG_Bx(i);  /* go to end of the loop */
-        i = *(pc++);  /* fetch next instruction */
-        lum_assert(GET_OPCODE(i) == OP_TFORCALL && ra == RA(i));
-        goto l_tforcall;
-      }
-      vmcase(OP_TFORCALL) {
-       l_tforcall: {
-        /* 'ra' has the iterator function, 'ra + 1' has the state,
-           'ra + 2' has the closing variable, and 'ra + 3' has the control
-           variable. The call will use the stack starting at 'ra + 3',
-           so that it preserves the first three values, and the first
-           return will be the new value for the control variable.
-        */
-        StkId ra = RA(i);
-        setobjs2s(L, ra + 5, ra + 3);  /* copy the control variable */
-        setobjs2s(L, ra + 4, ra + 1);  /* copy state */
-        setobjs2s(L, ra + 3, ra);  /* copy function */
-        L->top.p = ra + 3 + 3;
-        ProtectNT(lumD_call(L, ra + 3, GETARG_C(i)));  /* do the call */
-        updatestack(ci);  /* stack may have changed */
-        i = *(pc++);  /* go to next instruction */
-        lum_assert(GET_OPCODE(i) == OP_TFORLOOP && ra == RA(i));
-        goto l_tforloop;
-      }}
-      vmcase(OP_TFORLOOP) {
-       l_tforloop: {
-        StkId ra = RA(i);
-        if (!ttisnil(s2v(ra + 3)))  /* continue loop? */
-          pc -= GETARG_Bx(i);  /* jump back */
-        vmbreak;
-      }}
-      vmcase(OP_SETLIST) {
-        StkId ra = RA(i);
-        unsigned n = cast_uint(GETARG_vB(i));
-        unsigned int last = cast_uint(GETARG_vC(i));
-        Table *h = hvalue(s2v(ra));
-        if (n == 0)
-          n = cast_uint(L->top.p - ra) - 1;  /* get up to the top */
-        else
-          L->top.p = ci->top.p;  /* correct top in case of emergency GC */
-        last += n;
-        if (TESTARG_k(i)) {
-          last += cast_uint(GETARG_Ax(*pc)) * (MAXARG_vC + 1);
-          pc++;
-        }
-        /* when 'n' is known, table should have proper size */
-        if (last > h->asize) {  /* needs more space? */
-          /* fixed-size sets should have space preallocated */
-          lum_assert(GETARG_vB(i) == 0);
-          lumH_resizearray(L, h, last);  /* preallocate it at once */
-        }
-        for (; n > 0; n--) {
-          TValue *val = s2v(ra + n);
-          obj2arr(h, last - 1, val);
-          last--;
-          lumC_barrierback(L, obj2gco(h), val);
-        }
-        vmbreak;
-      }
-      vmcase(OP_CLOSURE) {
-        StkId ra = RA(i);
-        Proto *p = cl->p->p[GETARG_Bx(i)];
-        halfProtect(pushclosure(L, p, cl->upvals, base, ra));
-        checkGC(L, ra + 1);
-        vmbreak;
-      }
-      vmcase(OP_VARARG) {
-        StkId ra = RA(i);
-        int n = GETARG_C(i) - 1;  /* required results */
-        Protect(lumT_getvarargs(L, ci, ra, n));
-        vmbreak;
-      }
-      vmcase(OP_VARARGPREP) {
-        ProtectNT(lumT_adjustvarargs(L, GETARG_A(i), ci, cl->p));
-        if (l_unlikely(trap)) {  /* previous "Protect" updated trap */
-          lumD_hookcall(L, ci);
-          L->oldpc = 1;  /* next opcode will be seen as a "new" line */
-        }
-        updatebase(ci);  /* function has new base after adjustment */
-        vmbreak;
-      }
-      vmcase(OP_EXTRAARG) {
-        lum_assert(0);
-        vmbreak;
-      }
+#include "lvmops.h"
     }
   }
+ ret:  /* return from a Lum function */
+  if (ci->callstatus & CIST_FRESH)
+    return;  /* end this frame */
+  else {
+    ci = ci->previous;
+    goto returning;  /* continue running caller in this frame */
+  }
 }
 
+#else
+
+#include "ltailcall.h"
+
+#endif
+
 /* }================================================================== */
@@ -48,8 +48,8 @@ typedef enum {
 
 
 /* convert an object to a float (including string coercion) */
-#define tonumber(o,n) \
-	(ttisfloat(o) ? (*(n) = fltvalue(o), 1) : lumV_tonumber_(o,n))
+#define tonumber(L,o,n) \
+	(ttisfloat(o) ? (*(n) = fltvalue(o), 1) : lumV_tonumber_(L,o,n))
 
 
 /* convert an object to a float (without string coercion) */
@@ -59,9 +59,9 @@ typedef enum {
 
 
 /* convert an object to an integer (including string coercion) */
-#define tointeger(o,i) \
+#define tointeger(L,o,i) \
   (l_likely(ttisinteger(o)) ? (*(i) = ivalue(o), 1) \
-                          : lumV_tointeger(o,i,LUM_FLOORN2I))
+                          : lumV_tointeger(L,o,i,LUM_FLOORN2I))
 
 
 /* convert an object to an integer (without string coercion) */
@@ -91,6 +91,19 @@ typedef enum {
   else { lumH_fastgeti(hvalue(t), k, res, tag); }
 
 
+/*
+** Special cases of 'lumV_fastget'/'lumV_fastset' for constant short
+** strings, using the node-index cache 'c' of the constant.
+*/
+#define lumV_fastgetk(t,k,c,res,tag) \
+  if (!ttistable(t)) tag = LUM_VNOTABLE; \
+  else { lumH_fastgetk(hvalue(t), k, c, res, tag); }
+
+#define lumV_fastsetk(t,k,c,val,hres) \
+  if (!ttistable(t)) hres = HNOTATABLE; \
+  else { lumH_fastsetk(hvalue(t), k, c, val, hres); }
+
+
 #define lumV_fastset(t,k,val,hres,f) \
   (hres = (!ttistable(t) ? HNOTATABLE : f(hvalue(t), k, val)))
 
@@ -115,11 +128,14 @@ typedef enum {
 LUMI_FUNC int lumV_equalobj (lum_State *L, const TValue *t1, const TValue *t2);
 LUMI_FUNC int lumV_lessthan (lum_State *L, const TValue *l, const TValue *r);
 LUMI_FUNC int lumV_lessequal (lum_State *L, const TValue *l, const TValue *r);
-LUMI_FUNC int lumV_tonumber_ (const TValue *obj, lum_Number *n);
-LUMI_FUNC int lumV_tointeger (const TValue *obj, lum_Integer *p, F2Imod mode);
+LUMI_FUNC int lumV_tonumber_ (lum_State *L, const TValue *obj,
+                                                  lum_Number *n);
+LUMI_FUNC int lumV_tointeger (lum_State *L, const TValue *obj,
+                                            lum_Integer *p, F2Imod mode);
 LUMI_FUNC int lumV_tointegerns (const TValue *obj, lum_Integer *p,
                                 F2Imod mode);
 LUMI_FUNC int lumV_flttointeger (lum_Number n, lum_Integer *p, F2Imod mode);
+LUMI_FUNC void lumV_clearidxcache (global_State *g);
 LUMI_FUNC lu_byte lumV_finishget (lum_State *L, const TValue *t, TValue *key,
                                                 StkId val, lu_byte tag);
 LUMI_FUNC void lumV_finishset (lum_State *L, const TValue *t, TValue *key,